@@ -0,0 +1,458 @@
+/*
+ * jscore-bench.c - Microbenchmarks for the binding boundary
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <JavaScriptCore/JavaScript.h>
+
+#include "jscore-context.h"
+#include "jscore-class.h"
+#include "jscore-object.h"
+#include "jscore-value.h"
+
+typedef struct
+{
+  JSCoreContext *context;
+  JSCoreClass *klass;
+  JSCoreObject *object;
+  JSCoreObject *function;
+  JSCoreValue *value;
+  GVariant *variant;
+  gchar *string;
+  gsize size;
+} BenchState;
+
+typedef struct
+{
+  const gchar *name;
+  gsize size;
+  void (*setup) (BenchState *state);
+  void (*run) (BenchState *state, guint64 iterations);
+} Benchmark;
+
+/* Keeps results alive so the loops are not optimized away */
+static volatile gdouble sink;
+
+static gint n_samples = 20;
+static gdouble min_time_ms = 10.0;
+static gchar *filter = NULL;
+static gchar *output = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "samples", 's', 0, G_OPTION_ARG_INT, &n_samples, "Samples per benchmark", "N" },
+  { "min-time", 't', 0, G_OPTION_ARG_DOUBLE, &min_time_ms, "Minimum time per sample", "MS" },
+  { "filter", 'f', 0, G_OPTION_ARG_STRING, &filter, "Only run benchmarks containing STRING", "STRING" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write JSON results to FILE", "FILE" },
+  { NULL }
+};
+
+static guint64
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static void
+setup_string (BenchState *state)
+{
+  state->string = g_malloc (state->size + 1);
+  memset (state->string, 'x', state->size);
+  state->string[state->size] = '\0';
+  state->value = jscore_value_new_string (state->context, state->string);
+  jscore_value_ref (state->context, state->value);
+}
+
+static void
+setup_object (BenchState *state)
+{
+  state->klass = jscore_class_new ((const JSCoreClassDefinition *) &kJSClassDefinitionEmpty);
+  state->object = jscore_object_new (state->context, state->klass, NULL);
+  jscore_object_set_property (state->object, "x",
+                              jscore_value_new_number (state->context, 1),
+                              JS_CORE_PROPERTY_ATTRIBUTE_NONE, NULL);
+}
+
+static void
+setup_function (BenchState *state)
+{
+  GArray *names = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  gchar *a = "a", *b = "b";
+
+  g_array_append_val (names, a);
+  g_array_append_val (names, b);
+  state->function = jscore_object_new_from_function (state->context, "add", names,
+                                                     "return a + b;", NULL, NULL);
+  g_array_free (names, TRUE);
+
+  state->variant = g_variant_ref_sink (g_variant_new ("(dd)", 1.0, 2.0));
+}
+
+static void
+setup_variant (BenchState *state)
+{
+  GVariantBuilder builder;
+  gsize i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  for (i = 0; i < state->size; i++)
+    {
+      gchar *key = g_strdup_printf ("key%" G_GSIZE_FORMAT, i);
+
+      g_variant_builder_add (&builder, "{sv}", key, g_variant_new_double (i));
+      g_free (key);
+    }
+  state->variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+  state->value = jscore_value_new_variant (state->context, state->variant, NULL);
+  jscore_value_ref (state->context, state->value);
+}
+
+static void
+run_new_number (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = GPOINTER_TO_SIZE (jscore_value_new_number (state->context, i));
+}
+
+static void
+run_new_boolean (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = GPOINTER_TO_SIZE (jscore_value_new_boolean (state->context, i & 1));
+}
+
+static void
+run_new_null (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = GPOINTER_TO_SIZE (jscore_value_new_null (state->context));
+}
+
+static void
+run_get_number (BenchState *state, guint64 iterations)
+{
+  JSCoreValue *value = jscore_value_new_number (state->context, 42);
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = jscore_value_get_number (state->context, value);
+}
+
+static void
+run_get_boolean (BenchState *state, guint64 iterations)
+{
+  JSCoreValue *value = jscore_value_new_boolean (state->context, TRUE);
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = jscore_value_get_boolean (state->context, value);
+}
+
+static void
+run_new_string (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = GPOINTER_TO_SIZE (jscore_value_new_string (state->context, state->string));
+}
+
+static void
+run_get_string (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      gchar *str = jscore_value_get_string (state->context, state->value);
+
+      sink = str[0];
+      g_free (str);
+    }
+}
+
+static void
+run_string_round_trip (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      JSCoreValue *value = jscore_value_new_string (state->context, state->string);
+      gchar *str = jscore_value_get_string (state->context, value);
+
+      sink = str[0];
+      g_free (str);
+    }
+}
+
+static void
+run_get_property (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = GPOINTER_TO_SIZE (jscore_object_get_property (state->object, "x", NULL));
+}
+
+static void
+run_set_property (BenchState *state, guint64 iterations)
+{
+  JSCoreValue *value = jscore_value_new_number (state->context, 2);
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    jscore_object_set_property (state->object, "x", value,
+                                JS_CORE_PROPERTY_ATTRIBUTE_NONE, NULL);
+}
+
+static void
+run_call_as_function (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = GPOINTER_TO_SIZE (jscore_object_call_as_function (state->function, NULL,
+                                                             state->variant, NULL));
+}
+
+static void
+run_new_variant (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    sink = GPOINTER_TO_SIZE (jscore_value_new_variant (state->context, state->variant, NULL));
+}
+
+static void
+run_to_variant (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      GVariant *variant = jscore_value_to_variant (state->value, state->context);
+
+      sink = GPOINTER_TO_SIZE (variant);
+      if (variant)
+        g_variant_unref (variant);
+    }
+}
+
+static void
+run_context_new (BenchState *state, guint64 iterations)
+{
+  guint64 i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      JSCoreContext *context = jscore_context_new ();
+
+      sink = GPOINTER_TO_SIZE (context);
+      g_object_unref (context);
+    }
+}
+
+static const Benchmark benchmarks[] =
+{
+  { "value/new_number", 0, NULL, run_new_number },
+  { "value/new_boolean", 0, NULL, run_new_boolean },
+  { "value/new_null", 0, NULL, run_new_null },
+  { "value/get_number", 0, NULL, run_get_number },
+  { "value/get_boolean", 0, NULL, run_get_boolean },
+  { "string/new/16", 16, setup_string, run_new_string },
+  { "string/new/1024", 1024, setup_string, run_new_string },
+  { "string/new/65536", 65536, setup_string, run_new_string },
+  { "string/get/16", 16, setup_string, run_get_string },
+  { "string/get/1024", 1024, setup_string, run_get_string },
+  { "string/get/65536", 65536, setup_string, run_get_string },
+  { "string/round_trip/16", 16, setup_string, run_string_round_trip },
+  { "string/round_trip/1024", 1024, setup_string, run_string_round_trip },
+  { "string/round_trip/65536", 65536, setup_string, run_string_round_trip },
+  { "object/get_property", 0, setup_object, run_get_property },
+  { "object/set_property", 0, setup_object, run_set_property },
+  { "object/call_as_function", 0, setup_function, run_call_as_function },
+  { "variant/new_variant/1", 1, setup_variant, run_new_variant },
+  { "variant/new_variant/64", 64, setup_variant, run_new_variant },
+  { "variant/to_variant/1", 1, setup_variant, run_to_variant },
+  { "variant/to_variant/64", 64, setup_variant, run_to_variant },
+  { "context/new", 0, NULL, run_context_new },
+};
+
+static void
+state_clear (BenchState *state)
+{
+  if (state->value)
+    jscore_value_unref (state->context, state->value);
+  if (state->object)
+    g_object_unref (state->object);
+  if (state->function)
+    g_object_unref (state->function);
+  if (state->klass)
+    g_object_unref (state->klass);
+  if (state->variant)
+    g_variant_unref (state->variant);
+  g_free (state->string);
+  g_object_unref (state->context);
+}
+
+static gint
+compare_doubles (gconstpointer a, gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a, db = *(const gdouble *) b;
+
+  return da < db ? -1 : da > db;
+}
+
+/* Doubles the iteration count until one sample takes at least
+ * min_time_ms, which also serves as the warmup */
+static guint64
+calibrate (const Benchmark *bench, BenchState *state)
+{
+  guint64 iterations = 1;
+  guint64 target = min_time_ms * 1e6;
+
+  while (TRUE)
+    {
+      guint64 start = now_ns ();
+
+      bench->run (state, iterations);
+      if (now_ns () - start >= target || iterations >= G_GUINT64_CONSTANT (1) << 40)
+        return iterations;
+      iterations *= 2;
+    }
+}
+
+static void
+run_benchmark (const Benchmark *bench, GString *json, gboolean first)
+{
+  BenchState state = { 0 };
+  gdouble *samples = g_new (gdouble, n_samples);
+  gdouble mean = 0, variance = 0, stddev, median;
+  guint64 iterations;
+  gint i;
+
+  state.context = jscore_context_new ();
+  state.size = bench->size;
+  if (bench->setup)
+    bench->setup (&state);
+
+  iterations = calibrate (bench, &state);
+
+  for (i = 0; i < n_samples; i++)
+    {
+      guint64 start = now_ns ();
+
+      bench->run (&state, iterations);
+      samples[i] = (gdouble) (now_ns () - start) / iterations;
+      mean += samples[i];
+    }
+  mean /= n_samples;
+
+  for (i = 0; i < n_samples; i++)
+    variance += (samples[i] - mean) * (samples[i] - mean);
+  stddev = n_samples > 1 ? sqrt (variance / (n_samples - 1)) : 0;
+
+  qsort (samples, n_samples, sizeof (gdouble), compare_doubles);
+  median = n_samples % 2 ? samples[n_samples / 2]
+    : (samples[n_samples / 2 - 1] + samples[n_samples / 2]) / 2;
+
+  g_string_append_printf (json,
+                          "%s\n    {\"name\": \"%s\", \"iterations\": %" G_GUINT64_FORMAT ", "
+                          "\"ns_per_op\": {\"mean\": %.3f, \"median\": %.3f, \"stddev\": %.3f, "
+                          "\"min\": %.3f, \"max\": %.3f, \"ci95\": %.3f}}",
+                          first ? "" : ",", bench->name, iterations,
+                          mean, median, stddev, samples[0], samples[n_samples - 1],
+                          1.96 * stddev / sqrt (n_samples));
+
+  g_printerr ("%-28s %12.1f ns/op (+/- %.1f)\n", bench->name, median, stddev);
+
+  g_free (samples);
+  state_clear (&state);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *options;
+  GError *error = NULL;
+  GString *json;
+  gboolean first = TRUE;
+  guint i;
+
+  options = g_option_context_new ("- benchmark javascriptcore-gobject");
+  g_option_context_add_main_entries (options, entries, NULL);
+  if (!g_option_context_parse (options, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+  g_option_context_free (options);
+
+  if (n_samples < 1)
+    n_samples = 1;
+
+  json = g_string_new (NULL);
+  g_string_append_printf (json, "{\n  \"version\": 1,\n  \"library\": \"%s\",\n"
+                          "  \"samples\": %d,\n  \"min_time_ms\": %.3f,\n  \"benchmarks\": [",
+                          PACKAGE_STRING, n_samples, min_time_ms);
+
+  for (i = 0; i < G_N_ELEMENTS (benchmarks); i++)
+    {
+      if (filter && !strstr (benchmarks[i].name, filter))
+        continue;
+      run_benchmark (&benchmarks[i], json, first);
+      first = FALSE;
+    }
+
+  g_string_append (json, "\n  ]\n}\n");
+
+  if (output)
+    {
+      if (!g_file_set_contents (output, json->str, json->len, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          g_error_free (error);
+          g_string_free (json, TRUE);
+          return 1;
+        }
+    }
+  else
+    fputs (json->str, stdout);
+
+  g_string_free (json, TRUE);
+
+  return 0;
+}
@@ -0,0 +1,471 @@
+/*
+ * jscore-stress.c - Context lifecycle and throughput stress harness
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <glib.h>
+#include <JavaScriptCore/JavaScript.h>
+
+#include "jscore-context.h"
+#include "jscore-context-group.h"
+#include "jscore-class.h"
+#include "jscore-object.h"
+#include "jscore-value.h"
+
+typedef enum
+{
+  WORKLOAD_EVAL,
+  WORKLOAD_CALL,
+  WORKLOAD_OBJECT,
+  WORKLOAD_STRING,
+  WORKLOAD_VARIANT,
+  N_WORKLOADS,
+  /* Not part of the mix, timed for every context */
+  WORKLOAD_LIFECYCLE = N_WORKLOADS,
+  N_TIMINGS
+} Workload;
+
+static const gchar *workload_names[N_TIMINGS] =
+{
+  "eval", "call", "object", "string", "variant", "lifecycle"
+};
+
+typedef struct
+{
+  guint index;
+  GThread *thread;
+  GArray *latencies[N_TIMINGS];
+  guint64 n_ops;
+  gint errors;
+} Worker;
+
+typedef struct
+{
+  guint64 t_ms;
+  guint64 rss_kb;
+  guint protected;
+  guint contexts;
+} Sample;
+
+static gint n_threads = 4;
+static gint n_contexts = 1000;
+static gint n_ops = 16;
+static gint interval_ms = 100;
+static gint seed = 1;
+static gchar *mix = NULL;
+static gchar *output = NULL;
+
+static guint weights[N_WORKLOADS] = { 4, 2, 2, 1, 1 };
+static guint total_weight;
+
+static gint contexts_done = 0;
+static gint workers_running = 0;
+
+static GOptionEntry entries[] =
+{
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &n_threads, "Worker threads", "N" },
+  { "contexts", 'c', 0, G_OPTION_ARG_INT, &n_contexts, "Contexts created and destroyed per thread", "N" },
+  { "ops", 'n', 0, G_OPTION_ARG_INT, &n_ops, "Operations per context", "N" },
+  { "mix", 'm', 0, G_OPTION_ARG_STRING, &mix, "Workload weights, e.g. eval=4,call=2,object=2,string=1,variant=1", "MIX" },
+  { "interval", 'i', 0, G_OPTION_ARG_INT, &interval_ms, "RSS and protect set sampling interval", "MS" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Random seed", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write JSON results to FILE", "FILE" },
+  { NULL }
+};
+
+static const gchar eval_script[] =
+  "var a = []; for (var i = 0; i < 64; i++) a.push({ i: i, s: 'v' + i }); "
+  "JSON.stringify(a).length";
+
+static guint64
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static guint64
+current_rss_kb (void)
+{
+  guint64 size, resident = 0;
+  FILE *f = fopen ("/proc/self/statm", "r");
+
+  if (f == NULL)
+    return 0;
+  if (fscanf (f, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &size, &resident) != 2)
+    resident = 0;
+  fclose (f);
+
+  return resident * sysconf (_SC_PAGESIZE) / 1024;
+}
+
+static gboolean
+parse_mix (const gchar *spec, GError **error)
+{
+  gchar **items = g_strsplit (spec, ",", -1);
+  gchar **item;
+  guint i;
+
+  memset (weights, 0, sizeof (weights));
+
+  for (item = items; *item; item++)
+    {
+      gchar **pair = g_strsplit (*item, "=", 2);
+
+      for (i = 0; i < N_WORKLOADS; i++)
+        if (g_strcmp0 (pair[0], workload_names[i]) == 0)
+          break;
+
+      if (i == N_WORKLOADS || pair[1] == NULL)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Invalid workload '%s'", *item);
+          g_strfreev (pair);
+          g_strfreev (items);
+          return FALSE;
+        }
+
+      weights[i] = atoi (pair[1]);
+      g_strfreev (pair);
+    }
+
+  g_strfreev (items);
+  return TRUE;
+}
+
+static Workload
+pick_workload (GRand *rand)
+{
+  guint n = g_rand_int_range (rand, 0, total_weight);
+  guint i;
+
+  for (i = 0; i < N_WORKLOADS - 1; i++)
+    {
+      if (n < weights[i])
+        break;
+      n -= weights[i];
+    }
+
+  return i;
+}
+
+static gboolean
+run_workload (Workload workload,
+              JSCoreContext *context,
+              JSCoreClass *klass,
+              JSCoreObject *function,
+              const gchar *string)
+{
+  GError *error = NULL;
+
+  switch (workload)
+    {
+    case WORKLOAD_EVAL:
+      jscore_context_evaluate_script (context, eval_script, NULL, 1, &error);
+      break;
+
+    case WORKLOAD_CALL:
+      {
+        GVariant *args = g_variant_ref_sink (g_variant_new ("(dd)", 1.0, 2.0));
+
+        jscore_object_call_as_function (function, NULL, args, &error);
+        g_variant_unref (args);
+      }
+      break;
+
+    case WORKLOAD_OBJECT:
+      {
+        JSCoreObject *object = jscore_object_new (context, klass, NULL);
+
+        jscore_object_set_property (object, "x", jscore_value_new_number (context, 1),
+                                    JS_CORE_PROPERTY_ATTRIBUTE_NONE, &error);
+        if (error == NULL)
+          jscore_object_get_property (object, "x", &error);
+        g_object_unref (object);
+      }
+      break;
+
+    case WORKLOAD_STRING:
+      g_free (jscore_value_get_string (context, jscore_value_new_string (context, string)));
+      break;
+
+    case WORKLOAD_VARIANT:
+      {
+        GVariant *variant = g_variant_ref_sink (g_variant_new_parsed ("{'a': <1.0>, 'b': <'text'>, 'c': <[1.0, 2.0, 3.0]>}"));
+        JSCoreValue *value = jscore_value_new_variant (context, variant, &error);
+
+        if (error == NULL)
+          {
+            GVariant *back = jscore_value_to_variant (value, context);
+
+            if (back)
+              g_variant_unref (back);
+          }
+        g_variant_unref (variant);
+      }
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  if (error)
+    {
+      g_error_free (error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gpointer
+worker_thread (gpointer data)
+{
+  Worker *worker = data;
+  GRand *rand = g_rand_new_with_seed (seed + worker->index);
+  JSCoreContextGroup *group = g_object_new (JSCORE_TYPE_CONTEXT_GROUP, NULL);
+  JSCoreClass *klass = jscore_class_new ((const JSCoreClassDefinition *) &kJSClassDefinitionEmpty);
+  gchar *string = g_strnfill (1024, 'x');
+  GArray *names = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  gchar *a = "a", *b = "b";
+  gint i, j;
+
+  g_array_append_val (names, a);
+  g_array_append_val (names, b);
+
+  for (i = 0; i < n_contexts; i++)
+    {
+      guint64 start = now_ns (), lifecycle;
+      JSCoreContext *context = jscore_context_new_in_group (NULL, group);
+      JSCoreObject *function =
+        jscore_object_new_from_function (context, "add", names, "return a + b;", NULL, NULL);
+
+      lifecycle = now_ns () - start;
+
+      for (j = 0; j < n_ops; j++)
+        {
+          Workload workload = pick_workload (rand);
+          guint64 op_start = now_ns (), elapsed;
+
+          if (!run_workload (workload, context, klass, function, string))
+            worker->errors++;
+
+          elapsed = now_ns () - op_start;
+          g_array_append_val (worker->latencies[workload], elapsed);
+          worker->n_ops++;
+        }
+
+      start = now_ns ();
+      g_object_unref (function);
+      g_object_unref (context);
+      lifecycle += now_ns () - start;
+      g_array_append_val (worker->latencies[WORKLOAD_LIFECYCLE], lifecycle);
+
+      g_atomic_int_inc (&contexts_done);
+    }
+
+  g_array_free (names, TRUE);
+  g_free (string);
+  g_object_unref (klass);
+  g_object_unref (group);
+  g_rand_free (rand);
+
+  g_atomic_int_add (&workers_running, -1);
+
+  return NULL;
+}
+
+static gint
+compare_uint64 (gconstpointer a, gconstpointer b)
+{
+  guint64 ua = *(const guint64 *) a, ub = *(const guint64 *) b;
+
+  return ua < ub ? -1 : ua > ub;
+}
+
+static gdouble
+percentile (GArray *sorted, gdouble p)
+{
+  guint index;
+
+  if (sorted->len == 0)
+    return 0;
+
+  index = (guint) (p / 100.0 * (sorted->len - 1) + 0.5);
+  return g_array_index (sorted, guint64, index) / 1000.0;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *options;
+  GError *error = NULL;
+  Worker *workers;
+  GArray *samples = g_array_new (FALSE, FALSE, sizeof (Sample));
+  GString *json;
+  struct rusage usage;
+  guint initial_protected, final_protected;
+  guint64 start, elapsed_ns, total_ops = 0, peak_rss = 0;
+  gint total_errors = 0;
+  guint i, k;
+
+  options = g_option_context_new ("- stress javascriptcore-gobject contexts");
+  g_option_context_add_main_entries (options, entries, NULL);
+  if (!g_option_context_parse (options, &argc, &argv, &error) ||
+      (mix && !parse_mix (mix, &error)))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+  g_option_context_free (options);
+
+  for (i = 0; i < N_WORKLOADS; i++)
+    total_weight += weights[i];
+  if (total_weight == 0 || n_threads < 1 || n_contexts < 0 || n_ops < 0 || interval_ms < 1)
+    {
+      g_printerr ("Nothing to run\n");
+      return 1;
+    }
+
+  initial_protected = jscore_get_protect_count ();
+  workers = g_new0 (Worker, n_threads);
+  workers_running = n_threads;
+  start = now_ns ();
+
+  for (i = 0; i < n_threads; i++)
+    {
+      workers[i].index = i;
+      for (k = 0; k < N_TIMINGS; k++)
+        workers[i].latencies[k] = g_array_new (FALSE, FALSE, sizeof (guint64));
+      workers[i].thread = g_thread_new ("jscore-stress", worker_thread, &workers[i]);
+    }
+
+  /* Sample until the last worker is done, then once more after */
+  while (TRUE)
+    {
+      gboolean running = g_atomic_int_get (&workers_running) > 0;
+      Sample sample;
+
+      sample.t_ms = (now_ns () - start) / 1000000;
+      sample.rss_kb = current_rss_kb ();
+      sample.protected = jscore_get_protect_count ();
+      sample.contexts = g_atomic_int_get (&contexts_done);
+      g_array_append_val (samples, sample);
+      peak_rss = MAX (peak_rss, sample.rss_kb);
+
+      if (!running)
+        break;
+      g_usleep (interval_ms * 1000);
+    }
+
+  for (i = 0; i < n_threads; i++)
+    g_thread_join (workers[i].thread);
+  elapsed_ns = now_ns () - start;
+  final_protected = jscore_get_protect_count ();
+
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    peak_rss = MAX (peak_rss, (guint64) usage.ru_maxrss);
+
+  json = g_string_new (NULL);
+  g_string_append_printf (json, "{\n  \"version\": 1,\n  \"library\": \"%s\",\n"
+                          "  \"threads\": %d,\n  \"contexts_per_thread\": %d,\n"
+                          "  \"ops_per_context\": %d,\n  \"mix\": {",
+                          PACKAGE_STRING, n_threads, n_contexts, n_ops);
+  for (i = 0; i < N_WORKLOADS; i++)
+    g_string_append_printf (json, "%s\"%s\": %u", i ? ", " : "", workload_names[i], weights[i]);
+
+  g_string_append (json, "},\n  \"latency_us\": {");
+  for (k = 0; k < N_TIMINGS; k++)
+    {
+      GArray *all = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+      for (i = 0; i < n_threads; i++)
+        g_array_append_vals (all, workers[i].latencies[k]->data, workers[i].latencies[k]->len);
+      g_array_sort (all, compare_uint64);
+
+      g_string_append_printf (json,
+                              "%s\n    \"%s\": {\"count\": %u, \"p50\": %.3f, \"p90\": %.3f, "
+                              "\"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+                              k ? "," : "", workload_names[k], all->len,
+                              percentile (all, 50), percentile (all, 90), percentile (all, 99),
+                              percentile (all, 99.9), percentile (all, 100));
+      g_array_free (all, TRUE);
+    }
+
+  for (i = 0; i < n_threads; i++)
+    {
+      total_ops += workers[i].n_ops;
+      total_errors += workers[i].errors;
+    }
+
+  g_string_append_printf (json,
+                          "\n  },\n  \"elapsed_s\": %.3f,\n  \"ops_per_s\": %.1f,\n"
+                          "  \"contexts_per_s\": %.1f,\n  \"errors\": %d,\n"
+                          "  \"peak_rss_kb\": %" G_GUINT64_FORMAT ",\n"
+                          "  \"protected_before\": %u,\n  \"protected_after\": %u,\n"
+                          "  \"series\": [",
+                          elapsed_ns / 1e9, total_ops / (elapsed_ns / 1e9),
+                          (gdouble) n_threads * n_contexts / (elapsed_ns / 1e9),
+                          total_errors, peak_rss, initial_protected, final_protected);
+  for (i = 0; i < samples->len; i++)
+    {
+      Sample *sample = &g_array_index (samples, Sample, i);
+
+      g_string_append_printf (json, "%s\n    {\"t_ms\": %" G_GUINT64_FORMAT ", \"rss_kb\": %"
+                              G_GUINT64_FORMAT ", \"protected\": %u, \"contexts\": %u}",
+                              i ? "," : "", sample->t_ms, sample->rss_kb,
+                              sample->protected, sample->contexts);
+    }
+  g_string_append (json, "\n  ]\n}\n");
+
+  if (output)
+    {
+      if (!g_file_set_contents (output, json->str, json->len, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          g_error_free (error);
+        }
+    }
+  else
+    fputs (json->str, stdout);
+
+  g_string_free (json, TRUE);
+  g_array_free (samples, TRUE);
+  for (i = 0; i < n_threads; i++)
+    for (k = 0; k < N_TIMINGS; k++)
+      g_array_free (workers[i].latencies[k], TRUE);
+  g_free (workers);
+
+  /* Every context is gone, so anything still protected leaked */
+  if (final_protected != initial_protected)
+    {
+      g_printerr ("Protect set grew by %d values\n", (gint) (final_protected - initial_protected));
+      return 2;
+    }
+
+  return total_errors ? 1 : 0;
+}
@@ -0,0 +1,600 @@
+/*
+ * jscore-channel.c - Source for JSCoreChannel
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-channel.h"
+#include "jscore-serialize.h"
+#include "jscore-object-private.h"
+#include "jscore-context-private.h"
+#include "jscore-value-private.h"
+
+#include <JavaScriptCore/JavaScript.h>
+
+/* Each direction is a bounded ring of serialized messages (Vyukov's
+ * sequence queue): producers claim a slot with one CAS, the single
+ * consumer needs no atomic read-modify-write at all. The receiving end
+ * is woken by making its GSource ready, at most once per batch. */
+
+#define DEFAULT_CAPACITY 256
+
+G_DEFINE_TYPE (JSCoreChannel, jscore_channel, G_TYPE_OBJECT);
+
+static void jscore_channel_dispose (GObject *object);
+static void jscore_channel_finalize (GObject *object);
+
+enum
+{
+  SIGNAL_DRAIN, LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+typedef struct
+{
+  guint sequence;
+  GBytes *message;
+} Cell;
+
+typedef struct
+{
+  Cell *cells;
+  guint mask;
+  guint tail;
+  guint head;
+} Ring;
+
+typedef struct
+{
+  JSCoreChannel *channel;
+  JSCoreChannelEnd end;
+
+  /* Messages sent to this end */
+  Ring inbox;
+  /* Set by a producer that found inbox full */
+  gint wants_drain;
+
+  JSCoreContext *context;
+  JSObjectRef port;
+
+  /* Producers may wake us while the end is being detached */
+  GMutex source_lock;
+  GSource *source;
+
+  gint wakeup_pending;
+  gint drain_pending;
+} Endpoint;
+
+struct _JSCoreChannelPrivate
+{
+  Endpoint ends[2];
+  gboolean dispose_has_run;
+};
+
+static void
+ring_init (Ring *ring, guint capacity)
+{
+  guint i;
+
+  ring->cells = g_new0 (Cell, capacity);
+  ring->mask = capacity - 1;
+  ring->tail = 0;
+  ring->head = 0;
+
+  for (i = 0; i < capacity; i++)
+    ring->cells[i].sequence = i;
+}
+
+static gboolean
+ring_push (Ring *ring, GBytes *message)
+{
+  guint pos = g_atomic_int_get ((gint *) &ring->tail);
+  Cell *cell;
+  gint diff;
+
+  for (;;)
+    {
+      cell = &ring->cells[pos & ring->mask];
+      diff = (gint) ((guint) g_atomic_int_get ((gint *) &cell->sequence) - pos);
+
+      if (diff == 0)
+        {
+          if (g_atomic_int_compare_and_exchange ((gint *) &ring->tail, pos, pos + 1))
+            break;
+        }
+      else if (diff < 0)
+        return FALSE;
+
+      pos = g_atomic_int_get ((gint *) &ring->tail);
+    }
+
+  cell->message = message;
+  g_atomic_int_set ((gint *) &cell->sequence, pos + 1);
+
+  return TRUE;
+}
+
+/* Consumer side only */
+static GBytes *
+ring_pop (Ring *ring)
+{
+  guint pos = ring->head;
+  Cell *cell = &ring->cells[pos & ring->mask];
+  GBytes *message;
+
+  if ((gint) ((guint) g_atomic_int_get ((gint *) &cell->sequence) - (pos + 1)) < 0)
+    return NULL;
+
+  message = cell->message;
+  cell->message = NULL;
+  ring->head = pos + 1;
+  g_atomic_int_set ((gint *) &cell->sequence, pos + ring->mask + 1);
+
+  return message;
+}
+
+static void
+ring_clear (Ring *ring)
+{
+  GBytes *message;
+
+  while ((message = ring_pop (ring)))
+    g_bytes_unref (message);
+
+  g_free (ring->cells);
+}
+
+static void
+endpoint_wakeup (Endpoint *endpoint)
+{
+  if (!g_atomic_int_compare_and_exchange (&endpoint->wakeup_pending, 0, 1))
+    return;
+
+  g_mutex_lock (&endpoint->source_lock);
+  if (endpoint->source)
+    g_source_set_ready_time (endpoint->source, 0);
+  g_mutex_unlock (&endpoint->source_lock);
+}
+
+static JSObjectRef
+port_get_handler (Endpoint *endpoint, const gchar *name)
+{
+  JSContextRef ctx = endpoint->context->priv->real;
+  JSStringRef js_name = JSStringCreateWithUTF8CString (name);
+  JSValueRef handler = JSObjectGetProperty (ctx, endpoint->port, js_name, NULL);
+
+  JSStringRelease (js_name);
+
+  if (!JSValueIsObject (ctx, handler)
+      || !JSObjectIsFunction (ctx, (JSObjectRef) handler))
+    return NULL;
+
+  return (JSObjectRef) handler;
+}
+
+static void
+endpoint_deliver (Endpoint *endpoint, GBytes *message)
+{
+  JSContextRef ctx = endpoint->context->priv->real;
+  JSValueRef exception = NULL;
+  JSObjectRef handler;
+  JSValueRef value;
+  GError *error = NULL;
+
+  handler = port_get_handler (endpoint, "onmessage");
+  if (handler == NULL)
+    return;
+
+  value = (JSValueRef) jscore_value_deserialize (endpoint->context, message, NULL,
+                                                 JS_CORE_CLONE_NONE, &error);
+  if (value == NULL)
+    {
+      g_warning ("Dropping message: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  JSObjectCallAsFunction (ctx, handler, endpoint->port, 1, &value, &exception);
+  if (exception)
+    {
+      set_error_from_js_exception (&error, exception, endpoint->context);
+      g_warning ("Uncaught exception in onmessage: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static gboolean
+endpoint_dispatch (gpointer data)
+{
+  Endpoint *endpoint = data;
+  Endpoint *peer = &endpoint->channel->priv->ends[!endpoint->end];
+  JSValueRef exception = NULL;
+  JSObjectRef handler;
+  GBytes *message;
+  GError *error = NULL;
+  guint n;
+
+  /* Cleared first, so a message posted while draining wakes us again */
+  g_atomic_int_set (&endpoint->wakeup_pending, 0);
+
+  /* Ends that are not attached only get drain notifications, their
+   * messages wait for a context */
+  n = 0;
+  if (endpoint->context)
+    {
+      /* Bounded so a handler replying to itself cannot starve the loop */
+      for (n = 0; n <= endpoint->inbox.mask; n++)
+        {
+          message = ring_pop (&endpoint->inbox);
+          if (message == NULL)
+            break;
+
+          endpoint_deliver (endpoint, message);
+          g_bytes_unref (message);
+        }
+    }
+
+  if (n > endpoint->inbox.mask)
+    endpoint_wakeup (endpoint);
+
+  if (n > 0 && g_atomic_int_compare_and_exchange (&endpoint->wants_drain, 1, 0))
+    {
+      g_atomic_int_set (&peer->drain_pending, 1);
+      endpoint_wakeup (peer);
+    }
+
+  if (g_atomic_int_compare_and_exchange (&endpoint->drain_pending, 1, 0))
+    {
+      g_signal_emit (endpoint->channel, signals[SIGNAL_DRAIN], 0, endpoint->end);
+
+      handler = endpoint->context ? port_get_handler (endpoint, "ondrain") : NULL;
+      if (handler)
+        {
+          JSObjectCallAsFunction (endpoint->context->priv->real, handler,
+                                  endpoint->port, 0, NULL, &exception);
+          if (exception)
+            {
+              set_error_from_js_exception (&error, exception, endpoint->context);
+              g_warning ("Uncaught exception in ondrain: %s", error->message);
+              g_error_free (error);
+            }
+        }
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+endpoint_source_dispatch (GSource *source,
+                          GSourceFunc callback,
+                          gpointer user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs endpoint_source_funcs = {
+  NULL,
+  NULL,
+  endpoint_source_dispatch,
+  NULL
+};
+
+/* Replaces the source of the end with one on the thread-default main
+ * context, returns the old one to destroy outside the lock */
+static GSource *
+endpoint_set_source (Endpoint *endpoint)
+{
+  GMainContext *main_context;
+  GSource *source, *old;
+
+  source = g_source_new (&endpoint_source_funcs, sizeof (GSource));
+  g_source_set_name (source, "JSCoreChannel");
+  g_source_set_callback (source, endpoint_dispatch, endpoint, NULL);
+
+  main_context = g_main_context_ref_thread_default ();
+  g_source_attach (source, main_context);
+  g_main_context_unref (main_context);
+
+  g_mutex_lock (&endpoint->source_lock);
+  old = endpoint->source;
+  endpoint->source = source;
+  g_mutex_unlock (&endpoint->source_lock);
+
+  /* A wakeup may have gone to the old source, or come before anyone
+   * listened */
+  g_atomic_int_set (&endpoint->wakeup_pending, 0);
+  endpoint_wakeup (endpoint);
+
+  return old;
+}
+
+static void
+source_free (GSource *source)
+{
+  if (source == NULL)
+    return;
+
+  g_source_destroy (source);
+  g_source_unref (source);
+}
+
+/* C producers that are not attached still need to hear about drains */
+static void
+endpoint_ensure_source (Endpoint *endpoint)
+{
+  gboolean has_source;
+
+  g_mutex_lock (&endpoint->source_lock);
+  has_source = endpoint->source != NULL;
+  g_mutex_unlock (&endpoint->source_lock);
+
+  if (!has_source)
+    source_free (endpoint_set_source (endpoint));
+}
+
+gboolean
+jscore_channel_post (JSCoreChannel *channel,
+                     JSCoreChannelEnd from,
+                     GBytes *message)
+{
+  Endpoint *peer;
+
+  g_return_val_if_fail (IS_JSCORE_CHANNEL (channel), FALSE);
+  g_return_val_if_fail (from <= JS_CORE_CHANNEL_END_B, FALSE);
+  g_return_val_if_fail (message != NULL, FALSE);
+
+  peer = &channel->priv->ends[!from];
+
+  g_bytes_ref (message);
+
+  if (!ring_push (&peer->inbox, message))
+    {
+      /* Retry once the flag is up, the consumer may have drained between */
+      endpoint_ensure_source (&channel->priv->ends[from]);
+      g_atomic_int_set (&peer->wants_drain, 1);
+      if (!ring_push (&peer->inbox, message))
+        {
+          g_bytes_unref (message);
+          return FALSE;
+        }
+    }
+
+  endpoint_wakeup (peer);
+
+  return TRUE;
+}
+
+guint
+jscore_channel_get_queued (JSCoreChannel *channel,
+                           JSCoreChannelEnd end)
+{
+  Ring *ring;
+
+  g_return_val_if_fail (IS_JSCORE_CHANNEL (channel), 0);
+  g_return_val_if_fail (end <= JS_CORE_CHANNEL_END_B, 0);
+
+  ring = &channel->priv->ends[end].inbox;
+
+  return (guint) g_atomic_int_get ((gint *) &ring->tail) - ring->head;
+}
+
+static JSValueRef
+port_post_message (JSContextRef ctx,
+                   JSObjectRef function,
+                   JSObjectRef this_object,
+                   size_t argument_count,
+                   const JSValueRef arguments[],
+                   JSValueRef *exception)
+{
+  Endpoint *endpoint = JSObjectGetPrivate (this_object);
+  GError *error = NULL;
+  GBytes *message;
+  JSStringRef string;
+  gboolean posted;
+
+  if (endpoint == NULL)
+    return JSValueMakeBoolean (ctx, FALSE);
+
+  message = jscore_value_serialize (endpoint->context,
+                                    (JSCoreValue *) (argument_count > 0
+                                                     ? arguments[0]
+                                                     : JSValueMakeUndefined (ctx)),
+                                    NULL, &error);
+  if (message == NULL)
+    {
+      string = JSStringCreateWithUTF8CString (error->message);
+      *exception = JSValueMakeString (ctx, string);
+      JSStringRelease (string);
+      g_error_free (error);
+      return NULL;
+    }
+
+  posted = jscore_channel_post (endpoint->channel, endpoint->end, message);
+  g_bytes_unref (message);
+
+  return JSValueMakeBoolean (ctx, posted);
+}
+
+static JSClassRef
+get_port_class (void)
+{
+  static gsize class = 0;
+
+  if (g_once_init_enter (&class))
+    {
+      static const JSStaticFunction functions[] = {
+        { "postMessage", port_post_message, kJSPropertyAttributeDontEnum },
+        { NULL, NULL, 0 }
+      };
+      JSClassDefinition definition = kJSClassDefinitionEmpty;
+
+      definition.className = "MessagePort";
+      definition.staticFunctions = functions;
+
+      g_once_init_leave (&class, (gsize) JSClassCreate (&definition));
+    }
+
+  return (JSClassRef) class;
+}
+
+JSCoreObject *
+jscore_channel_attach (JSCoreChannel *channel,
+                       JSCoreChannelEnd end,
+                       JSCoreContext *context)
+{
+  Endpoint *endpoint;
+
+  g_return_val_if_fail (IS_JSCORE_CHANNEL (channel), NULL);
+  g_return_val_if_fail (end <= JS_CORE_CHANNEL_END_B, NULL);
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), NULL);
+
+  endpoint = &channel->priv->ends[end];
+  g_return_val_if_fail (endpoint->context == NULL, NULL);
+
+  endpoint->context = g_object_ref (context);
+  endpoint->port = JSObjectMake (context->priv->real, get_port_class (), endpoint);
+  jscore_value_protect (context->priv->real, endpoint->port);
+
+  /* Drains seen while posting unattached are delivered here from now on */
+  source_free (endpoint_set_source (endpoint));
+
+  return jscore_object_wrap (context, endpoint->port);
+}
+
+void
+jscore_channel_detach (JSCoreChannel *channel,
+                       JSCoreChannelEnd end)
+{
+  Endpoint *endpoint;
+  GSource *source;
+
+  g_return_if_fail (IS_JSCORE_CHANNEL (channel));
+  g_return_if_fail (end <= JS_CORE_CHANNEL_END_B);
+
+  endpoint = &channel->priv->ends[end];
+
+  g_mutex_lock (&endpoint->source_lock);
+  source = endpoint->source;
+  endpoint->source = NULL;
+  g_mutex_unlock (&endpoint->source_lock);
+
+  source_free (source);
+
+  if (endpoint->context == NULL)
+    return;
+
+  JSObjectSetPrivate (endpoint->port, NULL);
+  jscore_value_unprotect (endpoint->context->priv->real, endpoint->port);
+  endpoint->port = NULL;
+
+  g_object_unref (endpoint->context);
+  endpoint->context = NULL;
+}
+
+JSCoreChannel *
+jscore_channel_new (guint capacity)
+{
+  JSCoreChannel *channel = g_object_new (JSCORE_TYPE_CHANNEL, NULL);
+  JSCoreChannelPrivate *priv = channel->priv;
+  guint size = 1;
+  guint i;
+
+  g_return_val_if_fail (capacity <= G_MAXINT / 2, NULL);
+
+  if (capacity == 0)
+    capacity = DEFAULT_CAPACITY;
+
+  while (size < capacity)
+    size <<= 1;
+
+  for (i = 0; i < 2; i++)
+    {
+      priv->ends[i].channel = channel;
+      priv->ends[i].end = i;
+      ring_init (&priv->ends[i].inbox, size);
+    }
+
+  return channel;
+}
+
+static void
+jscore_channel_class_init (JSCoreChannelClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (JSCoreChannelPrivate));
+
+  gobject_class->dispose = jscore_channel_dispose;
+  gobject_class->finalize = jscore_channel_finalize;
+
+  /* Emitted on the thread of the end that can post again */
+  signals[SIGNAL_DRAIN] = g_signal_new ("drain",
+                                        G_OBJECT_CLASS_TYPE (klass),
+                                        G_SIGNAL_RUN_LAST,
+                                        0,
+                                        NULL, NULL,
+                                        g_cclosure_marshal_VOID__UINT,
+                                        G_TYPE_NONE, 1, G_TYPE_UINT);
+}
+
+static void
+jscore_channel_init (JSCoreChannel *self)
+{
+  JSCoreChannelPrivate *priv =
+      G_TYPE_INSTANCE_GET_PRIVATE (self, JSCORE_TYPE_CHANNEL,
+                                   JSCoreChannelPrivate);
+
+  self->priv = priv;
+  g_mutex_init (&priv->ends[0].source_lock);
+  g_mutex_init (&priv->ends[1].source_lock);
+  priv->dispose_has_run = FALSE;
+}
+
+static void
+jscore_channel_dispose (GObject *object)
+{
+  JSCoreChannel *self = (JSCoreChannel *) object;
+  JSCoreChannelPrivate *priv = self->priv;
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  /* Ends should have been detached from their own threads by now */
+  jscore_channel_detach (self, JS_CORE_CHANNEL_END_A);
+  jscore_channel_detach (self, JS_CORE_CHANNEL_END_B);
+
+  G_OBJECT_CLASS (jscore_channel_parent_class)->dispose (object);
+}
+
+static void
+jscore_channel_finalize (GObject *object)
+{
+  JSCoreChannel *self = (JSCoreChannel *) object;
+  JSCoreChannelPrivate *priv = self->priv;
+
+  ring_clear (&priv->ends[0].inbox);
+  ring_clear (&priv->ends[1].inbox);
+  g_mutex_clear (&priv->ends[0].source_lock);
+  g_mutex_clear (&priv->ends[1].source_lock);
+
+  G_OBJECT_CLASS (jscore_channel_parent_class)->finalize (object);
+}
@@ -0,0 +1,91 @@
+/*
+ * jscore-channel.h - Header for JSCoreChannel
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_CHANNEL_H__
+#define __JSCORE_CHANNEL_H__
+
+#include "jscore-object.h"
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define JSCORE_TYPE_CHANNEL                     \
+  (jscore_channel_get_type())
+#define JSCORE_CHANNEL(obj)                                     \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj),                           \
+                               JSCORE_TYPE_CHANNEL,             \
+                               JSCoreChannel))
+#define JSCORE_CHANNEL_CLASS(klass)                     \
+  (G_TYPE_CHECK_CLASS_CAST ((klass),                    \
+                            JSCORE_TYPE_CHANNEL,        \
+                            JSCoreChannelClass))
+#define IS_JSCORE_CHANNEL(obj)                                  \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj),                           \
+                               JSCORE_TYPE_CHANNEL))
+#define IS_JSCORE_CHANNEL_CLASS(klass)                  \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass),                    \
+                            JSCORE_TYPE_CHANNEL))
+#define JSCORE_CHANNEL_GET_CLASS(obj)                           \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj),                            \
+                              JSCORE_TYPE_CHANNEL,              \
+                              JSCoreChannelClass))
+
+typedef struct _JSCoreChannel      JSCoreChannel;
+typedef struct _JSCoreChannelClass JSCoreChannelClass;
+typedef struct _JSCoreChannelPrivate JSCoreChannelPrivate;
+
+typedef enum {
+  JS_CORE_CHANNEL_END_A,
+  JS_CORE_CHANNEL_END_B
+} JSCoreChannelEnd;
+
+struct _JSCoreChannelClass
+{
+  GObjectClass parent_class;
+};
+
+struct _JSCoreChannel
+{
+  GObject parent;
+  JSCoreChannelPrivate *priv;
+};
+
+GType jscore_channel_get_type (void) G_GNUC_CONST;
+
+/* capacity is per direction, rounded up to a power of two */
+JSCoreChannel *jscore_channel_new (guint capacity);
+
+/* Must be called from the thread running the thread-default main context,
+ * which is where messages for this end are delivered. The returned port
+ * has postMessage (value), onmessage (value) and ondrain (). */
+JSCoreObject *jscore_channel_attach (JSCoreChannel *channel, JSCoreChannelEnd end, JSCoreContext *context);
+void jscore_channel_detach (JSCoreChannel *channel, JSCoreChannelEnd end);
+
+/* Sends a serialized value to the other end. Returns FALSE when its queue
+ * is full, "drain" is emitted on this end once it has room again: on the
+ * thread it is attached from, or for an end that is not attached, on the
+ * thread-default main context of the caller. */
+gboolean jscore_channel_post (JSCoreChannel *channel, JSCoreChannelEnd from, GBytes *message);
+guint jscore_channel_get_queued (JSCoreChannel *channel, JSCoreChannelEnd end);
+
+G_END_DECLS
+
+#endif /* __JSCORE_CHANNEL_H__ */
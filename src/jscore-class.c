@@ -28,12 +28,12 @@ G_DEFINE_TYPE (JSCoreClass, jscore_class, G_TYPE_OBJECT);
 static void jscore_class_dispose (GObject *object);
 
 JSCoreClass *
-jscore_class_new (const JSClassDefinition *definition)
+jscore_class_new (const JSCoreClassDefinition *definition)
 {
   GObject *object = g_object_new (JSCORE_TYPE_CLASS, NULL);
 
   JSCoreClass *js_class = JSCORE_CLASS (object);
-  js_class->priv->class = JSClassCreate(definition);
+  js_class->priv->class = JSClassCreate((const JSClassDefinition *) definition);
 
   return js_class;
 }
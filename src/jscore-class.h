@@ -65,6 +65,8 @@ struct _JSCoreClass
 
 GType jscore_class_get_type (void) G_GNUC_CONST;
 
+JSCoreClass *jscore_class_new (const JSCoreClassDefinition *definition);
+
 G_END_DECLS
 
 #endif /* __JSCORE_CLASS_H__ */
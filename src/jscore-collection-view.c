@@ -0,0 +1,378 @@
+/*
+ * jscore-collection-view.c - Source for JS views over GLib collections
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-collection-view.h"
+#include "jscore-object-private.h"
+#include "jscore-context-private.h"
+#include "jscore-class-private.h"
+
+#include <JavaScriptCore/JavaScript.h>
+
+/* Element access goes through the collection on every property lookup,
+ * so exposing a collection is O(1) whatever its size. */
+
+#define KEY_BUFFER_SIZE 128
+
+typedef struct
+{
+  JSCoreCollectionViewType type;
+  gpointer collection;
+  /* Weak, NULL once the context is disposed */
+  JSCoreContext *context;
+  JSCoreItemConverter converter;
+  gpointer user_data;
+  GDestroyNotify destroy_notify;
+} CollectionView;
+
+static const gchar *class_names[] = {
+  "PtrArrayView",
+  "ListModelView",
+  "HashTableView"
+};
+
+static gboolean
+property_name_to_index (JSStringRef name, guint *index)
+{
+  const JSChar *chars = JSStringGetCharactersPtr (name);
+  size_t length = JSStringGetLength (name);
+  guint64 value = 0;
+  size_t i;
+
+  /* Canonical array indices only: no sign, no leading zero */
+  if (length == 0 || length > 10 || (length > 1 && chars[0] == '0'))
+    return FALSE;
+
+  for (i = 0; i < length; i++)
+    {
+      if (chars[i] < '0' || chars[i] > '9')
+        return FALSE;
+      value = value * 10 + (chars[i] - '0');
+    }
+
+  if (value >= G_MAXUINT)
+    return FALSE;
+
+  *index = (guint) value;
+  return TRUE;
+}
+
+static gchar *
+property_name_to_key (JSStringRef name, gchar *buffer)
+{
+  size_t size = JSStringGetMaximumUTF8CStringSize (name);
+  gchar *key = size <= KEY_BUFFER_SIZE ? buffer : g_malloc (size);
+
+  JSStringGetUTF8CString (name, key, size);
+
+  return key;
+}
+
+static guint
+collection_view_get_length (CollectionView *view)
+{
+  switch (view->type)
+    {
+    case JS_CORE_COLLECTION_VIEW_PTR_ARRAY:
+      return ((GPtrArray *) view->collection)->len;
+    case JS_CORE_COLLECTION_VIEW_LIST_MODEL:
+      return g_list_model_get_n_items (view->collection);
+    case JS_CORE_COLLECTION_VIEW_HASH_TABLE:
+      return g_hash_table_size (view->collection);
+    }
+
+  return 0;
+}
+
+static JSValueRef
+collection_view_convert (JSContextRef ctx, CollectionView *view, gpointer item)
+{
+  JSCoreValue *value = NULL;
+
+  /* Converters get the context, which may be gone while the view is
+   * still reachable from another context of the group */
+  if (view->context)
+    value = view->converter (view->context, item, view->user_data);
+
+  if (value == NULL)
+    return JSValueMakeUndefined (ctx);
+
+  return (JSValueRef) value;
+}
+
+static JSValueRef
+collection_view_get_index (JSContextRef ctx, CollectionView *view, guint index)
+{
+  JSValueRef value;
+  gpointer item;
+
+  if (view->type == JS_CORE_COLLECTION_VIEW_PTR_ARRAY)
+    return collection_view_convert (ctx, view,
+                                    g_ptr_array_index ((GPtrArray *) view->collection,
+                                                       index));
+
+  item = g_list_model_get_item (view->collection, index);
+  value = collection_view_convert (ctx, view, item);
+  if (item)
+    g_object_unref (item);
+
+  return value;
+}
+
+static JSValueRef
+collection_view_get_property (JSContextRef ctx,
+                              JSObjectRef object,
+                              JSStringRef property_name,
+                              JSValueRef *exception)
+{
+  CollectionView *view = JSObjectGetPrivate (object);
+  gchar buffer[KEY_BUFFER_SIZE];
+  gchar *key;
+  gpointer item;
+  guint index;
+
+  if (view->type == JS_CORE_COLLECTION_VIEW_HASH_TABLE)
+    {
+      key = property_name_to_key (property_name, buffer);
+      item = g_hash_table_lookup (view->collection, key);
+      if (key != buffer)
+        g_free (key);
+
+      /* Unknown keys fall through to the prototype */
+      return item ? collection_view_convert (ctx, view, item) : NULL;
+    }
+
+  if (property_name_to_index (property_name, &index))
+    {
+      if (index >= collection_view_get_length (view))
+        return JSValueMakeUndefined (ctx);
+
+      return collection_view_get_index (ctx, view, index);
+    }
+
+  if (JSStringIsEqualToUTF8CString (property_name, "length"))
+    return JSValueMakeNumber (ctx, collection_view_get_length (view));
+
+  return NULL;
+}
+
+static bool
+collection_view_has_property (JSContextRef ctx,
+                              JSObjectRef object,
+                              JSStringRef property_name)
+{
+  CollectionView *view = JSObjectGetPrivate (object);
+  gchar buffer[KEY_BUFFER_SIZE];
+  gchar *key;
+  gboolean ret;
+  guint index;
+
+  if (view->type == JS_CORE_COLLECTION_VIEW_HASH_TABLE)
+    {
+      key = property_name_to_key (property_name, buffer);
+      ret = g_hash_table_contains (view->collection, key);
+      if (key != buffer)
+        g_free (key);
+
+      return ret;
+    }
+
+  if (property_name_to_index (property_name, &index))
+    return index < collection_view_get_length (view);
+
+  return JSStringIsEqualToUTF8CString (property_name, "length");
+}
+
+static void
+collection_view_get_property_names (JSContextRef ctx,
+                                    JSObjectRef object,
+                                    JSPropertyNameAccumulatorRef property_names)
+{
+  CollectionView *view = JSObjectGetPrivate (object);
+  gchar buffer[16];
+  JSStringRef name;
+  GHashTableIter iter;
+  gpointer key;
+  guint length, i;
+
+  if (view->type == JS_CORE_COLLECTION_VIEW_HASH_TABLE)
+    {
+      g_hash_table_iter_init (&iter, view->collection);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+          name = JSStringCreateWithUTF8CString (key);
+          JSPropertyNameAccumulatorAddName (property_names, name);
+          JSStringRelease (name);
+        }
+      return;
+    }
+
+  length = collection_view_get_length (view);
+  for (i = 0; i < length; i++)
+    {
+      g_snprintf (buffer, sizeof (buffer), "%u", i);
+      name = JSStringCreateWithUTF8CString (buffer);
+      JSPropertyNameAccumulatorAddName (property_names, name);
+      JSStringRelease (name);
+    }
+}
+
+static void
+collection_view_finalize (JSObjectRef object)
+{
+  CollectionView *view = JSObjectGetPrivate (object);
+
+  if (view->destroy_notify)
+    view->destroy_notify (view->user_data);
+
+  switch (view->type)
+    {
+    case JS_CORE_COLLECTION_VIEW_PTR_ARRAY:
+      g_ptr_array_unref (view->collection);
+      break;
+    case JS_CORE_COLLECTION_VIEW_LIST_MODEL:
+      g_object_unref (view->collection);
+      break;
+    case JS_CORE_COLLECTION_VIEW_HASH_TABLE:
+      g_hash_table_unref (view->collection);
+      break;
+    }
+
+  if (view->context)
+    g_object_remove_weak_pointer (G_OBJECT (view->context),
+                                  (gpointer *) &view->context);
+
+  g_slice_free (CollectionView, view);
+}
+
+JSCoreClass *
+jscore_collection_view_get_class (JSCoreCollectionViewType type)
+{
+  static gsize classes[G_N_ELEMENTS (class_names)];
+
+  g_return_val_if_fail (type < G_N_ELEMENTS (class_names), NULL);
+
+  if (g_once_init_enter (&classes[type]))
+    {
+      JSClassDefinition definition = kJSClassDefinitionEmpty;
+
+      definition.className = class_names[type];
+      definition.getProperty = collection_view_get_property;
+      definition.hasProperty = collection_view_has_property;
+      definition.getPropertyNames = collection_view_get_property_names;
+      definition.finalize = collection_view_finalize;
+
+      g_once_init_leave (&classes[type],
+                         (gsize) jscore_class_new ((const JSCoreClassDefinition *) &definition));
+    }
+
+  return (JSCoreClass *) classes[type];
+}
+
+static JSCoreObject *
+collection_view_new (JSCoreContext *ctx,
+                     JSCoreCollectionViewType type,
+                     gpointer collection,
+                     JSCoreItemConverter converter,
+                     gpointer user_data,
+                     GDestroyNotify destroy_notify)
+{
+  JSCoreClass *class = jscore_collection_view_get_class (type);
+  JSContextRef real = ctx->priv->real;
+  CollectionView *view;
+  JSObjectRef object;
+  JSStringRef name;
+  JSValueRef array;
+
+  view = g_slice_new (CollectionView);
+  view->type = type;
+  view->collection = collection;
+  view->context = ctx;
+  g_object_add_weak_pointer (G_OBJECT (ctx), (gpointer *) &view->context);
+  view->converter = converter;
+  view->user_data = user_data;
+  view->destroy_notify = destroy_notify;
+
+  object = JSObjectMake (real, class->priv->class, view);
+
+  /* Array-likes get the Array methods (map, forEach, ...) */
+  if (type != JS_CORE_COLLECTION_VIEW_HASH_TABLE)
+    {
+      name = JSStringCreateWithUTF8CString ("Array");
+      array = JSObjectGetProperty (real, JSContextGetGlobalObject (real),
+                                   name, NULL);
+      JSStringRelease (name);
+
+      if (JSValueIsObject (real, array))
+        {
+          name = JSStringCreateWithUTF8CString ("prototype");
+          JSObjectSetPrototype (real, object,
+                                JSObjectGetProperty (real, (JSObjectRef) array,
+                                                     name, NULL));
+          JSStringRelease (name);
+        }
+    }
+
+  return jscore_object_wrap (ctx, object);
+}
+
+JSCoreObject *
+jscore_object_new_for_ptr_array (JSCoreContext *ctx,
+                                 GPtrArray *array,
+                                 JSCoreItemConverter converter,
+                                 gpointer user_data,
+                                 GDestroyNotify destroy_notify)
+{
+  g_return_val_if_fail (array != NULL, NULL);
+  g_return_val_if_fail (converter != NULL, NULL);
+
+  return collection_view_new (ctx, JS_CORE_COLLECTION_VIEW_PTR_ARRAY,
+                              g_ptr_array_ref (array),
+                              converter, user_data, destroy_notify);
+}
+
+JSCoreObject *
+jscore_object_new_for_list_model (JSCoreContext *ctx,
+                                  GListModel *model,
+                                  JSCoreItemConverter converter,
+                                  gpointer user_data,
+                                  GDestroyNotify destroy_notify)
+{
+  g_return_val_if_fail (G_IS_LIST_MODEL (model), NULL);
+  g_return_val_if_fail (converter != NULL, NULL);
+
+  return collection_view_new (ctx, JS_CORE_COLLECTION_VIEW_LIST_MODEL,
+                              g_object_ref (model),
+                              converter, user_data, destroy_notify);
+}
+
+JSCoreObject *
+jscore_object_new_for_hash_table (JSCoreContext *ctx,
+                                  GHashTable *table,
+                                  JSCoreItemConverter converter,
+                                  gpointer user_data,
+                                  GDestroyNotify destroy_notify)
+{
+  g_return_val_if_fail (table != NULL, NULL);
+  g_return_val_if_fail (converter != NULL, NULL);
+
+  return collection_view_new (ctx, JS_CORE_COLLECTION_VIEW_HASH_TABLE,
+                              g_hash_table_ref (table),
+                              converter, user_data, destroy_notify);
+}
@@ -0,0 +1,50 @@
+/*
+ * jscore-collection-view.h - Header for JS views over GLib collections
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_COLLECTION_VIEW_H__
+#define __JSCORE_COLLECTION_VIEW_H__
+
+#include "jscore-object.h"
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  JS_CORE_COLLECTION_VIEW_PTR_ARRAY,
+  JS_CORE_COLLECTION_VIEW_LIST_MODEL,
+  JS_CORE_COLLECTION_VIEW_HASH_TABLE
+} JSCoreCollectionViewType;
+
+/* Called each time a script reads an element, the returned value is not
+ * cached. For list models the item is only borrowed. */
+typedef JSCoreValue *
+(*JSCoreItemConverter) (JSCoreContext *context, gpointer item, gpointer user_data);
+
+JSCoreClass *jscore_collection_view_get_class (JSCoreCollectionViewType type);
+
+JSCoreObject *jscore_object_new_for_ptr_array (JSCoreContext *ctx, GPtrArray *array, JSCoreItemConverter converter, gpointer user_data, GDestroyNotify destroy_notify);
+JSCoreObject *jscore_object_new_for_list_model (JSCoreContext *ctx, GListModel *model, JSCoreItemConverter converter, gpointer user_data, GDestroyNotify destroy_notify);
+/* The hash table must use UTF-8 string keys */
+JSCoreObject *jscore_object_new_for_hash_table (JSCoreContext *ctx, GHashTable *table, JSCoreItemConverter converter, gpointer user_data, GDestroyNotify destroy_notify);
+
+G_END_DECLS
+
+#endif /* __JSCORE_COLLECTION_VIEW_H__ */
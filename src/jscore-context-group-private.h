@@ -20,14 +20,101 @@
 #ifndef js_core_context_group_private_h
 #define js_core_context_group_private_h
 
+#include <glib.h>
+#include "jscore-context.h"
 #include <JavaScriptCore/JavaScript.h>
 
+/* Performance counters, kept per context and summed per group. All are
+ * totals except WRAPPERS_ALIVE. */
+typedef enum
+{
+  JSCORE_COUNTER_VALUES_CREATED,
+  JSCORE_COUNTER_STRINGS_TRANSCODED,
+  JSCORE_COUNTER_STRING_BYTES,
+  JSCORE_COUNTER_PROPERTY_ACCESSES,
+  JSCORE_COUNTER_CALLS_INTO_JS,
+  JSCORE_COUNTER_CALLS_FROM_JS,
+  JSCORE_COUNTER_EXCEPTIONS,
+  JSCORE_COUNTER_PROTECTS,
+  JSCORE_COUNTER_UNPROTECTS,
+  JSCORE_COUNTER_WRAPPERS_ALIVE,
+  JSCORE_N_COUNTERS
+} JSCoreCounter;
+
 typedef struct _JSCoreContextGroupPrivate JSCoreContextGroupPrivate;
 struct _JSCoreContextGroupPrivate
 {
   JSContextGroupRef real;
+
+  /* Thread that created the group and its thread-default main context */
+  GThread *owner;
+  GMainContext *owner_context;
+
+  /* Set for groups running on their own thread */
+  GThread *thread;
+  GMainLoop *loop;
+
+  /* Pending jscore_context_invoke() calls, run from one source */
+  GMutex invoke_lock;
+  GQueue invocations;
+  GSource *invoke_source;
+
+  /* Execution time limits, all in seconds, 0 when unset */
+  gdouble time_limit;
+  gdouble check_interval;
+  JSCoreShouldTerminateFunc terminate_func;
+  gpointer terminate_data;
+  GDestroyNotify terminate_destroy;
+
+  /* Contexts of the group, weak */
+  GMutex contexts_lock;
+  GQueue contexts;
+  /* Counters of destroyed contexts, under contexts_lock */
+  gint64 retired[JSCORE_N_COUNTERS];
+
+  /* Garbage collection scheduling */
+  JSCoreCollectMode idle_mode;
+  gint64 idle_interval;
+  gint64 last_collect;
+  GSource *idle_source;
+  GSource *pressure_source;
+  gint pressure_fd;
+
+  /* Memory budget, usage is the last measure */
+  gsize budget;
+  gsize usage;
+  gint n_protected;
+  /* Reported from any thread, atomic */
+  gssize extra_memory;
+  gint64 last_budget_check;
+  GHashTable *pooled;
+
+  /* key -> SharedValue, see jscore_context_group_share_value() */
+  GHashTable *shared;
+  GMutex shared_lock;
+
+  /* Functions compiled by jscore_object_new_from_function(), least
+   * recently used first. Only touched from the owner thread. */
+  GHashTable *functions;
+  GQueue functions_lru;
+  guint functions_max;
+  guint64 function_hits;
+  guint64 function_misses;
+  guint64 function_evictions;
+
   gboolean dispose_has_run;
 };
 
+gboolean jscore_context_group_watch_limit (JSCoreContextGroup *group, gdouble limit, GError **error);
+void jscore_context_group_add_context (JSCoreContextGroup *group, JSCoreContext *context);
+void jscore_context_group_remove_context (JSCoreContextGroup *group, JSCoreContext *context);
+void jscore_context_group_schedule_idle_collect (JSCoreContextGroup *group);
+void jscore_context_group_check_budget (JSCoreContextGroup *group, gboolean force);
+void jscore_context_group_touch_pooled (gpointer pooled);
+extern const gchar *jscore_counter_names[JSCORE_N_COUNTERS];
+GVariant *jscore_counters_to_variant (const gint64 *counters);
+gpointer jscore_context_group_lookup_function (JSCoreContextGroup *group, const gchar *key);
+void jscore_context_group_cache_function (JSCoreContextGroup *group, const gchar *key, JSCoreContext *context, gpointer function);
+void jscore_context_group_queue_invocation (JSCoreContextGroup *group, JSCoreContext *context, JSCoreContextInvokeFunc func, gpointer user_data, GDestroyNotify destroy_notify);
 
 #endif
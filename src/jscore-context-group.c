@@ -20,25 +20,1309 @@
 
 #include "jscore-context-group.h"
 #include "jscore-context-group-private.h"
+#include "jscore-context-private.h"
+#include "jscore-value.h"
+#include "jscore-value-private.h"
+#include "jscore-probes.h"
 #include <JavaScriptCore/JavaScript.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#endif
 
 G_DEFINE_TYPE (JSCoreContextGroup, jscore_context_group, G_TYPE_OBJECT);
 
 static void jscore_context_group_constructed (GObject *object);
 static void jscore_context_group_dispose (GObject *object);
 static void jscore_context_group_finalize (GObject *object);
+static void jscore_context_group_get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
+
+enum
+{
+  SIGNAL_OVER_BUDGET, SIGNAL_EVICTED, LAST_SIGNAL
+};
+
+/* One read-only property per counter, in JSCoreCounter order */
+enum
+{
+  PROP_COUNTERS = 1
+};
+
+const gchar *jscore_counter_names[JSCORE_N_COUNTERS] =
+{
+  "values-created",
+  "strings-transcoded",
+  "string-bytes",
+  "property-accesses",
+  "calls-into-js",
+  "calls-from-js",
+  "exceptions",
+  "protects",
+  "unprotects",
+  "wrappers-alive"
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* Rough costs used when JavaScriptCore can't report its heap size */
+#define ESTIMATED_CONTEXT_SIZE (512 * 1024)
+#define ESTIMATED_VALUE_SIZE 128
+
+/* Budgets are checked after calls at most this often, in microseconds */
+#define BUDGET_CHECK_INTERVAL (100 * 1000)
+
+/* Pooled contexts of every group, least recently used first */
+typedef struct
+{
+  JSCoreContextGroup *group;
+  gchar *key;
+  JSCoreContext *context;
+  /* data is NULL once the entry is out of the LRU */
+  GList link;
+} PooledContext;
+
+static GQueue pool_lru = G_QUEUE_INIT;
+static GList *all_groups = NULL;
+static gsize process_limit = 0;
+G_LOCK_DEFINE_STATIC (pool);
+
+/* Compiled functions kept by default, see
+ * jscore_context_group_set_function_cache_size() */
+#define DEFAULT_FUNCTION_CACHE_SIZE 1024
+
+/* The wrapper of a compiled function, usable only in its own context */
+typedef struct
+{
+  gchar *key;
+  JSCoreContext *context;
+  GObject *function;
+  GList link;
+} CachedFunction;
+
+/* A shared value stays protected in, and keeps alive, the context that
+ * created it; functions inside it still see that context's globals. */
+typedef struct
+{
+  JSGlobalContextRef owner;
+  JSValueRef value;
+} SharedValue;
+
+#ifdef HAVE_JSCONTEXTGROUPSETEXECUTIONTIMELIMIT
+/* From JSContextRefPrivate.h, which is not installed */
+typedef bool
+(*JSShouldTerminateCallback) (JSContextRef ctx, void *context);
+JS_EXPORT void JSContextGroupSetExecutionTimeLimit (JSContextGroupRef group, double limit, JSShouldTerminateCallback callback, void *context);
+JS_EXPORT void JSContextGroupClearExecutionTimeLimit (JSContextGroupRef group);
+#endif
+
+/* From JSBasePrivate.h, JSGarbageCollect() only hints at a collection */
+#ifdef HAVE_JSSYNCHRONOUSGARBAGECOLLECTFORDEBUGGING
+JS_EXPORT void JSSynchronousGarbageCollectForDebugging (JSContextRef ctx);
+#endif
+#ifdef HAVE_JSSYNCHRONOUSEDENCOLLECTFORDEBUGGING
+JS_EXPORT void JSSynchronousEdenCollectForDebugging (JSContextRef ctx);
+#endif
+#ifdef HAVE_JSGETMEMORYUSAGESTATISTICS
+JS_EXPORT JSObjectRef JSGetMemoryUsageStatistics (JSContextRef ctx);
+#endif
+
+typedef struct
+{
+  JSCoreContext *context;
+  JSCoreContextInvokeFunc func;
+  gpointer user_data;
+  GDestroyNotify destroy_notify;
+} Invocation;
+
+static const gchar deep_freeze_source[] =
+  "(function deepFreeze (o) {\n"
+  "  if (typeof ArrayBuffer !== 'undefined' && ArrayBuffer.isView (o))\n"
+  "    return o;\n"
+  "  Object.freeze (o);\n"
+  "  Object.getOwnPropertyNames (o).forEach (function (name) {\n"
+  "    var d = Object.getOwnPropertyDescriptor (o, name);\n"
+  "    var v = d.value;\n"
+  "    if (v !== null && (typeof v === 'object' || typeof v === 'function')\n"
+  "        && !Object.isFrozen (v))\n"
+  "      deepFreeze (v);\n"
+  "  });\n"
+  "  return o;\n"
+  "})";
+
+static void
+shared_value_free (gpointer data)
+{
+  SharedValue *shared = data;
+
+  jscore_value_unprotect (shared->owner, shared->value);
+  JSGlobalContextRelease (shared->owner);
+  g_slice_free (SharedValue, shared);
+}
+
+static gboolean
+deep_freeze (JSCoreContext *context, JSValueRef value, GError **error)
+{
+  JSContextRef ctx = context->priv->real;
+  JSValueRef exception = NULL;
+  JSStringRef script;
+  JSValueRef function;
+
+  if (!JSValueIsObject (ctx, value))
+    return TRUE;
+
+  script = JSStringCreateWithUTF8CString (deep_freeze_source);
+  function = JSEvaluateScript (ctx, script, NULL, NULL, 1, &exception);
+  JSStringRelease (script);
+
+  if (!exception)
+    JSObjectCallAsFunction (ctx, (JSObjectRef) function, NULL, 1, &value,
+                            &exception);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+invocation_free (Invocation *invocation)
+{
+  if (invocation->destroy_notify)
+    invocation->destroy_notify (invocation->user_data);
+  g_object_unref (invocation->context);
+  g_slice_free (Invocation, invocation);
+}
+
+static gboolean
+invoke_source_dispatch (GSource *source,
+                        GSourceFunc callback,
+                        gpointer user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs invoke_source_funcs = {
+  NULL,
+  NULL,
+  invoke_source_dispatch,
+  NULL
+};
+
+/* Takes the whole queue at once, so a burst of calls costs one wakeup */
+static gboolean
+run_invocations (gpointer data)
+{
+  JSCoreContextGroupPrivate *priv = JSCORE_CONTEXT_GROUP (data)->priv;
+  Invocation *invocation;
+  GQueue batch;
+
+  g_mutex_lock (&priv->invoke_lock);
+  batch = priv->invocations;
+  g_queue_init (&priv->invocations);
+  g_mutex_unlock (&priv->invoke_lock);
+
+  while ((invocation = g_queue_pop_head (&batch)))
+    {
+      invocation->func (invocation->context, invocation->user_data);
+      invocation_free (invocation);
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+attach_invoke_source (JSCoreContextGroupPrivate *priv,
+                      JSCoreContextGroup *group)
+{
+  if (priv->invoke_source)
+    {
+      g_source_destroy (priv->invoke_source);
+      g_source_unref (priv->invoke_source);
+    }
+
+  priv->invoke_source = g_source_new (&invoke_source_funcs, sizeof (GSource));
+  g_source_set_name (priv->invoke_source, "JSCoreContext invoke");
+  g_source_set_callback (priv->invoke_source, run_invocations, group, NULL);
+  g_source_attach (priv->invoke_source, priv->owner_context);
+}
+
+static gpointer
+group_thread_func (gpointer data)
+{
+  GMainLoop *loop = data;
+  GMainContext *main_context = g_main_loop_get_context (loop);
+
+  g_main_context_push_thread_default (main_context);
+  g_main_loop_run (loop);
+  g_main_context_pop_thread_default (main_context);
+
+  g_main_loop_unref (loop);
+
+  return NULL;
+}
+
+/* Runs from the loop, so a quit can't be lost before the loop starts */
+static gboolean
+quit_loop (gpointer data)
+{
+  g_main_loop_quit (data);
+
+  return G_SOURCE_REMOVE;
+}
+
+JSCoreContextGroup *
+jscore_context_group_new_with_thread (const gchar *name)
+{
+  JSCoreContextGroup *group = g_object_new (JSCORE_TYPE_CONTEXT_GROUP, NULL);
+  JSCoreContextGroupPrivate *priv = group->priv;
+
+  g_main_context_unref (priv->owner_context);
+  priv->owner_context = g_main_context_new ();
+  attach_invoke_source (priv, group);
+
+  priv->loop = g_main_loop_new (priv->owner_context, FALSE);
+  priv->thread = g_thread_new (name ? name : "jscore-group",
+                               group_thread_func,
+                               g_main_loop_ref (priv->loop));
+  priv->owner = priv->thread;
+
+  return group;
+}
+
+void
+jscore_context_group_queue_invocation (JSCoreContextGroup *group,
+                                       JSCoreContext *context,
+                                       JSCoreContextInvokeFunc func,
+                                       gpointer user_data,
+                                       GDestroyNotify destroy_notify)
+{
+  JSCoreContextGroupPrivate *priv = group->priv;
+  Invocation *invocation = g_slice_new (Invocation);
+  gboolean was_empty;
+
+  invocation->context = g_object_ref (context);
+  invocation->func = func;
+  invocation->user_data = user_data;
+  invocation->destroy_notify = destroy_notify;
+
+  g_mutex_lock (&priv->invoke_lock);
+  was_empty = g_queue_is_empty (&priv->invocations);
+  g_queue_push_tail (&priv->invocations, invocation);
+  if (was_empty)
+    g_source_set_ready_time (priv->invoke_source, 0);
+  g_mutex_unlock (&priv->invoke_lock);
+}
+
+#ifdef HAVE_JSCONTEXTGROUPSETEXECUTIONTIMELIMIT
+/* Called by the JavaScriptCore watchdog on the thread running the script,
+ * every check_interval of execution until it returns true */
+static bool
+should_terminate (JSContextRef ctx,
+                  void *data)
+{
+  JSCoreContextGroup *group = data;
+  JSCoreContextGroupPrivate *priv = group->priv;
+  JSCoreContext *context = jscore_context_lookup (ctx);
+  gdouble limit, elapsed;
+
+  if (context == NULL)
+    return false;
+
+  limit = context->priv->call_limit;
+  if (limit == 0)
+    limit = context->priv->time_limit;
+  if (limit == 0)
+    limit = priv->time_limit;
+  if (limit == 0)
+    return false;
+
+  /* Entered some way other than an evaluate or call */
+  if (context->priv->entered_at == 0)
+    elapsed = priv->check_interval;
+  else
+    elapsed = (g_get_monotonic_time () - context->priv->entered_at)
+      / (gdouble) G_USEC_PER_SEC;
+
+  if (elapsed < limit)
+    return false;
+
+  if (priv->terminate_func
+      && !priv->terminate_func (context, elapsed, priv->terminate_data))
+    return false;
+
+  context->priv->terminated = TRUE;
+
+  return true;
+}
+#endif
+
+gboolean
+jscore_context_group_watch_limit (JSCoreContextGroup *group,
+                                  gdouble limit,
+                                  GError **error)
+{
+#ifdef HAVE_JSCONTEXTGROUPSETEXECUTIONTIMELIMIT
+  JSCoreContextGroupPrivate *priv = group->priv;
+
+  if (limit > 0 && (priv->check_interval == 0 || limit < priv->check_interval))
+    {
+      priv->check_interval = limit;
+      JSContextGroupSetExecutionTimeLimit (priv->real, limit,
+                                           should_terminate, group);
+    }
+
+  return TRUE;
+#else
+  g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_NOT_SUPPORTED,
+                       "JavaScriptCore has no execution time limits");
+  return FALSE;
+#endif
+}
+
+gboolean
+jscore_context_group_set_execution_time_limit (JSCoreContextGroup *group,
+                                               gdouble limit,
+                                               JSCoreShouldTerminateFunc callback,
+                                               gpointer user_data,
+                                               GDestroyNotify destroy_notify,
+                                               GError **error)
+{
+  JSCoreContextGroupPrivate *priv;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), FALSE);
+  g_return_val_if_fail (limit > 0, FALSE);
+
+  if (!jscore_context_group_watch_limit (group, limit, error))
+    return FALSE;
+
+  priv = group->priv;
+
+  if (priv->terminate_destroy)
+    priv->terminate_destroy (priv->terminate_data);
+
+  priv->time_limit = limit;
+  priv->terminate_func = callback;
+  priv->terminate_data = user_data;
+  priv->terminate_destroy = destroy_notify;
+
+  return TRUE;
+}
+
+void
+jscore_context_group_clear_execution_time_limit (JSCoreContextGroup *group)
+{
+  JSCoreContextGroupPrivate *priv;
+#ifdef HAVE_JSCONTEXTGROUPSETEXECUTIONTIMELIMIT
+  gdouble interval = 0;
+  GList *l;
+#endif
+
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  priv = group->priv;
+
+  if (priv->terminate_destroy)
+    priv->terminate_destroy (priv->terminate_data);
+
+  priv->time_limit = 0;
+  priv->terminate_func = NULL;
+  priv->terminate_data = NULL;
+  priv->terminate_destroy = NULL;
+
+#ifdef HAVE_JSCONTEXTGROUPSETEXECUTIONTIMELIMIT
+  /* Limits set on contexts, or on calls running in them, still need the
+   * watchdog, checking as often as the shortest of them */
+  g_mutex_lock (&priv->contexts_lock);
+  for (l = priv->contexts.head; l; l = l->next)
+    {
+      JSCoreContext *context = l->data;
+
+      if (context->priv->time_limit > 0
+          && (interval == 0 || context->priv->time_limit < interval))
+        interval = context->priv->time_limit;
+      if (context->priv->call_limit > 0
+          && (interval == 0 || context->priv->call_limit < interval))
+        interval = context->priv->call_limit;
+    }
+  g_mutex_unlock (&priv->contexts_lock);
+
+  if (interval > 0)
+    {
+      if (interval != priv->check_interval)
+        JSContextGroupSetExecutionTimeLimit (priv->real, interval,
+                                             should_terminate, group);
+    }
+  else if (priv->check_interval > 0)
+    JSContextGroupClearExecutionTimeLimit (priv->real);
+
+  priv->check_interval = interval;
+#else
+  priv->check_interval = 0;
+#endif
+}
+
+void
+jscore_context_group_add_context (JSCoreContextGroup *group,
+                                  JSCoreContext *context)
+{
+  g_mutex_lock (&group->priv->contexts_lock);
+  g_queue_push_tail (&group->priv->contexts, context);
+  g_mutex_unlock (&group->priv->contexts_lock);
+}
+
+static void
+cached_function_free (CachedFunction *cached)
+{
+  g_object_unref (cached->function);
+  g_free (cached->key);
+  g_slice_free (CachedFunction, cached);
+}
+
+static void
+uncache_function (JSCoreContextGroupPrivate *priv,
+                  CachedFunction *cached)
+{
+  g_queue_unlink (&priv->functions_lru, &cached->link);
+  g_hash_table_remove (priv->functions, cached->key);
+  cached_function_free (cached);
+}
+
+static void
+trim_function_cache (JSCoreContextGroupPrivate *priv)
+{
+  while (priv->functions_lru.length > priv->functions_max)
+    {
+      uncache_function (priv, priv->functions_lru.head->data);
+      priv->function_evictions++;
+    }
+}
+
+/* Functions of a context must go before it does */
+static void
+forget_functions (JSCoreContextGroupPrivate *priv,
+                  JSCoreContext *context)
+{
+  GList *l, *next;
+
+  for (l = priv->functions_lru.head; l; l = next)
+    {
+      CachedFunction *cached = l->data;
+
+      next = l->next;
+      if (context == NULL || cached->context == context)
+        uncache_function (priv, cached);
+    }
+}
+
+gpointer
+jscore_context_group_lookup_function (JSCoreContextGroup *group,
+                                      const gchar *key)
+{
+  JSCoreContextGroupPrivate *priv = group->priv;
+  CachedFunction *cached;
+
+  if (priv->functions_max == 0)
+    return NULL;
+
+  cached = g_hash_table_lookup (priv->functions, key);
+  if (cached == NULL)
+    {
+      priv->function_misses++;
+      return NULL;
+    }
+
+  priv->function_hits++;
+  g_queue_unlink (&priv->functions_lru, &cached->link);
+  g_queue_push_tail_link (&priv->functions_lru, &cached->link);
+
+  return g_object_ref (cached->function);
+}
+
+void
+jscore_context_group_cache_function (JSCoreContextGroup *group,
+                                     const gchar *key,
+                                     JSCoreContext *context,
+                                     gpointer function)
+{
+  JSCoreContextGroupPrivate *priv = group->priv;
+  CachedFunction *cached;
+
+  if (priv->functions_max == 0)
+    return;
+
+  cached = g_hash_table_lookup (priv->functions, key);
+  if (cached)
+    uncache_function (priv, cached);
+
+  cached = g_slice_new0 (CachedFunction);
+  cached->key = g_strdup (key);
+  cached->context = context;
+  cached->function = g_object_ref (function);
+  cached->link.data = cached;
+
+  g_hash_table_insert (priv->functions, cached->key, cached);
+  g_queue_push_tail_link (&priv->functions_lru, &cached->link);
+
+  trim_function_cache (priv);
+}
+
+void
+jscore_context_group_set_function_cache_size (JSCoreContextGroup *group,
+                                              guint size)
+{
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  group->priv->functions_max = size;
+  trim_function_cache (group->priv);
+}
+
+GVariant *
+jscore_context_group_get_function_cache_stats (JSCoreContextGroup *group)
+{
+  JSCoreContextGroupPrivate *priv;
+  GVariantBuilder builder;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), NULL);
+
+  priv = group->priv;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+  g_variant_builder_add (&builder, "{st}", "hits", priv->function_hits);
+  g_variant_builder_add (&builder, "{st}", "misses", priv->function_misses);
+  g_variant_builder_add (&builder, "{st}", "evictions",
+                         priv->function_evictions);
+  g_variant_builder_add (&builder, "{st}", "size",
+                         (guint64) priv->functions_lru.length);
+  g_variant_builder_add (&builder, "{st}", "capacity",
+                         (guint64) priv->functions_max);
+
+  return g_variant_builder_end (&builder);
+}
+
+void
+jscore_context_group_remove_context (JSCoreContextGroup *group,
+                                     JSCoreContext *context)
+{
+  guint i;
+
+  forget_functions (group->priv, context);
+
+  g_mutex_lock (&group->priv->contexts_lock);
+  if (g_queue_remove (&group->priv->contexts, context))
+    for (i = 0; i < JSCORE_N_COUNTERS; i++)
+      group->priv->retired[i] +=
+        __atomic_load_n (&context->priv->counters[i], __ATOMIC_RELAXED);
+  g_mutex_unlock (&group->priv->contexts_lock);
+}
+
+GVariant *
+jscore_counters_to_variant (const gint64 *counters)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+  for (i = 0; i < JSCORE_N_COUNTERS; i++)
+    g_variant_builder_add (&builder, "{st}", jscore_counter_names[i],
+                           (guint64) MAX (counters[i], 0));
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+sum_counters (JSCoreContextGroup *group,
+              gint64 *counters)
+{
+  GList *l;
+  guint i;
+
+  g_mutex_lock (&group->priv->contexts_lock);
+  memcpy (counters, group->priv->retired, sizeof (group->priv->retired));
+  for (l = group->priv->contexts.head; l; l = l->next)
+    {
+      JSCoreContext *context = l->data;
+
+      for (i = 0; i < JSCORE_N_COUNTERS; i++)
+        counters[i] += __atomic_load_n (&context->priv->counters[i],
+                                        __ATOMIC_RELAXED);
+    }
+  g_mutex_unlock (&group->priv->contexts_lock);
+}
+
+GVariant *
+jscore_context_group_get_counters (JSCoreContextGroup *group)
+{
+  gint64 counters[JSCORE_N_COUNTERS];
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), NULL);
+
+  sum_counters (group, counters);
+
+  return jscore_counters_to_variant (counters);
+}
+
+void
+jscore_context_group_collect (JSCoreContextGroup *group,
+                              JSCoreCollectMode mode)
+{
+  JSCoreContextGroupPrivate *priv;
+  JSCoreContext *context;
+  JSContextRef ctx;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  priv = group->priv;
+
+  if (mode == JS_CORE_COLLECT_NONE)
+    return;
+
+  /* The heap belongs to the group, any of its contexts reaches it */
+  g_mutex_lock (&priv->contexts_lock);
+  context = g_queue_peek_head (&priv->contexts);
+  if (context)
+    g_object_ref (context);
+  g_mutex_unlock (&priv->contexts_lock);
+
+  if (context == NULL)
+    return;
+
+  ctx = context->priv->real;
+
+  JSCORE_PROBE2 (gc_collect, group, mode);
+
+#ifdef HAVE_JSSYNCHRONOUSEDENCOLLECTFORDEBUGGING
+  if (mode == JS_CORE_COLLECT_INCREMENTAL)
+    JSSynchronousEdenCollectForDebugging (ctx);
+  else
+#endif
+#ifdef HAVE_JSSYNCHRONOUSGARBAGECOLLECTFORDEBUGGING
+  if (mode == JS_CORE_COLLECT_FULL)
+    JSSynchronousGarbageCollectForDebugging (ctx);
+  else
+#endif
+    JSGarbageCollect (ctx);
+
+  priv->last_collect = g_get_monotonic_time ();
+
+  g_object_unref (context);
+}
+
+static gboolean
+idle_collect (gpointer data)
+{
+  JSCoreContextGroup *group = data;
+  JSCoreContextGroupPrivate *priv = group->priv;
+
+  g_source_unref (priv->idle_source);
+  priv->idle_source = NULL;
+
+  jscore_context_group_collect (group, priv->idle_mode);
+
+  return G_SOURCE_REMOVE;
+}
+
+void
+jscore_context_group_schedule_idle_collect (JSCoreContextGroup *group)
+{
+  JSCoreContextGroupPrivate *priv = group->priv;
+  gint64 wait;
+
+  if (priv->idle_mode == JS_CORE_COLLECT_NONE || priv->idle_source)
+    return;
+
+  wait = priv->last_collect + priv->idle_interval - g_get_monotonic_time ();
+
+  /* Low priority, so pending requests always go first */
+  if (wait > 0)
+    priv->idle_source = g_timeout_source_new (wait / 1000 + 1);
+  else
+    priv->idle_source = g_idle_source_new ();
+
+  g_source_set_priority (priv->idle_source, G_PRIORITY_LOW);
+  g_source_set_name (priv->idle_source, "JSCoreContextGroup collect");
+  g_source_set_callback (priv->idle_source, idle_collect, group, NULL);
+  g_source_attach (priv->idle_source, priv->owner_context);
+}
+
+void
+jscore_context_group_set_idle_collection (JSCoreContextGroup *group,
+                                          JSCoreCollectMode mode,
+                                          guint min_interval_ms)
+{
+  JSCoreContextGroupPrivate *priv;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  priv = group->priv;
+  priv->idle_mode = mode;
+  priv->idle_interval = (gint64) min_interval_ms * 1000;
+
+  if (mode == JS_CORE_COLLECT_NONE && priv->idle_source)
+    {
+      g_source_destroy (priv->idle_source);
+      g_source_unref (priv->idle_source);
+      priv->idle_source = NULL;
+    }
+}
+
+#ifdef __linux__
+/* The cgroup v2 pressure file of the process, or the system wide one */
+static gchar *
+find_pressure_file (void)
+{
+  gchar *contents = NULL;
+  gchar *path = NULL;
+  gchar **lines;
+  guint i;
+
+  if (g_file_get_contents ("/proc/self/cgroup", &contents, NULL, NULL))
+    {
+      lines = g_strsplit (contents, "\n", -1);
+      for (i = 0; lines[i] && path == NULL; i++)
+        {
+          if (!g_str_has_prefix (lines[i], "0::"))
+            continue;
+
+          path = g_build_filename ("/sys/fs/cgroup", lines[i] + 3,
+                                   "memory.pressure", NULL);
+          if (!g_file_test (path, G_FILE_TEST_EXISTS))
+            {
+              g_free (path);
+              path = NULL;
+            }
+        }
+      g_strfreev (lines);
+      g_free (contents);
+    }
+
+  return path ? path : g_strdup ("/proc/pressure/memory");
+}
+
+static gboolean
+pressure_event (gint fd,
+                GIOCondition condition,
+                gpointer data)
+{
+  JSCoreContextGroup *group = data;
+
+  /* The cgroup went away */
+  if (condition & G_IO_ERR)
+    {
+      g_warning ("Memory pressure monitor stopped");
+      jscore_context_group_unwatch_memory_pressure (group);
+      return G_SOURCE_REMOVE;
+    }
+
+  jscore_context_group_collect (group, JS_CORE_COLLECT_FULL);
+
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+gboolean
+jscore_context_group_watch_memory_pressure (JSCoreContextGroup *group,
+                                            guint stall_ms,
+                                            guint window_ms,
+                                            GError **error)
+{
+#ifdef __linux__
+  JSCoreContextGroupPrivate *priv;
+  gchar *path, *trigger;
+  gint fd;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), FALSE);
+  g_return_val_if_fail (stall_ms > 0 && stall_ms < window_ms, FALSE);
+
+  priv = group->priv;
+
+  jscore_context_group_unwatch_memory_pressure (group);
+
+  path = find_pressure_file ();
+  fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    {
+      g_set_error (error, JS_CORE_ERROR, JS_CORE_ERROR_NOT_SUPPORTED,
+                   "Can't open %s: %s", path, g_strerror (errno));
+      g_free (path);
+      return FALSE;
+    }
+
+  /* The kernel wants the terminating nul */
+  trigger = g_strdup_printf ("some %u %u", stall_ms * 1000, window_ms * 1000);
+  if (write (fd, trigger, strlen (trigger) + 1) < 0)
+    {
+      g_set_error (error, JS_CORE_ERROR, JS_CORE_ERROR_FAILED,
+                   "Can't set a trigger on %s: %s", path, g_strerror (errno));
+      g_free (trigger);
+      g_free (path);
+      close (fd);
+      return FALSE;
+    }
+  g_free (trigger);
+  g_free (path);
+
+  priv->pressure_fd = fd;
+  priv->pressure_source = g_unix_fd_source_new (fd, G_IO_PRI | G_IO_ERR);
+  g_source_set_name (priv->pressure_source, "JSCoreContextGroup pressure");
+  g_source_set_callback (priv->pressure_source, (GSourceFunc) pressure_event,
+                         group, NULL);
+  g_source_attach (priv->pressure_source, priv->owner_context);
+
+  return TRUE;
+#else
+  g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_NOT_SUPPORTED,
+                       "Memory pressure is only reported on Linux");
+  return FALSE;
+#endif
+}
+
+void
+jscore_context_group_unwatch_memory_pressure (JSCoreContextGroup *group)
+{
+  JSCoreContextGroupPrivate *priv;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  priv = group->priv;
+
+  if (priv->pressure_source == NULL)
+    return;
+
+  g_source_destroy (priv->pressure_source);
+  g_source_unref (priv->pressure_source);
+  priv->pressure_source = NULL;
+#ifdef __linux__
+  close (priv->pressure_fd);
+#endif
+  priv->pressure_fd = -1;
+}
+
+static gsize
+measure_usage (JSCoreContextGroup *group)
+{
+  JSCoreContextGroupPrivate *priv = group->priv;
+  gssize extra = (gssize) g_atomic_pointer_get (&priv->extra_memory);
+  gsize usage;
+
+#ifdef HAVE_JSGETMEMORYUSAGESTATISTICS
+  JSCoreContext *context;
+  JSStringRef name;
+  JSObjectRef statistics;
+
+  g_mutex_lock (&priv->contexts_lock);
+  context = g_queue_peek_head (&priv->contexts);
+  if (context)
+    g_object_ref (context);
+  g_mutex_unlock (&priv->contexts_lock);
+
+  if (context)
+    {
+      name = JSStringCreateWithUTF8CString ("heapSize");
+      statistics = JSGetMemoryUsageStatistics (context->priv->real);
+      usage = JSValueToNumber (context->priv->real,
+                               JSObjectGetProperty (context->priv->real,
+                                                    statistics, name, NULL),
+                               NULL);
+      JSStringRelease (name);
+      g_object_unref (context);
+
+      return usage + MAX (extra, 0);
+    }
+#endif
+
+  g_mutex_lock (&priv->contexts_lock);
+  usage = priv->contexts.length * ESTIMATED_CONTEXT_SIZE;
+  g_mutex_unlock (&priv->contexts_lock);
+
+  usage += g_atomic_int_get (&priv->n_protected) * ESTIMATED_VALUE_SIZE;
+
+  return usage + MAX (extra, 0);
+}
+
+static void
+pooled_context_free (PooledContext *pooled)
+{
+  pooled->context->priv->pooled = NULL;
+  g_object_unref (pooled->context);
+  g_free (pooled->key);
+  g_slice_free (PooledContext, pooled);
+}
+
+static void
+emit_evicted (JSCoreContext *context,
+              gpointer data)
+{
+  PooledContext *pooled = data;
+
+  g_signal_emit (pooled->group, signals[SIGNAL_EVICTED], 0, pooled->key);
+}
+
+/* Called with the pool lock held, takes the entry out of its group */
+static PooledContext *
+steal_least_recent (JSCoreContextGroup *group)
+{
+  GList *l;
+
+  for (l = pool_lru.head; l; l = l->next)
+    {
+      PooledContext *pooled = l->data;
+
+      if (group && pooled->group != group)
+        continue;
+      /* Contexts running a script are not idle */
+      if (pooled->context->priv->entered_at)
+        continue;
+
+      g_queue_unlink (&pool_lru, &pooled->link);
+      pooled->link.data = NULL;
+      g_hash_table_steal (pooled->group->priv->pooled, pooled->key);
+
+      return pooled;
+    }
+
+  return NULL;
+}
+
+static void
+evict (PooledContext *pooled)
+{
+  JSCoreContextGroupPrivate *priv = pooled->group->priv;
+
+  /* The signal goes out on the thread owning the evicted context */
+  if (priv->owner == g_thread_self ())
+    {
+      emit_evicted (pooled->context, pooled);
+      pooled_context_free (pooled);
+    }
+  else
+    jscore_context_group_queue_invocation (pooled->group, pooled->context,
+                                           emit_evicted, pooled,
+                                           (GDestroyNotify) pooled_context_free);
+}
+
+void
+jscore_context_group_check_budget (JSCoreContextGroup *group,
+                                   gboolean force)
+{
+  JSCoreContextGroupPrivate *priv = group->priv;
+  PooledContext *pooled = NULL;
+  gint64 now = g_get_monotonic_time ();
+  gsize total = 0;
+  GList *l;
+
+  if (priv->budget == 0 && process_limit == 0)
+    return;
+  if (!force && now - priv->last_budget_check < BUDGET_CHECK_INTERVAL)
+    return;
+
+  priv->last_budget_check = now;
+  priv->usage = measure_usage (group);
+
+  if (priv->budget && priv->usage > priv->budget)
+    {
+      g_signal_emit (group, signals[SIGNAL_OVER_BUDGET], 0,
+                     (guint64) priv->usage, (guint64) priv->budget);
+
+      G_LOCK (pool);
+      pooled = steal_least_recent (group);
+      G_UNLOCK (pool);
+    }
+
+  /* Freed memory only shows after a collection, one eviction per check */
+  if (pooled == NULL && process_limit)
+    {
+      G_LOCK (pool);
+      for (l = all_groups; l; l = l->next)
+        total += JSCORE_CONTEXT_GROUP (l->data)->priv->usage;
+      if (total > process_limit)
+        pooled = steal_least_recent (NULL);
+      G_UNLOCK (pool);
+    }
+
+  if (pooled)
+    evict (pooled);
+}
+
+void
+jscore_context_group_touch_pooled (gpointer data)
+{
+  PooledContext *pooled = data;
+
+  G_LOCK (pool);
+  if (pooled->link.data)
+    {
+      g_queue_unlink (&pool_lru, &pooled->link);
+      g_queue_push_tail_link (&pool_lru, &pooled->link);
+    }
+  G_UNLOCK (pool);
+}
+
+void
+jscore_context_group_set_memory_budget (JSCoreContextGroup *group,
+                                        gsize budget)
+{
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  group->priv->budget = budget;
+  jscore_context_group_check_budget (group, TRUE);
+}
+
+gsize
+jscore_context_group_get_memory_usage (JSCoreContextGroup *group)
+{
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), 0);
+
+  group->priv->usage = measure_usage (group);
+
+  return group->priv->usage;
+}
+
+guint
+jscore_context_group_get_protect_count (JSCoreContextGroup *group)
+{
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), 0);
+
+  return g_atomic_int_get (&group->priv->n_protected);
+}
+
+void
+jscore_context_group_report_extra_memory (JSCoreContextGroup *group,
+                                          gssize delta)
+{
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  g_atomic_pointer_add (&group->priv->extra_memory, delta);
+  if (delta > 0)
+    jscore_context_group_check_budget (group, FALSE);
+}
+
+void
+jscore_context_group_pool_context (JSCoreContextGroup *group,
+                                   const gchar *key,
+                                   JSCoreContext *context)
+{
+  JSCoreContextGroupPrivate *priv;
+  PooledContext *pooled, *old;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (IS_JSCORE_CONTEXT (context));
+  g_return_if_fail (context->priv->group == group);
+  g_return_if_fail (context->priv->pooled == NULL);
+
+  priv = group->priv;
+
+  pooled = g_slice_new0 (PooledContext);
+  pooled->group = group;
+  pooled->key = g_strdup (key);
+  pooled->context = g_object_ref (context);
+  pooled->link.data = pooled;
+  pooled->context->priv->pooled = pooled;
+
+  G_LOCK (pool);
+  /* Replaces any context pooled under the same key */
+  old = g_hash_table_lookup (priv->pooled, key);
+  if (old)
+    {
+      g_queue_unlink (&pool_lru, &old->link);
+      old->link.data = NULL;
+      g_hash_table_steal (priv->pooled, key);
+    }
+  g_hash_table_insert (priv->pooled, pooled->key, pooled);
+  g_queue_push_tail_link (&pool_lru, &pooled->link);
+  G_UNLOCK (pool);
+
+  /* Dropping a context may dispose it, which must not happen locked */
+  if (old)
+    pooled_context_free (old);
+
+  jscore_context_group_check_budget (group, FALSE);
+}
+
+JSCoreContext *
+jscore_context_group_lookup_pooled (JSCoreContextGroup *group,
+                                    const gchar *key)
+{
+  PooledContext *pooled;
+  JSCoreContext *context = NULL;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  G_LOCK (pool);
+  pooled = g_hash_table_lookup (group->priv->pooled, key);
+  if (pooled)
+    {
+      g_queue_unlink (&pool_lru, &pooled->link);
+      g_queue_push_tail_link (&pool_lru, &pooled->link);
+      /* Taken under the lock, eviction may drop the pool's reference */
+      context = g_object_ref (pooled->context);
+    }
+  G_UNLOCK (pool);
+
+  return context;
+}
+
+void
+jscore_context_group_clear_pool (JSCoreContextGroup *group)
+{
+  GHashTableIter iter;
+  PooledContext *pooled;
+  GHashTable *pooled_contexts;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT_GROUP (group));
+
+  G_LOCK (pool);
+  pooled_contexts = group->priv->pooled;
+  group->priv->pooled = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_iter_init (&iter, pooled_contexts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pooled))
+    {
+      g_queue_unlink (&pool_lru, &pooled->link);
+      pooled->link.data = NULL;
+    }
+  G_UNLOCK (pool);
+
+  g_hash_table_iter_init (&iter, pooled_contexts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pooled))
+    pooled_context_free (pooled);
+  g_hash_table_destroy (pooled_contexts);
+}
+
+void
+jscore_set_process_memory_limit (gsize limit)
+{
+  process_limit = limit;
+}
+
+gboolean
+jscore_context_group_share_value (JSCoreContextGroup *group,
+                                  const gchar *key,
+                                  JSCoreContext *context,
+                                  JSCoreValue *value,
+                                  JSCoreShareFlags flags,
+                                  GError **error)
+{
+  JSCoreContextGroupPrivate *priv;
+  SharedValue *shared;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), FALSE);
+  g_return_val_if_fail (context->priv->group == group, FALSE);
+
+  priv = group->priv;
+
+  if ((flags & JS_CORE_SHARE_DEEP_FREEZE)
+      && !deep_freeze (context, (JSValueRef) value, error))
+    return FALSE;
+
+  shared = g_slice_new (SharedValue);
+  shared->owner = JSGlobalContextRetain (context->priv->real);
+  shared->value = (JSValueRef) value;
+  jscore_value_protect (shared->owner, shared->value);
+
+  g_mutex_lock (&priv->shared_lock);
+  g_hash_table_insert (priv->shared, g_strdup (key), shared);
+  g_mutex_unlock (&priv->shared_lock);
+
+  return TRUE;
+}
+
+JSCoreValue *
+jscore_context_group_lookup_shared (JSCoreContextGroup *group,
+                                    const gchar *key)
+{
+  JSCoreContextGroupPrivate *priv;
+  SharedValue *shared;
+  JSValueRef value = NULL;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  priv = group->priv;
+
+  /* Unsharing frees the entry, the value must be held before unlocking */
+  g_mutex_lock (&priv->shared_lock);
+  shared = g_hash_table_lookup (priv->shared, key);
+  if (shared)
+    {
+      value = shared->value;
+      jscore_value_protect (shared->owner, value);
+      g_atomic_int_inc (&priv->n_protected);
+    }
+  g_mutex_unlock (&priv->shared_lock);
+
+  return (JSCoreValue *) value;
+}
+
+gboolean
+jscore_context_group_unshare_value (JSCoreContextGroup *group,
+                                    const gchar *key)
+{
+  JSCoreContextGroupPrivate *priv;
+  gboolean ret;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT_GROUP (group), FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  priv = group->priv;
+
+  g_mutex_lock (&priv->shared_lock);
+  ret = g_hash_table_remove (priv->shared, key);
+  g_mutex_unlock (&priv->shared_lock);
+
+  return ret;
+}
 
 
 static void
 jscore_context_group_class_init (JSCoreContextGroupClass *klass)
 {
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  guint i;
 
   g_type_class_add_private (klass, sizeof (JSCoreContextGroupPrivate));
 
   gobject_class->constructed = jscore_context_group_constructed;
   gobject_class->dispose = jscore_context_group_dispose;
   gobject_class->finalize = jscore_context_group_finalize;
+  gobject_class->get_property = jscore_context_group_get_property;
+
+  for (i = 0; i < JSCORE_N_COUNTERS; i++)
+    g_object_class_install_property (gobject_class, PROP_COUNTERS + i,
+                                     g_param_spec_uint64 (jscore_counter_names[i],
+                                                          NULL, NULL,
+                                                          0, G_MAXUINT64, 0,
+                                                          G_PARAM_READABLE |
+                                                          G_PARAM_STATIC_STRINGS));
+
+  signals[SIGNAL_OVER_BUDGET] = g_signal_new ("over-budget",
+                                              G_OBJECT_CLASS_TYPE (klass),
+                                              G_SIGNAL_RUN_LAST,
+                                              0,
+                                              NULL, NULL,
+                                              NULL,
+                                              G_TYPE_NONE, 2,
+                                              G_TYPE_UINT64, G_TYPE_UINT64);
+
+  /* Emitted on the thread owning the group */
+  signals[SIGNAL_EVICTED] = g_signal_new ("evicted",
+                                          G_OBJECT_CLASS_TYPE (klass),
+                                          G_SIGNAL_RUN_LAST,
+                                          0,
+                                          NULL, NULL,
+                                          g_cclosure_marshal_VOID__STRING,
+                                          G_TYPE_NONE, 1, G_TYPE_STRING);
 
 }
 
@@ -50,9 +1334,62 @@ jscore_context_group_init (JSCoreContextGroup *self)
                                  JSCoreContextGroupPrivate);
 
   self->priv = priv;
+  priv->shared = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, shared_value_free);
+  g_mutex_init (&priv->shared_lock);
+  g_mutex_init (&priv->invoke_lock);
+  g_queue_init (&priv->invocations);
+  priv->invoke_source = NULL;
+  priv->thread = NULL;
+  priv->loop = NULL;
+  priv->time_limit = 0;
+  priv->check_interval = 0;
+  priv->terminate_func = NULL;
+  priv->terminate_data = NULL;
+  priv->terminate_destroy = NULL;
+  g_mutex_init (&priv->contexts_lock);
+  g_queue_init (&priv->contexts);
+  priv->idle_mode = JS_CORE_COLLECT_NONE;
+  priv->idle_interval = 0;
+  priv->last_collect = 0;
+  priv->idle_source = NULL;
+  priv->pressure_source = NULL;
+  priv->pressure_fd = -1;
+  priv->budget = 0;
+  priv->usage = 0;
+  priv->n_protected = 0;
+  priv->extra_memory = 0;
+  priv->last_budget_check = 0;
+  priv->pooled = g_hash_table_new (g_str_hash, g_str_equal);
+  memset (priv->retired, 0, sizeof (priv->retired));
+  priv->functions = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&priv->functions_lru);
+  priv->functions_max = DEFAULT_FUNCTION_CACHE_SIZE;
+  priv->function_hits = 0;
+  priv->function_misses = 0;
+  priv->function_evictions = 0;
   priv->dispose_has_run = FALSE;
 }
 
+static void
+jscore_context_group_get_property (GObject *object,
+                                   guint property_id,
+                                   GValue *value,
+                                   GParamSpec *pspec)
+{
+  JSCoreContextGroup *self = JSCORE_CONTEXT_GROUP (object);
+  gint64 counters[JSCORE_N_COUNTERS];
+
+  if (property_id >= PROP_COUNTERS &&
+      property_id < PROP_COUNTERS + JSCORE_N_COUNTERS)
+    {
+      sum_counters (self, counters);
+      g_value_set_uint64 (value, MAX (counters[property_id - PROP_COUNTERS], 0));
+    }
+  else
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+}
+
 
 static void
 jscore_context_group_constructed (GObject *object)
@@ -64,6 +1401,15 @@ jscore_context_group_constructed (GObject *object)
 
   priv->real = JSContextGroupCreate();
 
+  priv->owner = g_thread_self ();
+  priv->owner_context = g_main_context_ref_thread_default ();
+
+  attach_invoke_source (priv, self);
+
+  G_LOCK (pool);
+  all_groups = g_list_prepend (all_groups, self);
+  G_UNLOCK (pool);
+
   if (chain_up != NULL)
     chain_up (object);
 
@@ -77,6 +1423,54 @@ jscore_context_group_dispose (GObject *object)
   if (priv->dispose_has_run)
     return;
 
+  g_hash_table_remove_all (priv->shared);
+  forget_functions (priv, NULL);
+
+  /* Pooled contexts hold the group, this only runs on explicit dispose */
+  jscore_context_group_clear_pool (self);
+
+  G_LOCK (pool);
+  all_groups = g_list_remove (all_groups, self);
+  G_UNLOCK (pool);
+
+  if (priv->loop)
+    {
+      GSource *source = g_idle_source_new ();
+
+      g_source_set_callback (source, quit_loop,
+                             g_main_loop_ref (priv->loop),
+                             (GDestroyNotify) g_main_loop_unref);
+      g_source_attach (source, priv->owner_context);
+      g_source_unref (source);
+
+      /* The last unref may come from a job on the group thread itself */
+      if (priv->thread == g_thread_self ())
+        g_thread_unref (priv->thread);
+      else
+        g_thread_join (priv->thread);
+
+      priv->thread = NULL;
+      g_main_loop_unref (priv->loop);
+      priv->loop = NULL;
+    }
+
+  /* Pending invocations hold their context, which holds us */
+  if (priv->invoke_source)
+    {
+      g_source_destroy (priv->invoke_source);
+      g_source_unref (priv->invoke_source);
+      priv->invoke_source = NULL;
+    }
+  g_main_context_unref (priv->owner_context);
+
+  jscore_context_group_clear_execution_time_limit (self);
+  jscore_context_group_set_idle_collection (self, JS_CORE_COLLECT_NONE, 0);
+  jscore_context_group_unwatch_memory_pressure (self);
+
+#ifdef JSCORE_ENABLE_DEBUG
+  jscore_debug_report_protected (priv->real);
+#endif
+
   JSContextGroupRelease(priv->real);
 
   priv->dispose_has_run = TRUE;
@@ -88,9 +1482,14 @@ static void
 jscore_context_group_finalize (GObject *object)
 {
   JSCoreContextGroup *self = (JSCoreContextGroup *)object;
+  JSCoreContextGroupPrivate *priv = self->priv;
 
-  /* Make compiler happy */
-  (void)self;
+  g_hash_table_destroy (priv->shared);
+  g_hash_table_destroy (priv->pooled);
+  g_hash_table_destroy (priv->functions);
+  g_mutex_clear (&priv->shared_lock);
+  g_mutex_clear (&priv->invoke_lock);
+  g_mutex_clear (&priv->contexts_lock);
 
   G_OBJECT_CLASS (jscore_context_group_parent_class)->finalize (object);
 }
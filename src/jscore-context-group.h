@@ -50,6 +50,28 @@ G_BEGIN_DECLS
 typedef struct _JSCoreContextGroup      JSCoreContextGroup;
 typedef struct _JSCoreContextGroupClass JSCoreContextGroupClass;
 typedef struct _JSCoreContextGroupPrivate JSCoreContextGroupPrivate;
+/* Completed by jscore-context.h and jscore-value.h, which include this
+ * header */
+typedef struct _JSCoreContext JSCoreContext;
+typedef gpointer JSCoreValue;
+
+/* Asked once a script in context has run past its limit, elapsed is in
+ * seconds. Returning FALSE lets it run for another check interval. */
+typedef gboolean
+(*JSCoreShouldTerminateFunc) (JSCoreContext *context, gdouble elapsed, gpointer user_data);
+
+typedef enum {
+  JS_CORE_COLLECT_NONE,
+  /* Young objects only, where JavaScriptCore allows asking for that */
+  JS_CORE_COLLECT_INCREMENTAL,
+  JS_CORE_COLLECT_FULL
+} JSCoreCollectMode;
+
+typedef enum {
+  JS_CORE_SHARE_NONE = 0,
+  /* Object.freeze() the value and everything reachable from it */
+  JS_CORE_SHARE_DEEP_FREEZE = 1 << 0
+} JSCoreShareFlags;
 
 struct _JSCoreContextGroupClass
 {
@@ -64,6 +86,67 @@ struct _JSCoreContextGroup
 
 GType jscore_context_group_get_type (void) G_GNUC_CONST;
 
+/* A group whose contexts are owned by a new thread running its own main
+ * context, so async calls on them never block the caller */
+JSCoreContextGroup *jscore_context_group_new_with_thread (const gchar *name);
+
+/* Limits are in seconds of execution of one call from C into a script.
+ * Scripts are checked at the smallest limit in use in the group, so larger
+ * ones may overrun by up to that much. callback may be NULL, which always
+ * terminates. */
+gboolean jscore_context_group_set_execution_time_limit (JSCoreContextGroup *group, gdouble limit, JSCoreShouldTerminateFunc callback, gpointer user_data, GDestroyNotify destroy_notify, GError **error);
+/* Limits set on contexts of the group keep applying */
+void jscore_context_group_clear_execution_time_limit (JSCoreContextGroup *group);
+/* Must be called from the thread owning the group */
+void jscore_context_group_collect (JSCoreContextGroup *group, JSCoreCollectMode mode);
+/* After calls from C into scripts, collect once the owner main context has
+ * nothing else to do, at most every min_interval_ms. JS_CORE_COLLECT_NONE
+ * turns it off. */
+void jscore_context_group_set_idle_collection (JSCoreContextGroup *group, JSCoreCollectMode mode, guint min_interval_ms);
+/* Linux only. Collects fully whenever tasks of the process' cgroup, or of
+ * the whole system without cgroup v2, stall on memory for stall_ms within
+ * window_ms. */
+gboolean jscore_context_group_watch_memory_pressure (JSCoreContextGroup *group, guint stall_ms, guint window_ms, GError **error);
+void jscore_context_group_unwatch_memory_pressure (JSCoreContextGroup *group);
+
+/* Heap usage in bytes, from JavaScriptCore when it can tell, otherwise
+ * estimated from contexts, protected values and reported extra memory.
+ * "over-budget" is emitted when it goes above budget, 0 for none. */
+void jscore_context_group_set_memory_budget (JSCoreContextGroup *group, gsize budget);
+gsize jscore_context_group_get_memory_usage (JSCoreContextGroup *group);
+/* Values protected with jscore_value_ref() and object wrappers alive in
+ * contexts of the group */
+guint jscore_context_group_get_protect_count (JSCoreContextGroup *group);
+/* For memory held by bindings on behalf of scripts */
+void jscore_context_group_report_extra_memory (JSCoreContextGroup *group, gssize delta);
+/* Pooled contexts are kept alive by the group until they are evicted,
+ * least recently used first, when the group is over budget or all groups
+ * together are over the process limit. "evicted" is emitted with key. */
+void jscore_context_group_pool_context (JSCoreContextGroup *group, const gchar *key, JSCoreContext *context);
+/* Returns a new reference, release it with g_object_unref() */
+JSCoreContext *jscore_context_group_lookup_pooled (JSCoreContextGroup *group, const gchar *key);
+/* Pooled contexts keep their group alive, this breaks the cycle */
+void jscore_context_group_clear_pool (JSCoreContextGroup *group);
+void jscore_set_process_memory_limit (gsize limit);
+
+/* Functions compiled from source are cached per group, up to size of them,
+ * 0 turns the cache off. Stats are a{st} with "hits", "misses",
+ * "evictions", "size" and "capacity". */
+void jscore_context_group_set_function_cache_size (JSCoreContextGroup *group, guint size);
+GVariant *jscore_context_group_get_function_cache_stats (JSCoreContextGroup *group);
+
+/* Counters of all contexts ever in the group as a{st}, also readable as
+ * properties of the same names */
+GVariant *jscore_context_group_get_counters (JSCoreContextGroup *group);
+
+/* Values shared by reference between the contexts of a group, any of them
+ * can use the value returned by lookup, which is protected until released
+ * with jscore_value_unref() on any context of the group. Sharing again
+ * under a key replaces the previous value. */
+gboolean jscore_context_group_share_value (JSCoreContextGroup *group, const gchar *key, JSCoreContext *context, JSCoreValue *value, JSCoreShareFlags flags, GError **error);
+JSCoreValue *jscore_context_group_lookup_shared (JSCoreContextGroup *group, const gchar *key);
+gboolean jscore_context_group_unshare_value (JSCoreContextGroup *group, const gchar *key);
+
 G_END_DECLS
 
 #endif /* __JSCORE_CONTEXT_GROUP_H__ */
@@ -20,15 +20,70 @@
 #ifndef js_core_context_private_h
 #define js_core_context_private_h
 
+#include "jscore-context-group.h"
+#include "jscore-context-group-private.h"
+#include "jscore-exception.h"
 #include <JavaScriptCore/JavaScript.h>
 
 typedef struct _JSCoreContextPrivate JSCoreContextPrivate;
 struct _JSCoreContextPrivate
 {
   JSGlobalContextRef real;
+  JSCoreContextGroup *group;
+
+  /* Lazily evaluated helpers used by the serializer, protected */
+  JSObjectRef clone_helpers;
+
+  /* Promise reactions, see jscore-promise.c. Settled ones wait in the
+   * queue until settle_source runs on the owner main context. */
+  JSObjectRef promise_then;
+  GQueue settled;
+  GSource *settle_source;
+
+  /* Timer wheel behind setTimeout, see jscore-timers.c */
+  struct _TimerWheel *timers;
+
+  /* Execution time limits, see jscore_context_group_watch_limit() */
+  gdouble time_limit;
+  gdouble call_limit;
+  gint64 entered_at;
+  gboolean terminated;
+
+  /* Entry of the group pool holding the context, if any */
+  gpointer pooled;
+
+  /* Behind the last JS_CORE_ERROR_EXCEPTION set for a call on the
+   * context, see jscore_context_take_exception() */
+  JSCoreException *last_exception;
+
+  /* Lazily evaluated, protected, see jscore_context_evaluate_batch() */
+  JSObjectRef batch_runner;
+
+  /* See JSCORE_COUNT() */
+  gint64 counters[JSCORE_N_COUNTERS];
 
   gboolean dispose_has_run;
 };
 
+#ifdef JSCORE_ENABLE_DEBUG
+#define JSCORE_CONTEXT_CHECK_THREAD(context)                                  \
+  G_STMT_START {                                                              \
+    if (G_UNLIKELY ((context)->priv->group->priv->owner != g_thread_self ())) \
+      g_critical ("%s: context used outside of its owner thread", G_STRFUNC); \
+  } G_STMT_END
+#else
+#define JSCORE_CONTEXT_CHECK_THREAD(context) G_STMT_START { } G_STMT_END
+#endif
+
+/* Counters only need to be eventually right, so these are relaxed and
+ * cost about as much as a plain increment */
+#define JSCORE_COUNT(context, counter, n) \
+  __atomic_fetch_add (&(context)->priv->counters[(counter)], (n), __ATOMIC_RELAXED)
+
+JSCoreContext *jscore_context_lookup (JSContextRef ctx);
+gboolean jscore_context_enter (JSCoreContext *context);
+void jscore_context_leave (JSCoreContext *context, gboolean outermost);
+void jscore_context_complete_settled (JSCoreContext *context);
+void jscore_context_free_timers (JSCoreContext *context);
 
 #endif
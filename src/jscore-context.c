@@ -24,8 +24,17 @@
 #include "jscore-context-group-private.h"
 #include "jscore-context-private.h"
 #include "jscore-class-private.h"
+#include "jscore-value.h"
+#include "jscore-value-private.h"
+#include "jscore-exception.h"
+#include "jscore-exception-private.h"
+#include "jscore-object.h"
+#include "jscore-object-private.h"
+#include "jscore-probes.h"
+#include "jscore-recorder-private.h"
 
 #include <JavaScriptCore/JavaScript.h>
+#include <string.h>
 
 G_DEFINE_TYPE (JSCoreContext, jscore_context, G_TYPE_OBJECT);
 
@@ -49,9 +58,29 @@ jscore_context_set_property (GObject *object,
 /* properties */
 enum
 {
-  PROP_DUMMY = 1, LAST_PROPERTY
+  PROP_DUMMY = 1,
+  /* One read-only property per counter, in JSCoreCounter order */
+  PROP_COUNTERS,
+  LAST_PROPERTY = PROP_COUNTERS + JSCORE_N_COUNTERS
 };
 
+/* Wrappers by global context, for callbacks that only get the latter */
+static GHashTable *contexts = NULL;
+G_LOCK_DEFINE_STATIC (contexts);
+
+JSCoreContext *
+jscore_context_lookup (JSContextRef ctx)
+{
+  JSCoreContext *context = NULL;
+
+  G_LOCK (contexts);
+  if (contexts)
+    context = g_hash_table_lookup (contexts, JSContextGetGlobalContext (ctx));
+  G_UNLOCK (contexts);
+
+  return context;
+}
+
 JSCoreContext*
 jscore_context_new_in_group (JSCoreClass *class,
                              JSCoreContextGroup *group)
@@ -59,10 +88,27 @@ jscore_context_new_in_group (JSCoreClass *class,
   GObject *object = g_object_new (JSCORE_TYPE_CONTEXT, NULL);
 
   JSCoreContext *context = JSCORE_CONTEXT (object);
+  JSCoreContextPrivate *priv = context->priv;
+
+  /* Every context has a group so values can be shared with later ones */
+  if (group)
+    priv->group = g_object_ref (group);
+  else
+    priv->group = g_object_new (JSCORE_TYPE_CONTEXT_GROUP, NULL);
 
-  context->priv->real =
-      JSGlobalContextCreateInGroup (group ? group->priv->real : NULL,
-                                    class->priv->class);
+  priv->real =
+      JSGlobalContextCreateInGroup (priv->group->priv->real,
+                                    class ? class->priv->class : NULL);
+
+  G_LOCK (contexts);
+  if (contexts == NULL)
+    contexts = g_hash_table_new (g_direct_hash, g_direct_equal);
+  g_hash_table_insert (contexts, priv->real, context);
+  G_UNLOCK (contexts);
+
+  jscore_context_group_add_context (priv->group, context);
+
+  JSCORE_PROBE2 (context_create, context, priv->group);
 
   return context;
 }
@@ -82,7 +128,34 @@ jscore_context_new ()
 JSCoreContextGroup *
 jscore_context_get_group (JSCoreContext *context)
 {
-  return JSContextGetGroup (context->priv->real);
+  return context->priv->group;
+}
+
+JSCoreException *
+jscore_context_take_exception (JSCoreContext *context)
+{
+  JSCoreException *exception;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), NULL);
+
+  exception = context->priv->last_exception;
+  context->priv->last_exception = NULL;
+
+  return exception;
+}
+
+GVariant *
+jscore_context_get_counters (JSCoreContext *context)
+{
+  gint64 counters[JSCORE_N_COUNTERS];
+  guint i;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), NULL);
+
+  for (i = 0; i < JSCORE_N_COUNTERS; i++)
+    counters[i] = __atomic_load_n (&context->priv->counters[i], __ATOMIC_RELAXED);
+
+  return jscore_counters_to_variant (counters);
 }
 
 JSObjectRef
@@ -91,10 +164,408 @@ jscore_context_get_global_object (JSCoreContext *context)
   return JSContextGetGlobalObject (context->priv->real);
 }
 
+/* Brackets calls from C into scripts, only the outermost one is timed */
+gboolean
+jscore_context_enter (JSCoreContext *context)
+{
+  JSCoreContextPrivate *priv = context->priv;
+
+  JSCORE_COUNT (context, JSCORE_COUNTER_CALLS_INTO_JS, 1);
+
+  if (priv->entered_at)
+    return FALSE;
+
+  priv->entered_at = g_get_monotonic_time ();
+
+  if (priv->pooled)
+    jscore_context_group_touch_pooled (priv->pooled);
+
+  return TRUE;
+}
+
+void
+jscore_context_leave (JSCoreContext *context,
+                      gboolean outermost)
+{
+  if (outermost)
+    {
+      /* Still entered while the budget is checked, so it is not evicted
+       * from the pool under the caller that is leaving it */
+      jscore_context_group_check_budget (context->priv->group, FALSE);
+      context->priv->entered_at = 0;
+      context->priv->terminated = FALSE;
+      jscore_context_group_schedule_idle_collect (context->priv->group);
+    }
+}
+
+gboolean
+jscore_context_set_execution_time_limit (JSCoreContext *context,
+                                         gdouble limit,
+                                         GError **error)
+{
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), FALSE);
+  g_return_val_if_fail (limit >= 0, FALSE);
+
+  if (!jscore_context_group_watch_limit (context->priv->group, limit, error))
+    return FALSE;
+
+  context->priv->time_limit = limit;
+
+  return TRUE;
+}
+
+JSCoreValue *
+jscore_context_evaluate_script_with_limit (JSCoreContext *context,
+                                           const gchar *script,
+                                           const gchar *source_url,
+                                           gint line,
+                                           gdouble limit,
+                                           GError **error)
+{
+  JSCoreValue *result;
+  gdouble previous;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), NULL);
+  g_return_val_if_fail (limit >= 0, NULL);
+
+  if (!jscore_context_group_watch_limit (context->priv->group, limit, error))
+    return NULL;
+
+  previous = context->priv->call_limit;
+  context->priv->call_limit = limit;
+  result = jscore_context_evaluate_script (context, script, source_url,
+                                           line, error);
+  context->priv->call_limit = previous;
+
+  return result;
+}
+
+JSCoreValue *
+jscore_context_evaluate_script (JSCoreContext *context,
+                                const gchar *script,
+                                const gchar *source_url,
+                                gint line,
+                                GError **error)
+{
+  JSValueRef exception = NULL;
+  JSStringRef js_script, js_url = NULL;
+  JSValueRef result;
+  gboolean outermost;
+  gint64 start = 0;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), NULL);
+  g_return_val_if_fail (script != NULL, NULL);
+
+  outermost = jscore_context_enter (context);
+
+  JSCORE_PROBE3 (evaluate_start, context, source_url, line);
+
+  if (jscore_recorder_active ())
+    start = jscore_recorder_now ();
+
+  js_script = JSStringCreateWithUTF8CString (script);
+  if (source_url)
+    js_url = JSStringCreateWithUTF8CString (source_url);
+
+  result = JSEvaluateScript (context->priv->real, js_script, NULL, js_url,
+                             MAX (line, 1), &exception);
+
+  JSStringRelease (js_script);
+  if (js_url)
+    JSStringRelease (js_url);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      result = NULL;
+    }
+
+  JSCORE_PROBE3 (evaluate_end, context, source_url, exception != NULL);
+
+  if (start)
+    jscore_recorder_evaluate (source_url, script, start);
+
+  jscore_context_leave (context, outermost);
+
+  return (JSCoreValue *) result;
+}
+
+/* Calls the functions compiled from each source in its own try, so that
+ * one throwing does not stop the others. Returns [results, errors],
+ * errors holding [exception] for the sources that threw. */
+static const gchar batch_runner_source[] =
+  "(function (functions) {\n"
+  "  var results = [], errors = [];\n"
+  "  for (var i = 0; i < functions.length; i++)\n"
+  "    if (functions[i])\n"
+  "      try { results[i] = functions[i] (); } catch (e) { errors[i] = [e]; }\n"
+  "  return [results, errors];\n"
+  "})";
+
+static JSObjectRef
+get_batch_runner (JSCoreContext *context,
+                  GError **error)
+{
+  JSCoreContextPrivate *priv = context->priv;
+  JSValueRef exception = NULL;
+  JSStringRef script;
+  JSValueRef runner;
+
+  if (priv->batch_runner)
+    return priv->batch_runner;
+
+  script = JSStringCreateWithUTF8CString (batch_runner_source);
+  runner = JSEvaluateScript (priv->real, script, NULL, NULL, 1, &exception);
+  JSStringRelease (script);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return NULL;
+    }
+
+  jscore_value_protect (priv->real, runner);
+  priv->batch_runner = (JSObjectRef) runner;
+
+  return priv->batch_runner;
+}
+
+gboolean
+jscore_context_evaluate_batch (JSCoreContext *context,
+                               const gchar **sources,
+                               gsize n,
+                               JSCoreValue **results,
+                               JSCoreException **errors,
+                               GError **error)
+{
+  JSContextRef ctx;
+  JSValueRef exception = NULL;
+  JSValueRef pair, caught, array;
+  JSValueRef *functions;
+  JSCoreObject **compiled;
+  JSObjectRef runner, values, thrown;
+  GArray *no_parameters;
+  gboolean outermost, ok = TRUE;
+  gsize i;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), FALSE);
+  g_return_val_if_fail (sources != NULL || n == 0, FALSE);
+  g_return_val_if_fail (results != NULL || n == 0, FALSE);
+
+  for (i = 0; i < n; i++)
+    {
+      results[i] = NULL;
+      if (errors)
+        errors[i] = NULL;
+    }
+
+  if (n == 0)
+    return TRUE;
+
+  ctx = context->priv->real;
+  outermost = jscore_context_enter (context);
+
+  runner = get_batch_runner (context, error);
+  if (runner == NULL)
+    {
+      jscore_context_leave (context, outermost);
+      return FALSE;
+    }
+
+  /* Each source is a function of its own, compiled through the group
+   * cache, so sources never see each other or the runner */
+  functions = g_new (JSValueRef, n);
+  compiled = g_new (JSCoreObject *, n);
+  no_parameters = g_array_new (FALSE, FALSE, sizeof (gpointer));
+
+  for (i = 0; i < n; i++)
+    {
+      JSCoreException *syntax_error;
+      GError *local = NULL;
+      gchar *body = g_strdup_printf ("return (\n%s\n);", sources[i]);
+
+      compiled[i] = jscore_object_new_from_function (context, "batch",
+                                                     no_parameters, body,
+                                                     "", &local);
+      g_free (body);
+
+      if (compiled[i] != NULL)
+        {
+          functions[i] = compiled[i]->priv->object;
+          continue;
+        }
+
+      functions[i] = JSValueMakeNull (ctx);
+      ok = FALSE;
+      g_clear_error (&local);
+
+      syntax_error = jscore_context_take_exception (context);
+      if (errors)
+        errors[i] = syntax_error;
+      else if (syntax_error)
+        jscore_exception_unref (syntax_error);
+    }
+  g_array_free (no_parameters, TRUE);
+
+  array = JSObjectMakeArray (ctx, n, functions, NULL);
+  pair = JSObjectCallAsFunction (ctx, runner, NULL, 1, &array, &exception);
+
+  if (exception)
+    {
+      /* Only termination gets here, the runner catches everything else */
+      set_error_from_js_exception (error, exception, context);
+      ok = FALSE;
+      goto out;
+    }
+
+  values = (JSObjectRef) JSObjectGetPropertyAtIndex (ctx, (JSObjectRef) pair,
+                                                     0, NULL);
+  thrown = (JSObjectRef) JSObjectGetPropertyAtIndex (ctx, (JSObjectRef) pair,
+                                                     1, NULL);
+
+  for (i = 0; i < n; i++)
+    {
+      if (JSValueIsNull (ctx, functions[i]))
+        continue;
+
+      caught = JSObjectGetPropertyAtIndex (ctx, thrown, i, NULL);
+      if (JSValueIsUndefined (ctx, caught))
+        {
+          results[i] = (JSCoreValue *) JSObjectGetPropertyAtIndex (ctx, values,
+                                                                   i, NULL);
+          jscore_value_ref (context, results[i]);
+          continue;
+        }
+
+      ok = FALSE;
+      JSCORE_COUNT (context, JSCORE_COUNTER_EXCEPTIONS, 1);
+      if (errors)
+        {
+          caught = JSObjectGetPropertyAtIndex (ctx, (JSObjectRef) caught,
+                                               0, NULL);
+          errors[i] = jscore_exception_new (ctx, caught);
+        }
+    }
+
+out:
+  for (i = 0; i < n; i++)
+    if (compiled[i] != NULL)
+      g_object_unref (compiled[i]);
+  g_free (compiled);
+  g_free (functions);
+
+  jscore_context_leave (context, outermost);
+
+  return ok;
+}
+
+typedef struct
+{
+  gchar *script;
+  gchar *source_url;
+  gint line;
+} EvaluateData;
+
+static void
+evaluate_data_free (EvaluateData *data)
+{
+  g_free (data->script);
+  g_free (data->source_url);
+  g_slice_free (EvaluateData, data);
+}
+
+static void
+run_evaluate (JSCoreContext *context,
+              gpointer user_data)
+{
+  GTask *task = user_data;
+  EvaluateData *data = g_task_get_task_data (task);
+  GError *error = NULL;
+  JSCoreValue *result;
+  GVariant *variant;
+
+  /* Jobs queued before a cancellation still see it here */
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  result = jscore_context_evaluate_script (context, data->script,
+                                           data->source_url, data->line,
+                                           &error);
+  if (result == NULL)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  variant = jscore_value_to_variant (result, context);
+  if (variant)
+    g_variant_ref_sink (variant);
+  g_task_return_pointer (task, variant, (GDestroyNotify) g_variant_unref);
+}
+
+void
+jscore_context_evaluate_script_async (JSCoreContext *context,
+                                      const gchar *script,
+                                      const gchar *source_url,
+                                      gint line,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data)
+{
+  EvaluateData *data;
+  GTask *task;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT (context));
+  g_return_if_fail (script != NULL);
+
+  data = g_slice_new (EvaluateData);
+  data->script = g_strdup (script);
+  data->source_url = g_strdup (source_url);
+  data->line = line;
+
+  task = g_task_new (context, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jscore_context_evaluate_script_async);
+  g_task_set_task_data (task, data, (GDestroyNotify) evaluate_data_free);
+
+  jscore_context_invoke (context, run_evaluate, task, g_object_unref);
+}
+
+GVariant *
+jscore_context_evaluate_script_finish (JSCoreContext *context,
+                                       GAsyncResult *result,
+                                       GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, context), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+void
+jscore_context_invoke (JSCoreContext *context,
+                       JSCoreContextInvokeFunc func,
+                       gpointer user_data,
+                       GDestroyNotify destroy_notify)
+{
+  g_return_if_fail (IS_JSCORE_CONTEXT (context));
+  g_return_if_fail (func != NULL);
+
+  if (context->priv->group->priv->owner == g_thread_self ())
+    {
+      func (context, user_data);
+      if (destroy_notify)
+        destroy_notify (user_data);
+      return;
+    }
+
+  jscore_context_group_queue_invocation (context->priv->group, context,
+                                         func, user_data, destroy_notify);
+}
+
 static void
 jscore_context_class_init (JSCoreContextClass *klass)
 {
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  guint i;
 
   g_type_class_add_private (klass, sizeof(JSCoreContextPrivate));
 
@@ -103,6 +574,14 @@ jscore_context_class_init (JSCoreContextClass *klass)
   gobject_class->constructed = jscore_context_constructed;
   gobject_class->dispose = jscore_context_dispose;
   gobject_class->finalize = jscore_context_finalize;
+
+  for (i = 0; i < JSCORE_N_COUNTERS; i++)
+    g_object_class_install_property (gobject_class, PROP_COUNTERS + i,
+                                     g_param_spec_uint64 (jscore_counter_names[i],
+                                                          NULL, NULL,
+                                                          0, G_MAXUINT64, 0,
+                                                          G_PARAM_READABLE |
+                                                          G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -114,6 +593,20 @@ jscore_context_init (JSCoreContext *self)
                                    JSCoreContextPrivate);
 
   self->priv = priv;
+  priv->group = NULL;
+  priv->clone_helpers = NULL;
+  priv->promise_then = NULL;
+  g_queue_init (&priv->settled);
+  priv->settle_source = NULL;
+  priv->timers = NULL;
+  priv->time_limit = 0;
+  priv->call_limit = 0;
+  priv->entered_at = 0;
+  priv->terminated = FALSE;
+  priv->pooled = NULL;
+  priv->last_exception = NULL;
+  priv->batch_runner = NULL;
+  memset (priv->counters, 0, sizeof (priv->counters));
   priv->dispose_has_run = FALSE;
 }
 
@@ -126,16 +619,17 @@ jscore_context_get_property (GObject *object,
   JSCoreContext *self = JSCORE_CONTEXT (object);
   JSCoreContextPrivate *priv = self->priv;
 
-  /* Make compiler happy */
-  (void) priv;
-
   switch (property_id)
   {
   case PROP_DUMMY:
     g_value_set_uint (value, 0);
   break;
   default:
-    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    if (property_id >= PROP_COUNTERS && property_id < LAST_PROPERTY)
+      g_value_set_uint64 (value, MAX (__atomic_load_n (&priv->counters[property_id - PROP_COUNTERS],
+                                                       __ATOMIC_RELAXED), 0));
+    else
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   break;
   }
 }
@@ -189,8 +683,46 @@ jscore_context_dispose (GObject *object)
     return;
 
   priv->dispose_has_run = TRUE;
+
+  JSCORE_PROBE2 (context_destroy, self, priv->group);
+
+  if (priv->last_exception)
+    {
+      jscore_exception_unref (priv->last_exception);
+      priv->last_exception = NULL;
+    }
+
+  if (priv->clone_helpers)
+    jscore_value_unprotect (priv->real, priv->clone_helpers);
+
+  if (priv->batch_runner)
+    jscore_value_unprotect (priv->real, priv->batch_runner);
+
+  jscore_context_free_timers (self);
+
+  G_LOCK (contexts);
+  g_hash_table_remove (contexts, priv->real);
+  G_UNLOCK (contexts);
+
+  if (priv->group)
+    jscore_context_group_remove_context (priv->group, self);
+
+  if (priv->settle_source)
+    {
+      g_source_destroy (priv->settle_source);
+      g_source_unref (priv->settle_source);
+      priv->settle_source = NULL;
+    }
+  jscore_context_complete_settled (self);
+
+  if (priv->promise_then)
+    jscore_value_unprotect (priv->real, priv->promise_then);
+
   JSGlobalContextRelease (priv->real);
 
+  if (priv->group)
+    g_object_unref (priv->group);
+
   G_OBJECT_CLASS (jscore_context_parent_class)->dispose (object);
 }
 
@@ -23,7 +23,7 @@
 
 #include "jscore-context-group.h"
 #include "jscore-class.h"
-#include <glib-object.h>
+#include <gio/gio.h>
 
 
 G_BEGIN_DECLS
@@ -49,9 +49,13 @@ G_BEGIN_DECLS
                               JSCORE_TYPE_CONTEXT,        \
                               JSCoreContextClass))
 
-typedef struct _JSCoreContext      JSCoreContext;
 typedef struct _JSCoreContextClass JSCoreContextClass;
 typedef struct _JSCoreContextPrivate JSCoreContextPrivate;
+/* See jscore-exception.h */
+typedef struct _JSCoreException JSCoreException;
+
+typedef void
+(*JSCoreContextInvokeFunc) (JSCoreContext *context, gpointer user_data);
 
 struct _JSCoreContextClass
 {
@@ -69,6 +73,37 @@ GType jscore_context_get_type (void) G_GNUC_CONST;
 JSCoreContext* jscore_context_new (void);
 JSCoreContext* jscore_context_new_with_class (JSCoreClass *global_object_class);
 JSCoreContext* jscore_context_new_in_group (JSCoreClass *global_object_class, JSCoreContextGroup *group);
+JSCoreContextGroup *jscore_context_get_group (JSCoreContext *context);
+/* Snapshot of the context performance counters as a{st}: values created,
+ * strings transcoded and their bytes, property accesses, calls into and
+ * from scripts, exceptions, protect and unprotect calls and wrappers
+ * alive. Each is also a property of the same name. */
+GVariant *jscore_context_get_counters (JSCoreContext *context);
+/* The exception behind the last JS_CORE_ERROR_EXCEPTION set by a call on
+ * context, which is then forgotten. Calls passing a NULL error leave one
+ * too. */
+JSCoreException *jscore_context_take_exception (JSCoreContext *context);
+JSCoreValue *jscore_context_evaluate_script (JSCoreContext *context, const gchar *script, const gchar *source_url, gint line, GError **error);
+/* Runs on the thread owning the context, see jscore_context_invoke(). The
+ * result is NULL without an error when it has no variant form. */
+void jscore_context_evaluate_script_async (JSCoreContext *context, const gchar *script, const gchar *source_url, gint line, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+GVariant *jscore_context_evaluate_script_finish (JSCoreContext *context, GAsyncResult *result, GError **error);
+/* Runs func on the thread owning the context, right away when that is the
+ * calling thread. Calls queued from other threads share one wakeup. */
+void jscore_context_invoke (JSCoreContext *context, JSCoreContextInvokeFunc func, gpointer user_data, GDestroyNotify destroy_notify);
+/* Overrides the group limit for this context, 0 to use the group one */
+gboolean jscore_context_set_execution_time_limit (JSCoreContext *context, gdouble limit, GError **error);
+/* Same as jscore_context_evaluate_script() with a time limit for this
+ * call only, it overrides the context and group limits */
+JSCoreValue *jscore_context_evaluate_script_with_limit (JSCoreContext *context, const gchar *script, const gchar *source_url, gint line, gdouble limit, GError **error);
+
+/* Evaluates n expressions with a single call into the engine, each
+ * compiled once through the group function cache. results and errors are
+ * caller arrays of n entries, errors may be NULL. Results are protected,
+ * release them with jscore_value_unref(). Returns FALSE when any source
+ * threw, error is only set when the batch as a whole failed, e.g. on
+ * termination. */
+gboolean jscore_context_evaluate_batch (JSCoreContext *context, const gchar **sources, gsize n, JSCoreValue **results, JSCoreException **errors, GError **error);
 
 G_END_DECLS
 
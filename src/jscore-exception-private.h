@@ -0,0 +1,29 @@
+/*
+ * jscore-exception-private.h - Private header for exceptions thrown by scripts
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef js_core_exception_private_h
+#define js_core_exception_private_h
+
+#include "jscore-exception.h"
+#include <JavaScriptCore/JavaScript.h>
+
+JSCoreException *jscore_exception_new (JSContextRef ctx, JSValueRef value);
+
+#endif
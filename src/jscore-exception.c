@@ -0,0 +1,227 @@
+/*
+ * jscore-exception.c - Source for exceptions thrown by scripts
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-exception.h"
+#include "jscore-exception-private.h"
+#include "jscore-value-private.h"
+
+#include <JavaScriptCore/JavaScript.h>
+
+struct _JSCoreException
+{
+  gint ref_count;
+  JSGlobalContextRef ctx;
+  JSValueRef value;
+
+  /* Each read on first use */
+  gboolean has_message;
+  gboolean has_stack;
+  gboolean has_line;
+  gchar *name;
+  gchar *message;
+  gchar *stack;
+  gint line;
+};
+
+G_DEFINE_BOXED_TYPE (JSCoreException, jscore_exception,
+                     jscore_exception_ref, jscore_exception_unref)
+
+enum
+{
+  PROPERTY_NAME,
+  PROPERTY_MESSAGE,
+  PROPERTY_STACK,
+  PROPERTY_LINE,
+  N_PROPERTIES
+};
+
+/* Created once, every throw looks them up */
+static JSStringRef
+property_name (guint property)
+{
+  static const gchar *names[N_PROPERTIES] = { "name", "message", "stack", "line" };
+  static JSStringRef strings[N_PROPERTIES];
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint i;
+
+      for (i = 0; i < N_PROPERTIES; i++)
+        strings[i] = JSStringCreateWithUTF8CString (names[i]);
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return strings[property];
+}
+
+JSCoreException *
+jscore_exception_new (JSContextRef ctx,
+                      JSValueRef value)
+{
+  JSCoreException *exception = g_slice_new0 (JSCoreException);
+
+  exception->ref_count = 1;
+  exception->ctx = JSGlobalContextRetain (JSContextGetGlobalContext (ctx));
+  exception->value = value;
+  jscore_value_protect (exception->ctx, value);
+
+  return exception;
+}
+
+JSCoreException *
+jscore_exception_ref (JSCoreException *exception)
+{
+  g_return_val_if_fail (exception != NULL, NULL);
+
+  g_atomic_int_inc (&exception->ref_count);
+
+  return exception;
+}
+
+void
+jscore_exception_unref (JSCoreException *exception)
+{
+  g_return_if_fail (exception != NULL);
+
+  if (!g_atomic_int_dec_and_test (&exception->ref_count))
+    return;
+
+  jscore_value_unprotect (exception->ctx, exception->value);
+  JSGlobalContextRelease (exception->ctx);
+  g_free (exception->name);
+  g_free (exception->message);
+  g_free (exception->stack);
+  g_slice_free (JSCoreException, exception);
+}
+
+static gchar *
+get_string_property (JSCoreException *exception,
+                     guint property)
+{
+  JSValueRef value = JSObjectGetProperty (exception->ctx, (JSObjectRef) exception->value,
+                                          property_name (property), NULL);
+
+  if (value == NULL || JSValueIsUndefined (exception->ctx, value))
+    return NULL;
+
+  return jscore_value_get_string_real (exception->ctx, value);
+}
+
+/* Name and message are all a GError needs */
+static void
+read_message (JSCoreException *exception)
+{
+  if (exception->has_message)
+    return;
+  exception->has_message = TRUE;
+
+  /* Scripts can throw, and promises reject with, any value */
+  if (!JSValueIsObject (exception->ctx, exception->value))
+    {
+      exception->message = jscore_value_get_string_real (exception->ctx, exception->value);
+      return;
+    }
+
+  exception->name = get_string_property (exception, PROPERTY_NAME);
+  exception->message = get_string_property (exception, PROPERTY_MESSAGE);
+}
+
+JSCoreValue *
+jscore_exception_get_value (JSCoreException *exception)
+{
+  g_return_val_if_fail (exception != NULL, NULL);
+
+  return (JSCoreValue *) exception->value;
+}
+
+const gchar *
+jscore_exception_get_name (JSCoreException *exception)
+{
+  g_return_val_if_fail (exception != NULL, NULL);
+
+  read_message (exception);
+  return exception->name;
+}
+
+const gchar *
+jscore_exception_get_message (JSCoreException *exception)
+{
+  g_return_val_if_fail (exception != NULL, NULL);
+
+  read_message (exception);
+  return exception->message;
+}
+
+const gchar *
+jscore_exception_get_stack (JSCoreException *exception)
+{
+  g_return_val_if_fail (exception != NULL, NULL);
+
+  if (!exception->has_stack)
+    {
+      exception->has_stack = TRUE;
+      if (JSValueIsObject (exception->ctx, exception->value))
+        exception->stack = get_string_property (exception, PROPERTY_STACK);
+    }
+
+  return exception->stack;
+}
+
+gint
+jscore_exception_get_line (JSCoreException *exception)
+{
+  JSValueRef line;
+
+  g_return_val_if_fail (exception != NULL, 0);
+
+  if (!exception->has_line)
+    {
+      exception->has_line = TRUE;
+      if (JSValueIsObject (exception->ctx, exception->value))
+        {
+          line = JSObjectGetProperty (exception->ctx, (JSObjectRef) exception->value,
+                                      property_name (PROPERTY_LINE), NULL);
+          if (line && JSValueIsNumber (exception->ctx, line))
+            exception->line = JSValueToNumber (exception->ctx, line, NULL);
+        }
+    }
+
+  return exception->line;
+}
+
+void
+jscore_exception_to_error (JSCoreException *exception,
+                           GError **error)
+{
+  g_return_if_fail (exception != NULL);
+
+  if (error == NULL)
+    return;
+
+  read_message (exception);
+
+  if (exception->name)
+    g_set_error (error, JS_CORE_ERROR, JS_CORE_ERROR_EXCEPTION, "%s: %s",
+                 exception->name, exception->message ? exception->message : "");
+  else
+    g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_EXCEPTION,
+                         exception->message ? exception->message : "");
+}
@@ -0,0 +1,52 @@
+/*
+ * jscore-exception.h - Header for exceptions thrown by scripts
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_EXCEPTION_H__
+#define __JSCORE_EXCEPTION_H__
+
+#include <glib-object.h>
+#include "jscore-value.h"
+
+G_BEGIN_DECLS
+
+#define JSCORE_TYPE_EXCEPTION (jscore_exception_get_type ())
+
+/* A value thrown by a script, kept protected until the last unref, which
+ * must happen on the thread owning its context. Details are read from
+ * the value the first time they are asked for. JSCoreException itself is
+ * declared in jscore-context.h. */
+GType jscore_exception_get_type (void) G_GNUC_CONST;
+
+JSCoreException *jscore_exception_ref (JSCoreException *exception);
+void jscore_exception_unref (JSCoreException *exception);
+
+JSCoreValue *jscore_exception_get_value (JSCoreException *exception);
+/* NULL when the script threw something that is not an object */
+const gchar *jscore_exception_get_name (JSCoreException *exception);
+const gchar *jscore_exception_get_message (JSCoreException *exception);
+const gchar *jscore_exception_get_stack (JSCoreException *exception);
+/* 0 when unknown */
+gint jscore_exception_get_line (JSCoreException *exception);
+/* JS_CORE_ERROR_EXCEPTION with "name: message" */
+void jscore_exception_to_error (JSCoreException *exception, GError **error);
+
+G_END_DECLS
+
+#endif /* __JSCORE_EXCEPTION_H__ */
@@ -0,0 +1,395 @@
+/*
+ * jscore-list-model.c - Source for JSCoreListModel
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-list-model.h"
+#include "jscore-object-private.h"
+#include "jscore-context-private.h"
+#include "jscore-value-private.h"
+
+#include <JavaScriptCore/JavaScript.h>
+#include <math.h>
+
+/* A GListModel over a JS array. Items are converted when GTK asks for
+ * them and the last few are kept around, so scrolling back and forth does
+ * not convert again. Scripts call array.itemsChanged(position, removed,
+ * added), or itemsChanged() for a full reset, after mutating the array. */
+
+#define DEFAULT_CACHE_SIZE 64
+#define HOOK_NAME "itemsChanged"
+
+static void jscore_list_model_list_model_init (GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (JSCoreListModel, jscore_list_model, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL,
+                                                jscore_list_model_list_model_init));
+
+static void jscore_list_model_dispose (GObject *object);
+
+typedef struct
+{
+  guint position;
+  GObject *item;
+  GList link;
+} CacheEntry;
+
+struct _JSCoreListModelPrivate
+{
+  JSCoreObject *array;
+  JSObjectRef hook;
+  GType item_type;
+  guint n_items;
+
+  JSCoreListModelConverter converter;
+  gpointer user_data;
+  GDestroyNotify destroy_notify;
+
+  /* position -> CacheEntry, most recently used at the head of lru */
+  GHashTable *cache;
+  GQueue lru;
+  guint cache_size;
+
+  gboolean dispose_has_run;
+};
+
+static JSContextRef
+get_real_context (JSCoreListModel *model)
+{
+  return model->priv->array->priv->context->priv->real;
+}
+
+static guint
+read_length (JSCoreListModel *model)
+{
+  JSContextRef ctx = get_real_context (model);
+  JSStringRef name = JSStringCreateWithUTF8CString ("length");
+  JSValueRef length = JSObjectGetProperty (ctx,
+                                           model->priv->array->priv->object,
+                                           name, NULL);
+  gdouble value;
+
+  JSStringRelease (name);
+
+  value = JSValueToNumber (ctx, length, NULL);
+  if (!(value > 0))
+    return 0;
+
+  return value >= G_MAXUINT ? G_MAXUINT : (guint) value;
+}
+
+static void
+cache_entry_free (gpointer data)
+{
+  CacheEntry *entry = data;
+
+  g_object_unref (entry->item);
+  g_slice_free (CacheEntry, entry);
+}
+
+static void
+cache_drop_from (JSCoreListModel *model, guint position)
+{
+  JSCoreListModelPrivate *priv = model->priv;
+  GList *link, *next;
+  CacheEntry *entry;
+
+  for (link = priv->lru.head; link; link = next)
+    {
+      next = link->next;
+      entry = link->data;
+
+      if (entry->position >= position)
+        {
+          g_queue_unlink (&priv->lru, link);
+          g_hash_table_remove (priv->cache, GUINT_TO_POINTER (entry->position));
+        }
+    }
+}
+
+static void
+cache_trim (JSCoreListModel *model)
+{
+  JSCoreListModelPrivate *priv = model->priv;
+  CacheEntry *entry;
+
+  while (priv->lru.length > priv->cache_size)
+    {
+      entry = priv->lru.tail->data;
+      g_queue_unlink (&priv->lru, priv->lru.tail);
+      g_hash_table_remove (priv->cache, GUINT_TO_POINTER (entry->position));
+    }
+}
+
+static GType
+jscore_list_model_get_item_type (GListModel *list)
+{
+  return JSCORE_LIST_MODEL (list)->priv->item_type;
+}
+
+static guint
+jscore_list_model_get_n_items (GListModel *list)
+{
+  return JSCORE_LIST_MODEL (list)->priv->n_items;
+}
+
+static gpointer
+jscore_list_model_get_item (GListModel *list, guint position)
+{
+  JSCoreListModel *model = JSCORE_LIST_MODEL (list);
+  JSCoreListModelPrivate *priv = model->priv;
+  CacheEntry *entry;
+  JSValueRef value;
+  GObject *item;
+
+  if (position >= priv->n_items)
+    return NULL;
+
+  entry = g_hash_table_lookup (priv->cache, GUINT_TO_POINTER (position));
+  if (entry)
+    {
+      g_queue_unlink (&priv->lru, &entry->link);
+      g_queue_push_head_link (&priv->lru, &entry->link);
+      return g_object_ref (entry->item);
+    }
+
+  value = JSObjectGetPropertyAtIndex (get_real_context (model),
+                                      priv->array->priv->object,
+                                      position, NULL);
+  item = priv->converter (priv->array->priv->context, (JSCoreValue *) value,
+                          priv->user_data);
+  if (item == NULL || priv->cache_size == 0)
+    return item;
+
+  entry = g_slice_new (CacheEntry);
+  entry->position = position;
+  entry->item = g_object_ref (item);
+  entry->link.data = entry;
+  entry->link.prev = entry->link.next = NULL;
+
+  g_hash_table_insert (priv->cache, GUINT_TO_POINTER (position), entry);
+  g_queue_push_head_link (&priv->lru, &entry->link);
+  cache_trim (model);
+
+  return item;
+}
+
+static void
+jscore_list_model_list_model_init (GListModelInterface *iface)
+{
+  iface->get_item_type = jscore_list_model_get_item_type;
+  iface->get_n_items = jscore_list_model_get_n_items;
+  iface->get_item = jscore_list_model_get_item;
+}
+
+void
+jscore_list_model_items_changed (JSCoreListModel *model,
+                                 guint position,
+                                 guint removed,
+                                 guint added)
+{
+  JSCoreListModelPrivate *priv = model->priv;
+
+  g_return_if_fail (position <= priv->n_items);
+  g_return_if_fail (removed <= priv->n_items - position);
+
+  cache_drop_from (model, position);
+  priv->n_items = priv->n_items - removed + added;
+
+  g_list_model_items_changed (G_LIST_MODEL (model), position, removed, added);
+}
+
+void
+jscore_list_model_set_cache_size (JSCoreListModel *model,
+                                  guint cache_size)
+{
+  model->priv->cache_size = cache_size;
+  cache_trim (model);
+}
+
+/* Scripts can pass anything, only whole numbers a guint holds are used */
+static gboolean
+get_count (JSContextRef ctx,
+           JSValueRef value,
+           guint *count)
+{
+  gdouble number = JSValueToNumber (ctx, value, NULL);
+
+  if (!isfinite (number) || number < 0 || number > G_MAXUINT)
+    return FALSE;
+
+  *count = (guint) number;
+  return TRUE;
+}
+
+static JSValueRef
+items_changed_hook (JSContextRef ctx,
+                    JSObjectRef function,
+                    JSObjectRef this_object,
+                    size_t argument_count,
+                    const JSValueRef arguments[],
+                    JSValueRef *exception)
+{
+  JSCoreListModel *model = JSObjectGetPrivate (function);
+  guint old_length, new_length;
+  guint position, removed, added;
+
+  if (model == NULL)
+    return JSValueMakeUndefined (ctx);
+
+  old_length = model->priv->n_items;
+  new_length = read_length (model);
+
+  if (argument_count >= 3
+      && get_count (ctx, arguments[0], &position)
+      && get_count (ctx, arguments[1], &removed)
+      && get_count (ctx, arguments[2], &added))
+    {
+      position = MIN (position, old_length);
+      removed = MIN (removed, old_length - position);
+
+      /* Never let n_items drift from the real array length */
+      if ((guint64) old_length - removed + added == new_length)
+        {
+          jscore_list_model_items_changed (model, position, removed, added);
+          return JSValueMakeUndefined (ctx);
+        }
+    }
+
+  jscore_list_model_items_changed (model, 0, old_length, new_length);
+
+  return JSValueMakeUndefined (ctx);
+}
+
+static JSClassRef
+get_hook_class (void)
+{
+  static gsize class = 0;
+
+  if (g_once_init_enter (&class))
+    {
+      JSClassDefinition definition = kJSClassDefinitionEmpty;
+
+      definition.className = "ListModelHook";
+      definition.callAsFunction = items_changed_hook;
+
+      g_once_init_leave (&class, (gsize) JSClassCreate (&definition));
+    }
+
+  return (JSClassRef) class;
+}
+
+JSCoreListModel *
+jscore_list_model_new (JSCoreObject *array,
+                       GType item_type,
+                       JSCoreListModelConverter converter,
+                       gpointer user_data,
+                       GDestroyNotify destroy_notify)
+{
+  JSCoreListModel *model;
+  JSCoreListModelPrivate *priv;
+  JSContextRef ctx;
+  JSStringRef name;
+
+  g_return_val_if_fail (IS_JSCORE_OBJECT (array), NULL);
+  g_return_val_if_fail (g_type_is_a (item_type, G_TYPE_OBJECT), NULL);
+  g_return_val_if_fail (converter != NULL, NULL);
+
+  model = g_object_new (JSCORE_TYPE_LIST_MODEL, NULL);
+  priv = model->priv;
+
+  priv->array = g_object_ref (array);
+  priv->item_type = item_type;
+  priv->converter = converter;
+  priv->user_data = user_data;
+  priv->destroy_notify = destroy_notify;
+
+  ctx = get_real_context (model);
+  jscore_value_protect (ctx, array->priv->object);
+
+  priv->hook = JSObjectMake (ctx, get_hook_class (), model);
+  jscore_value_protect (ctx, priv->hook);
+
+  name = JSStringCreateWithUTF8CString (HOOK_NAME);
+  JSObjectSetProperty (ctx, array->priv->object, name, priv->hook,
+                       kJSPropertyAttributeDontEnum, NULL);
+  JSStringRelease (name);
+
+  priv->n_items = read_length (model);
+
+  return model;
+}
+
+static void
+jscore_list_model_class_init (JSCoreListModelClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (JSCoreListModelPrivate));
+
+  gobject_class->dispose = jscore_list_model_dispose;
+}
+
+static void
+jscore_list_model_init (JSCoreListModel *self)
+{
+  JSCoreListModelPrivate *priv =
+      G_TYPE_INSTANCE_GET_PRIVATE (self, JSCORE_TYPE_LIST_MODEL,
+                                   JSCoreListModelPrivate);
+
+  self->priv = priv;
+  priv->array = NULL;
+  priv->hook = NULL;
+  priv->cache = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                       NULL, cache_entry_free);
+  g_queue_init (&priv->lru);
+  priv->cache_size = DEFAULT_CACHE_SIZE;
+  priv->dispose_has_run = FALSE;
+}
+
+static void
+jscore_list_model_dispose (GObject *object)
+{
+  JSCoreListModel *self = (JSCoreListModel *) object;
+  JSCoreListModelPrivate *priv = self->priv;
+  JSContextRef ctx;
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  g_queue_init (&priv->lru);
+  g_hash_table_destroy (priv->cache);
+
+  if (priv->array)
+    {
+      ctx = get_real_context (self);
+
+      JSObjectSetPrivate (priv->hook, NULL);
+      jscore_value_unprotect (ctx, priv->hook);
+      jscore_value_unprotect (ctx, priv->array->priv->object);
+
+      g_object_unref (priv->array);
+    }
+
+  if (priv->destroy_notify)
+    priv->destroy_notify (priv->user_data);
+
+  G_OBJECT_CLASS (jscore_list_model_parent_class)->dispose (object);
+}
@@ -0,0 +1,78 @@
+/*
+ * jscore-list-model.h - Header for JSCoreListModel
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_LIST_MODEL_H__
+#define __JSCORE_LIST_MODEL_H__
+
+#include "jscore-object.h"
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define JSCORE_TYPE_LIST_MODEL                  \
+  (jscore_list_model_get_type())
+#define JSCORE_LIST_MODEL(obj)                          \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj),                   \
+                               JSCORE_TYPE_LIST_MODEL,  \
+                               JSCoreListModel))
+#define JSCORE_LIST_MODEL_CLASS(klass)                  \
+  (G_TYPE_CHECK_CLASS_CAST ((klass),                    \
+                            JSCORE_TYPE_LIST_MODEL,     \
+                            JSCoreListModelClass))
+#define IS_JSCORE_LIST_MODEL(obj)                       \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj),                   \
+                               JSCORE_TYPE_LIST_MODEL))
+#define IS_JSCORE_LIST_MODEL_CLASS(klass)               \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass),                    \
+                            JSCORE_TYPE_LIST_MODEL))
+#define JSCORE_LIST_MODEL_GET_CLASS(obj)                \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj),                    \
+                              JSCORE_TYPE_LIST_MODEL,   \
+                              JSCoreListModelClass))
+
+typedef struct _JSCoreListModel      JSCoreListModel;
+typedef struct _JSCoreListModelClass JSCoreListModelClass;
+typedef struct _JSCoreListModelPrivate JSCoreListModelPrivate;
+
+/* Must return a new reference to an instance of the model item type */
+typedef GObject *
+(*JSCoreListModelConverter) (JSCoreContext *context, JSCoreValue *value, gpointer user_data);
+
+struct _JSCoreListModelClass
+{
+  GObjectClass parent_class;
+};
+
+struct _JSCoreListModel
+{
+  GObject parent;
+  JSCoreListModelPrivate *priv;
+};
+
+GType jscore_list_model_get_type (void) G_GNUC_CONST;
+
+JSCoreListModel *jscore_list_model_new (JSCoreObject *array, GType item_type, JSCoreListModelConverter converter, gpointer user_data, GDestroyNotify destroy_notify);
+void jscore_list_model_set_cache_size (JSCoreListModel *model, guint cache_size);
+void jscore_list_model_items_changed (JSCoreListModel *model, guint position, guint removed, guint added);
+
+G_END_DECLS
+
+#endif /* __JSCORE_LIST_MODEL_H__ */
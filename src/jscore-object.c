@@ -19,22 +19,21 @@
  */
 
 #include "jscore-object.h"
+#include "jscore-object-private.h"
 #include "jscore-context-private.h"
 #include "jscore-class-private.h"
 #include "jscore-value-private.h"
+#include "jscore-probes.h"
+#include "jscore-profiler-private.h"
+#include "jscore-recorder-private.h"
+
+#include <string.h>
 
 static void
 jscore_object_class_init (JSCoreObjectClass *klass);
 static void
 jscore_object_init (JSCoreObject *self);
 
-#define JS_CORE_ERROR jscore__error_quark ()
-GQuark
-jscore_error_quark (void)
-{
-  return g_quark_from_static_string ("jscore-gobject-error");
-}
-
 G_DEFINE_TYPE (JSCoreObject, jscore_object, G_TYPE_OBJECT)
 
 static void
@@ -49,42 +48,36 @@ enum
 static guint signals[LAST_SIGNAL] =
   { 0 };
 
-struct _JSCoreObjectPrivate
+static JSContextRef
+get_real_context (JSCoreObject *object)
 {
-  JSObjectRef  object;
-  JSCoreContext *context;
-  gboolean dispose_has_run;
-};
+  return object->priv->context->priv->real;
+}
 
+/* Wrappers keep their object alive until they are disposed */
 static void
-set_error_from_js_exception (GError **error, JSValueRef exception, JSContextRef context)
+protect_object (JSCoreObject *object)
 {
-  JSStringRef message_property_name = JSStringCreateWithUTF8CString("message");
-  JSStringRef name_property_name = JSStringCreateWithUTF8CString("name");
-  gchar *name;
-  gchar *message;
-
-  g_assert ((exception));
-  if (!JSValueIsObject (context, (JSValueRef)exception))
+  if (object->priv->object == NULL)
     return;
 
-  message = jscore_value_get_string_real (context,
-                                          JSObjectGetProperty(context,
-                                                              (JSObjectRef) exception,
-                                                              message_property_name, NULL));
-
-  name = jscore_value_get_string_real (context,
-                                       JSObjectGetProperty(context,
-                                                           (JSObjectRef) exception,
-                                                           name_property_name, NULL));
-
-  g_set_error (error, JS_CORE_ERROR, 42, "%s: %s", name, message);
+  jscore_value_ref (object->priv->context, (JSCoreValue *) object->priv->object);
+  object->priv->protected = TRUE;
+  JSCORE_COUNT (object->priv->context, JSCORE_COUNTER_WRAPPERS_ALIVE, 1);
 }
 
-static JSContextRef
-get_real_context (JSCoreObject *object)
+/* Wraps an existing JS object without touching its private data */
+JSCoreObject *
+jscore_object_wrap (JSCoreContext *ctx, JSObjectRef object)
 {
-  return object->priv->context->priv->real;
+  GObject *gobject = g_object_new (JSCORE_TYPE_OBJECT, NULL);
+  JSCoreObject *jsObject = JSCORE_OBJECT (gobject);
+
+  jsObject->priv->context = ctx;
+  jsObject->priv->object = object;
+  protect_object (jsObject);
+
+  return jsObject;
 }
 
 JSCoreObject *
@@ -92,14 +85,55 @@ jscore_object_new (JSCoreContext *ctx, JSCoreClass *jsClass, void* data)
 {
   GObject *gobject = g_object_new (JSCORE_TYPE_OBJECT, NULL);
   JSCoreObject *jsObject = JSCORE_OBJECT (gobject);
+
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
   jsObject->priv->object = JSObjectMake (ctx->priv->real, jsClass->priv->class, data);
   jsObject->priv->context = ctx;
 
   JSObjectSetPrivate (jsObject->priv->object, jsObject);
+  protect_object (jsObject);
 
   return jsObject;
 }
 
+static void
+checksum_string (GChecksum *checksum,
+                 const gchar *string)
+{
+  /* The terminating nul keeps fields apart */
+  if (string)
+    g_checksum_update (checksum, (const guchar *) string, strlen (string) + 1);
+  else
+    g_checksum_update (checksum, (const guchar *) "\1", 2);
+}
+
+/* Functions only see the globals of their own context, which is part of
+ * the key along with everything they are compiled from */
+static gchar *
+function_key (JSCoreContext *ctx,
+              const gchar *name,
+              GArray *parameters_names,
+              const gchar *body,
+              const gchar *source_url)
+{
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  gchar *key;
+  guint i;
+
+  checksum_string (checksum, name);
+  for (i = 0; i < parameters_names->len; i++)
+    checksum_string (checksum, g_array_index (parameters_names, gpointer, i));
+  checksum_string (checksum, "");
+  checksum_string (checksum, body);
+  checksum_string (checksum, source_url);
+
+  key = g_strdup_printf ("%p:%s", ctx, g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+}
+
 // TODO: use param specs ? GVariant ? GValue ?
 JSCoreObject *
 jscore_object_new_from_function (JSCoreContext *ctx,
@@ -110,6 +144,18 @@ jscore_object_new_from_function (JSCoreContext *ctx,
                                  GError **error)
 {
   JSValueRef exception = 0;
+  JSCoreObject *cached;
+  gchar *key;
+
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
+  key = function_key (ctx, name, parameters_names, body, source_url);
+  cached = jscore_context_group_lookup_function (ctx->priv->group, key);
+  if (cached)
+    {
+      g_free (key);
+      return cached;
+    }
 
   GObject *gobject = g_object_new (JSCORE_TYPE_OBJECT, NULL);
   JSCoreObject *jsObject = JSCORE_OBJECT (gobject);
@@ -141,30 +187,61 @@ jscore_object_new_from_function (JSCoreContext *ctx,
                                                 0,
                                                 &exception);
 
-  JSObjectSetPrivate (jsObject->priv->object, jsObject);
-
   JSStringRelease (js_name);
   JSStringRelease (js_body);
   JSStringRelease (js_source);
 
   for (i = 0; i <js_parameters_names->len; i++)
     JSStringRelease (g_array_index(js_parameters_names, JSStringRef, i));
+  g_array_free (js_parameters_names, TRUE);
 
   if (exception)
-    set_error_from_js_exception (error, exception, ctx->priv->real);
+    {
+      /* Nothing was compiled, so there is nothing to wrap */
+      set_error_from_js_exception (error, exception, ctx);
+      jsObject->priv->object = NULL;
+      g_object_unref (jsObject);
+      g_free (key);
+      return NULL;
+    }
+
+  JSObjectSetPrivate (jsObject->priv->object, jsObject);
+  protect_object (jsObject);
+
+  jscore_context_group_cache_function (ctx->priv->group, key, ctx, jsObject);
+  g_free (key);
+
   return jsObject;
 }
 
-static JSObjectRef
+static void
 delegating_Callback (JSContextRef ctx, JSObjectRef constructor,
                      size_t argumentCount,
                      const JSValueRef arguments[],
                      JSValueRef* exception, guint signal_id)
 {
   JSCoreObject *jsObject = JSObjectGetPrivate (constructor);
+  gint64 sampled;
+  gint64 recorded;
+  gchar *name = NULL;
 
   GVariantBuilder builder;
 
+  /* The wrapper is gone, scripts may still hold the function */
+  if (jsObject == NULL)
+    return;
+
+  sampled = jscore_profiler_sample ();
+  recorded = jscore_recorder_active () ? jscore_recorder_now () : 0;
+
+  JSCORE_COUNT (jsObject->priv->context, JSCORE_COUNTER_CALLS_FROM_JS, 1);
+
+  /* Only looked up while a tracer is attached to the callback probes or
+   * while recording */
+  if (JSCORE_PROBE_ENABLED (callback_enter) || JSCORE_PROBE_ENABLED (callback_exit) || recorded)
+    name = jscore_value_get_function_name (ctx, constructor);
+  JSCORE_PROBE2 (callback_enter, jsObject->priv->context, name);
+
   g_variant_builder_init(&builder, G_VARIANT_TYPE_ARRAY);
 
   int i;
@@ -174,9 +251,22 @@ delegating_Callback (JSContextRef ctx, JSObjectRef constructor,
     g_variant_builder_add_value(&builder, value);
   }
 
+  /* Kept past the emission for the recorder */
   GVariant *arguments_variant = g_variant_builder_end(&builder);
+  if (arguments_variant)
+    g_variant_ref_sink (arguments_variant);
 
   g_signal_emit (jsObject, signal_id, signals[SIGNAL_FUNCTION_CALLED], arguments_variant);
+
+  JSCORE_PROBE2 (callback_exit, jsObject->priv->context, name);
+
+  if (sampled)
+    jscore_profiler_record (ctx, constructor, name, sampled);
+  if (recorded)
+    jscore_recorder_callback (name, arguments_variant, recorded);
+  if (arguments_variant)
+    g_variant_unref (arguments_variant);
+  g_free (name);
 }
 
 static JSObjectRef
@@ -189,6 +279,9 @@ delegating_JSObjectCallAsConstructorCallback (JSContextRef ctx, JSObjectRef cons
                        argumentCount,
                        arguments,
                        exception, signals[SIGNAL_FUNCTION_CALLED]);
+
+  /* Constructors have to produce an object */
+  return JSObjectMake (ctx, NULL, NULL);
 }
 
 JSValueRef
@@ -200,8 +293,29 @@ delegating_JSObjectCallAsFunctionCallback (JSContextRef ctx, JSObjectRef functio
                        argumentCount,
                        arguments,
                        exception, signals[SIGNAL_FUNCTION_CALLED]);
+
+  return JSValueMakeUndefined (ctx);
 }
 
+/* Functions made by JSObjectMakeFunctionWithCallback() have no private
+ * data, so callbacks are objects of a class that is callable instead */
+static JSClassRef
+get_callback_function_class (void)
+{
+  static gsize class = 0;
+
+  if (g_once_init_enter (&class))
+    {
+      JSClassDefinition definition = kJSClassDefinitionEmpty;
+
+      definition.className = "CallbackFunction";
+      definition.callAsFunction = delegating_JSObjectCallAsFunctionCallback;
+
+      g_once_init_leave (&class, (gsize) JSClassCreate (&definition));
+    }
+
+  return (JSClassRef) class;
+}
 
 JSCoreObject *
 jscore_object_new_from_function_with_callback (JSCoreContext *ctx,
@@ -210,12 +324,23 @@ jscore_object_new_from_function_with_callback (JSCoreContext *ctx,
   GObject *gobject = g_object_new (JSCORE_TYPE_OBJECT, NULL);
   JSCoreObject *jsObject = JSCORE_OBJECT (gobject);
 
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
+  JSStringRef jproperty = JSStringCreateWithUTF8CString ("name");
   JSStringRef jname = JSStringCreateWithUTF8CString (name);
   jsObject->priv->context = ctx;
-  jsObject->priv->object = JSObjectMakeFunctionWithCallback(ctx->priv->real, jname, delegating_JSObjectCallAsFunctionCallback);
-
-  JSObjectSetPrivate (jsObject->priv->object, jsObject);
-
+  jsObject->priv->object = JSObjectMake (ctx->priv->real,
+                                         get_callback_function_class (),
+                                         jsObject);
+
+  /* Read back by the profiler and the recorder */
+  JSObjectSetProperty (ctx->priv->real, jsObject->priv->object, jproperty,
+                       JSValueMakeString (ctx->priv->real, jname),
+                       kJSPropertyAttributeReadOnly | kJSPropertyAttributeDontEnum,
+                       NULL);
+  protect_object (jsObject);
+
+  JSStringRelease (jproperty);
   JSStringRelease (jname);
 
   return jsObject;
@@ -230,12 +355,15 @@ jscore_object_new_from_constructor (JSCoreContext *ctx,
   GObject *gobject = g_object_new (JSCORE_TYPE_OBJECT, NULL);
   JSCoreObject *jsObject = JSCORE_OBJECT (gobject);
 
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
   jsObject->priv->context = ctx;
   jsObject->priv->object = JSObjectMakeConstructor (ctx->priv->real,
                                                     jsClass->priv->class,
                                                     delegating_JSObjectCallAsConstructorCallback);
 
   JSObjectSetPrivate (jsObject->priv->object, jsObject);
+  protect_object (jsObject);
 
   return jsObject;
 }
@@ -250,6 +378,8 @@ jscore_object_new_from_array (JSCoreContext *ctx,
   GObject *gobject = g_object_new (JSCORE_TYPE_OBJECT, NULL);
   JSCoreObject *jsObject = JSCORE_OBJECT (gobject);
 
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
   jsObject->priv->context = ctx;
   jsObject->priv->object = JSObjectMakeArray (ctx->priv->real,
                                               num_elements,
@@ -257,22 +387,66 @@ jscore_object_new_from_array (JSCoreContext *ctx,
                                               &exception);
 
   JSObjectSetPrivate (jsObject->priv->object, jsObject);
+  protect_object (jsObject);
 
   if (exception)
-    set_error_from_js_exception (error, exception, ctx->priv->real);
+    set_error_from_js_exception (error, exception, ctx);
 
   return jsObject;
 }
 
+JSCoreObject *
+jscore_object_new_from_bytes (JSCoreContext *ctx,
+                              JSCoreTypedArrayType type,
+                              GBytes *bytes,
+                              GError **error)
+{
+  JSCoreValue *array = jscore_value_new_typed_array_from_bytes (ctx, type,
+                                                                bytes, error);
+
+  if (array == NULL)
+    return NULL;
+
+  return jscore_object_wrap (ctx, (JSObjectRef) array);
+}
+
+GBytes *
+jscore_object_get_bytes (JSCoreObject *object,
+                         GError **error)
+{
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+
+  return jscore_value_to_bytes (object->priv->context,
+                                (JSCoreValue *) object->priv->object,
+                                error);
+}
+
+JSCoreObject *
+jscore_object_rebind (JSCoreObject *object,
+                      JSCoreContext *context)
+{
+  g_return_val_if_fail (IS_JSCORE_OBJECT (object), NULL);
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), NULL);
+  g_return_val_if_fail (object->priv->context->priv->group == context->priv->group,
+                        NULL);
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  return jscore_object_wrap (context, object->priv->object);
+}
+
 JSCoreObject *
 jscore_object_new_from_date (JSCoreContext *ctx,
                              GDateTime *date,
                              GError **error)
 {
   JSValueRef exception = 0;
+
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
   //return JSObjectMakeDate(ctx->priv->real, )
   if (exception)
-    set_error_from_js_exception (error, exception, ctx->priv->real);
+    set_error_from_js_exception (error, exception, ctx);
 }
 
 JSCoreObject *
@@ -281,6 +455,9 @@ jscore_object_new_from_error (JSCoreContext *ctx,
                               GError **error)
 {
   JSValueRef* exception;
+
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
  // JSObjectMakeError()
 }
 
@@ -290,15 +467,18 @@ jscore_object_new_from_regexp (JSCoreContext *ctx,
                                GError **error)
 {
   JSValueRef exception = 0;
+
+  JSCORE_CONTEXT_CHECK_THREAD (ctx);
+
   //
   if (exception)
-    set_error_from_js_exception (error, exception, ctx->priv->real);
+    set_error_from_js_exception (error, exception, ctx);
 }
 
 JSCoreValue *
 jscore_object_get_prototype (JSCoreObject * object)
 {
-
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
   return (JSCoreValue *)JSObjectGetPrototype (get_real_context(object),
                                               object->priv->object);
 }
@@ -307,6 +487,8 @@ void
 jscore_object_set_prototype (JSCoreObject * object,
                              JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+
   JSObjectSetPrototype(get_real_context(object),
                        object->priv->object,
                        (JSValueRef)value);
@@ -316,8 +498,13 @@ gboolean
 jscore_object_has_property (JSCoreObject * object,
                             gchar *name)
 {
-  JSStringRef jname = JSStringCreateWithUTF8CString (name);
-  gboolean ret = JSObjectHasProperty(get_real_context(object), object->priv->object, jname);
+  JSStringRef jname;
+  gboolean ret;
+
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+
+  jname = JSStringCreateWithUTF8CString (name);
+  ret = JSObjectHasProperty(get_real_context(object), object->priv->object, jname);
   JSStringRelease (jname);
 
   return ret;
@@ -330,6 +517,10 @@ jscore_object_get_property (JSCoreObject *object,
 {
   JSValueRef exception = 0;
   JSCoreObjectPrivate *priv = object->priv;
+  gint64 recorded = jscore_recorder_active () ? jscore_recorder_now () : 0;
+
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+  JSCORE_COUNT (object->priv->context, JSCORE_COUNTER_PROPERTY_ACCESSES, 1);
 
   JSStringRef jname = JSStringCreateWithUTF8CString (name);
   JSValueRef ret = JSObjectGetProperty (get_real_context(object),
@@ -339,8 +530,13 @@ jscore_object_get_property (JSCoreObject *object,
 
   JSStringRelease (jname);
 
+  if (recorded)
+    jscore_recorder_property (JS_CORE_RECORD_PROPERTY_GET, name,
+                              ret ? JSValueGetType (get_real_context (object), ret) : kJSTypeUndefined,
+                              recorded);
+
   if (exception)
-    set_error_from_js_exception (error, exception, get_real_context(object));
+    set_error_from_js_exception (error, exception, object->priv->context);
 
   return (JSCoreValue *)ret;
 }
@@ -353,6 +549,10 @@ jscore_object_set_property (JSCoreObject * object,
                             GError** error)
 {
   JSCoreObjectPrivate *priv = object->priv;
+  gint64 recorded = jscore_recorder_active () ? jscore_recorder_now () : 0;
+
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+  JSCORE_COUNT (object->priv->context, JSCORE_COUNTER_PROPERTY_ACCESSES, 1);
 
   JSStringRef jname = JSStringCreateWithUTF8CString (name);
   JSValueRef exception = 0;
@@ -366,8 +566,13 @@ jscore_object_set_property (JSCoreObject * object,
 
   JSStringRelease (jname);
 
+  if (recorded && value)
+    jscore_recorder_property (JS_CORE_RECORD_PROPERTY_SET, name,
+                              JSValueGetType (get_real_context (object), (JSValueRef) value),
+                              recorded);
+
   if (exception)
-    set_error_from_js_exception (error, exception, get_real_context(object));
+    set_error_from_js_exception (error, exception, object->priv->context);
 }
 
 gboolean
@@ -378,14 +583,19 @@ jscore_object_delete_property (JSCoreObject *object,
   JSValueRef exception = 0;
   JSCoreObjectPrivate *priv = object->priv;
   JSStringRef jname = JSStringCreateWithUTF8CString (name);
-  gboolean ret = JSObjectDeleteProperty (get_real_context(object),
+  gboolean ret;
+
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+  JSCORE_COUNT (object->priv->context, JSCORE_COUNTER_PROPERTY_ACCESSES, 1);
+
+  ret = JSObjectDeleteProperty (get_real_context(object),
                                  priv->object,
                                  jname,
                                  &exception);
   JSStringRelease (jname);
 
   if (exception)
-    set_error_from_js_exception (error, exception, get_real_context(object));
+    set_error_from_js_exception (error, exception, object->priv->context);
 
   return ret;
 }
@@ -397,10 +607,15 @@ jscore_object_get_property_at_index (JSCoreObject * object,
 {
   JSCoreObjectPrivate *priv = object->priv;
   JSValueRef exception = 0;
-  JSValueRef value = JSObjectGetPropertyAtIndex (get_real_context(object),
+  JSValueRef value;
+
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+  JSCORE_COUNT (object->priv->context, JSCORE_COUNTER_PROPERTY_ACCESSES, 1);
+
+  value = JSObjectGetPropertyAtIndex (get_real_context(object),
                                      priv->object, index, &exception);
   if (exception)
-    set_error_from_js_exception (error, exception, get_real_context(object));
+    set_error_from_js_exception (error, exception, object->priv->context);
 
   return (JSCoreValue *)value;
 }
@@ -413,27 +628,37 @@ jscore_object_set_property_at_index (JSCoreObject * object,
 {
   JSCoreObjectPrivate *priv = object->priv;
   JSValueRef exception = 0;
+
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+  JSCORE_COUNT (object->priv->context, JSCORE_COUNTER_PROPERTY_ACCESSES, 1);
+
   JSObjectSetPropertyAtIndex (get_real_context(object),
                               priv->object, index, (JSValueRef)value, &exception);
   if (exception)
-    set_error_from_js_exception (error, exception, get_real_context(object));
+    set_error_from_js_exception (error, exception, object->priv->context);
 }
 
 gpointer
 jscore_object_get_private (JSCoreObject *object)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+
   return (gpointer) JSObjectGetPrivate (object->priv->object);
 }
 
 gboolean
 jscore_object_set_private (JSCoreObject *object, gpointer data)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+
   JSObjectSetPrivate (object->priv->object, data);
 }
 
 gboolean
 jscore_object_is_function (JSCoreObject *object)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+
   return JSObjectIsFunction (get_real_context(object), object->priv->object);
 }
 
@@ -465,12 +690,24 @@ jscore_object_call_as_function (JSCoreObject * object,
                         GError **error)
 {
   JSValueRef exception = 0;
+  gboolean outermost;
+
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
 
   if (thisObject == NULL)
     thisObject = object;
 
+  outermost = jscore_context_enter (object->priv->context);
+
 
   GArray *js_arguments = gvariant_to_js_value_array (object->priv->context, arguments, error);
+  if (js_arguments == NULL)
+    {
+      g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Arguments must be a tuple");
+      jscore_context_leave (object->priv->context, outermost);
+      return NULL;
+    }
 
   JSCoreValue *value = (JSCoreValue *)JSObjectCallAsFunction (get_real_context(object),
                                                               object->priv->object,
@@ -478,15 +715,103 @@ jscore_object_call_as_function (JSCoreObject * object,
                                                               js_arguments->len,
                                                               (JSValueRef *)js_arguments->data,
                                                               &exception);
-  g_array_free (js_arguments, FALSE);
+  g_array_free (js_arguments, TRUE);
 
   if (exception)
-    set_error_from_js_exception (error, exception, get_real_context(object));
+    {
+      set_error_from_js_exception (error, exception, object->priv->context);
+      value = NULL;
+    }
+
+  jscore_context_leave (object->priv->context, outermost);
+
+  return value;
+}
+
+typedef struct
+{
+  JSCoreObject *this_object;
+  GVariant *arguments;
+} CallData;
+
+static void
+call_data_free (CallData *data)
+{
+  if (data->this_object)
+    g_object_unref (data->this_object);
+  g_variant_unref (data->arguments);
+  g_slice_free (CallData, data);
+}
+
+static void
+run_call (JSCoreContext *context,
+          gpointer user_data)
+{
+  GTask *task = user_data;
+  JSCoreObject *object = g_task_get_source_object (task);
+  CallData *data = g_task_get_task_data (task);
+  GError *error = NULL;
+  JSCoreValue *result;
+  GVariant *variant;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  result = jscore_object_call_as_function (object, data->this_object,
+                                           data->arguments, &error);
+  if (error)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  variant = result ? jscore_value_to_variant (result, context) : NULL;
+  if (variant)
+    g_variant_ref_sink (variant);
+  g_task_return_pointer (task, variant, (GDestroyNotify) g_variant_unref);
+}
+
+void
+jscore_object_call_as_function_async (JSCoreObject *object,
+                                      JSCoreObject *thisObject,
+                                      GVariant *arguments,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data)
+{
+  CallData *data;
+  GTask *task;
+
+  g_return_if_fail (IS_JSCORE_OBJECT (object));
+
+  data = g_slice_new (CallData);
+  data->this_object = thisObject ? g_object_ref (thisObject) : NULL;
+  data->arguments = g_variant_ref_sink (arguments ? arguments
+                                                 : g_variant_new ("()"));
+
+  task = g_task_new (object, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jscore_object_call_as_function_async);
+  g_task_set_task_data (task, data, (GDestroyNotify) call_data_free);
+
+  jscore_context_invoke (object->priv->context, run_call, task,
+                         g_object_unref);
+}
+
+GVariant *
+jscore_object_call_as_function_finish (JSCoreObject *object,
+                                       GAsyncResult *result,
+                                       GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, object), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 gboolean
 jscore_object_is_constructor (JSCoreObject *object)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (object->priv->context);
+
   JSObjectIsConstructor (get_real_context(object), object->priv->object);
 }
 
@@ -498,8 +823,14 @@ jscore_object_call_as_constructor (JSCoreObject *self,
 {
   JSCoreObjectPrivate *priv = self->priv;
   JSValueRef exception = 0;
-  GArray *js_arguments = gvariant_to_js_value_array (priv->context, arguments, error);
+  GArray *js_arguments;
+  gboolean outermost;
+
+  JSCORE_CONTEXT_CHECK_THREAD (self->priv->context);
 
+  outermost = jscore_context_enter (priv->context);
+
+  js_arguments = gvariant_to_js_value_array (priv->context, arguments, error);
   GObject *gobject = g_object_new (JSCORE_TYPE_OBJECT, NULL);
   JSCoreObject *jsObject = JSCORE_OBJECT (gobject);
   jsObject->priv->context = self->priv->context;
@@ -512,7 +843,9 @@ jscore_object_call_as_constructor (JSCoreObject *self,
 
 
   if (exception)
-    set_error_from_js_exception (error, exception, get_real_context(self));
+    set_error_from_js_exception (error, exception, self->priv->context);
+
+  jscore_context_leave (priv->context, outermost);
 
   return jsObject;
 }
@@ -545,6 +878,7 @@ jscore_object_init (JSCoreObject *self)
 
   priv->context = NULL;
   priv->object = NULL;
+  priv->protected = FALSE;
   self->priv = priv;
   priv->dispose_has_run = FALSE;
 }
@@ -560,7 +894,14 @@ jscore_object_dispose (GObject *object)
     return;
 
   priv->dispose_has_run = TRUE;
-  JSValueUnprotect(get_real_context(self), priv->object);
+  /* Objects that failed to be created were never protected */
+  if (priv->protected)
+    {
+      if (JSObjectGetPrivate (priv->object) == self)
+        JSObjectSetPrivate (priv->object, NULL);
+      jscore_value_unref (priv->context, (JSCoreValue *) priv->object);
+      JSCORE_COUNT (priv->context, JSCORE_COUNTER_WRAPPERS_ALIVE, -1);
+    }
 
   G_OBJECT_CLASS (jscore_object_parent_class)->dispose (object);
 }
@@ -92,10 +92,14 @@ struct _JSCoreObject
 GType jscore_object_get_type (void) G_GNUC_CONST;
 
 JSCoreObject *jscore_object_new (JSCoreContext *ctx, JSCoreClass *jsClass, void* data);
+/* Compiled functions are cached by their group, the same name, parameters,
+ * body and source URL in a context may return the same object again.
+ * Returns NULL with error set when the body does not compile. */
 JSCoreObject *jscore_object_new_from_function (JSCoreContext *ctx, gchar *name, GArray *parameters_names, gchar *body, gchar *source_url, GError **error);
 JSCoreObject *jscore_object_new_from_function_with_callback (JSCoreContext *ctx, gchar *name);
 JSCoreObject *jscore_object_new_from_constructor (JSCoreContext *ctx, JSCoreClass *jsClass, JSCoreObjectCallAsConstructorCallback callAsConstructor);
 JSCoreObject *jscore_object_new_from_array (JSCoreContext *ctx,const gpointer elements[],gsize num_elements, GError **error);
+JSCoreObject *jscore_object_new_from_bytes (JSCoreContext *ctx, JSCoreTypedArrayType type, GBytes *bytes, GError **error);
 JSCoreObject *jscore_object_new_from_date (JSCoreContext *ctx, GDateTime *date, GError **error);
 JSCoreObject *jscore_object_new_from_error (JSCoreContext *ctx, GError *source_error, GError **error);
 JSCoreObject *jscore_object_new_from_regexp (JSCoreContext *ctx, GRegex *regex, GError **error);
@@ -112,8 +116,13 @@ gpointer jscore_object_get_private (JSCoreObject *object);
 gboolean jscore_object_set_private (JSCoreObject *object, gpointer data);
 gboolean jscore_object_is_function (JSCoreObject *object);
 JSCoreValue *jscore_object_call_as_function (JSCoreObject * object, JSCoreObject * thisObject, GVariant *arguments, GError **error);
+void jscore_object_call_as_function_async (JSCoreObject *object, JSCoreObject *thisObject, GVariant *arguments, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+GVariant *jscore_object_call_as_function_finish (JSCoreObject *object, GAsyncResult *result, GError **error);
 gboolean jscore_object_is_constructor (JSCoreObject *object);
 JSCoreObject *jscore_object_call_as_constructor (JSCoreObject *self, GVariant *arguments, GError **error);
+GBytes *jscore_object_get_bytes (JSCoreObject *object, GError **error);
+/* Same JS object seen from another context of the same group */
+JSCoreObject *jscore_object_rebind (JSCoreObject *object, JSCoreContext *context);
 
 G_END_DECLS
 
@@ -0,0 +1,39 @@
+/*
+ * jscore-probes.c - Semaphores of the static tracepoints
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-probes.h"
+
+#ifdef JSCORE_ENABLE_SDT
+
+/* Tracers find these through the probe notes and increment them */
+#define DEFINE_SEMAPHORE(name) \
+  volatile unsigned short JSCORE_PROBE_SEMAPHORE (name) __attribute__ ((section (".probes"))) = 0
+
+DEFINE_SEMAPHORE (evaluate_start);
+DEFINE_SEMAPHORE (evaluate_end);
+DEFINE_SEMAPHORE (callback_enter);
+DEFINE_SEMAPHORE (callback_exit);
+DEFINE_SEMAPHORE (variant_to_js);
+DEFINE_SEMAPHORE (js_to_variant);
+DEFINE_SEMAPHORE (context_create);
+DEFINE_SEMAPHORE (context_destroy);
+DEFINE_SEMAPHORE (gc_collect);
+
+#endif
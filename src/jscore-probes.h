@@ -0,0 +1,79 @@
+/*
+ * jscore-probes.h - Static tracepoints
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef js_core_probes_h
+#define js_core_probes_h
+
+#include <glib.h>
+
+/* USDT probes for perf, bpftrace and SystemTap, provider
+ * javascriptcore_gobject. Each probe has a semaphore that tracers raise
+ * while attached, so arguments are only computed then:
+ *
+ *   evaluate_start (context, source_url, line)
+ *   evaluate_end (context, source_url, failed)
+ *   callback_enter (context, function_name)
+ *   callback_exit (context, function_name)
+ *   variant_to_js (context, type_string, size)
+ *   js_to_variant (context, type_string, size)
+ *   context_create (context, group)
+ *   context_destroy (context, group)
+ *   gc_collect (group, mode)
+ */
+
+#ifdef JSCORE_ENABLE_SDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define JSCORE_PROBE_SEMAPHORE(name) javascriptcore_gobject_##name##_semaphore
+
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (evaluate_start);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (evaluate_end);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (callback_enter);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (callback_exit);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (variant_to_js);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (js_to_variant);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (context_create);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (context_destroy);
+extern volatile unsigned short JSCORE_PROBE_SEMAPHORE (gc_collect);
+
+#define JSCORE_PROBE_ENABLED(name) G_UNLIKELY (JSCORE_PROBE_SEMAPHORE (name))
+
+#define JSCORE_PROBE2(name, a, b)                                 \
+  G_STMT_START {                                                  \
+    if (JSCORE_PROBE_ENABLED (name))                              \
+      DTRACE_PROBE2 (javascriptcore_gobject, name, a, b);         \
+  } G_STMT_END
+#define JSCORE_PROBE3(name, a, b, c)                              \
+  G_STMT_START {                                                  \
+    if (JSCORE_PROBE_ENABLED (name))                              \
+      DTRACE_PROBE3 (javascriptcore_gobject, name, a, b, c);      \
+  } G_STMT_END
+
+#else
+
+#define JSCORE_PROBE_ENABLED(name) FALSE
+#define JSCORE_PROBE2(name, a, b) G_STMT_START { } G_STMT_END
+#define JSCORE_PROBE3(name, a, b, c) G_STMT_START { } G_STMT_END
+
+#endif
+
+#endif
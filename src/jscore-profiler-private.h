@@ -0,0 +1,37 @@
+/*
+ * jscore-profiler-private.h - Private header for the native callback profiler
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef js_core_profiler_private_h
+#define js_core_profiler_private_h
+
+#include "jscore-profiler.h"
+#include <JavaScriptCore/JavaScript.h>
+
+extern gint jscore_profiler_enabled;
+
+/* Start time in nanoseconds when this call is sampled, otherwise 0 */
+gint64 jscore_profiler_sample_real (void);
+/* name may be NULL, it is then looked up on function */
+void jscore_profiler_record (JSContextRef ctx, JSObjectRef function, const gchar *name, gint64 start);
+
+#define jscore_profiler_sample() \
+  (G_UNLIKELY (g_atomic_int_get (&jscore_profiler_enabled)) ? jscore_profiler_sample_real () : 0)
+
+#endif
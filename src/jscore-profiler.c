@@ -0,0 +1,540 @@
+/*
+ * jscore-profiler.c - Source for the native callback profiler
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-profiler.h"
+#include "jscore-profiler-private.h"
+#include "jscore-value-private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <JavaScriptCore/JavaScript.h>
+
+/* Log-linear buckets: exact below 4ns, then 4 per power of two, which
+ * keeps every bucket within 25% of the values it holds */
+#define SUB_BITS 2
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define MAX_BITS 48
+#define N_BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS)
+
+typedef struct
+{
+  gchar *name;
+  gchar *caller;
+  guint64 count;
+  guint64 total_ns;
+  guint64 min_ns;
+  guint64 max_ns;
+  guint64 buckets[N_BUCKETS];
+} Entry;
+
+gint jscore_profiler_enabled = 0;
+
+static guint sample_interval = 1;
+/* "name\ncaller" -> Entry */
+static GHashTable *entries = NULL;
+G_LOCK_DEFINE_STATIC (profiler);
+
+/* Calls left before the next sample on this thread */
+static GPrivate countdown = G_PRIVATE_INIT (NULL);
+
+static gint64
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static guint
+bucket_index (guint64 ns)
+{
+  guint msb;
+
+  if (ns < SUB_BUCKETS)
+    return ns;
+
+  msb = g_bit_storage (ns) - 1;
+  if (msb >= MAX_BITS)
+    return N_BUCKETS - 1;
+
+  return (msb - SUB_BITS + 1) * SUB_BUCKETS + ((ns >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* Largest value falling in the bucket */
+static guint64
+bucket_upper (guint index)
+{
+  guint msb, sub;
+
+  if (index < SUB_BUCKETS)
+    return index;
+
+  msb = index / SUB_BUCKETS + SUB_BITS - 1;
+  sub = index % SUB_BUCKETS;
+
+  return (((guint64) SUB_BUCKETS + sub + 1) << (msb - SUB_BITS)) - 1;
+}
+
+static guint64
+entry_percentile (Entry *entry, gdouble p)
+{
+  guint64 rank = (guint64) (p * entry->count), seen = 0;
+  guint i;
+
+  for (i = 0; i < N_BUCKETS; i++)
+    {
+      seen += entry->buckets[i];
+      if (seen > rank)
+        return MIN (bucket_upper (i), entry->max_ns);
+    }
+
+  return entry->max_ns;
+}
+
+static void
+entry_free (gpointer data)
+{
+  Entry *entry = data;
+
+  g_free (entry->name);
+  g_free (entry->caller);
+  g_slice_free (Entry, entry);
+}
+
+void
+jscore_profiler_start (guint interval)
+{
+  G_LOCK (profiler);
+  if (entries == NULL)
+    entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, entry_free);
+  sample_interval = MAX (interval, 1);
+  G_UNLOCK (profiler);
+
+  g_atomic_int_set (&jscore_profiler_enabled, TRUE);
+}
+
+void
+jscore_profiler_stop (void)
+{
+  g_atomic_int_set (&jscore_profiler_enabled, FALSE);
+}
+
+void
+jscore_profiler_reset (void)
+{
+  G_LOCK (profiler);
+  if (entries)
+    g_hash_table_remove_all (entries);
+  G_UNLOCK (profiler);
+}
+
+gint64
+jscore_profiler_sample_real (void)
+{
+  guint left = GPOINTER_TO_UINT (g_private_get (&countdown));
+
+  if (left > 1)
+    {
+      g_private_set (&countdown, GUINT_TO_POINTER (left - 1));
+      return 0;
+    }
+
+  g_private_set (&countdown, GUINT_TO_POINTER (sample_interval));
+
+  return MAX (now_ns (), 1);
+}
+
+/* Top script frame of the stack of a new error, as url:line */
+static gchar *
+get_caller (JSContextRef ctx)
+{
+  JSObjectRef error = JSObjectMakeError (ctx, 0, NULL, NULL);
+  JSStringRef jname = JSStringCreateWithUTF8CString ("stack");
+  JSValueRef stack = error ? JSObjectGetProperty (ctx, error, jname, NULL) : NULL;
+  gchar *caller = NULL, *text, **lines, **line;
+
+  JSStringRelease (jname);
+
+  if (stack == NULL || !JSValueIsString (ctx, stack))
+    return g_strdup ("(unknown)");
+
+  text = jscore_value_get_string_real (ctx, stack);
+  lines = g_strsplit (text ? text : "", "\n", -1);
+
+  for (line = lines; *line && caller == NULL; line++)
+    {
+      gchar *location = strchr (*line, '@');
+      gchar *column;
+
+      location = location ? location + 1 : *line;
+      if (*location == '\0' || strstr (location, "[native code]"))
+        continue;
+
+      caller = g_strdup (location);
+      /* Drop the column, keep the line */
+      column = strrchr (caller, ':');
+      if (column && strchr (caller, ':') != column)
+        *column = '\0';
+    }
+
+  g_strfreev (lines);
+  g_free (text);
+
+  return caller ? caller : g_strdup ("(unknown)");
+}
+
+void
+jscore_profiler_record (JSContextRef ctx,
+                        JSObjectRef function,
+                        const gchar *name,
+                        gint64 start)
+{
+  guint64 elapsed = MAX (now_ns () - start, 0);
+  gchar *caller = get_caller (ctx);
+  gchar *owned_name = NULL;
+  gchar *key;
+  Entry *entry;
+
+  if (name == NULL && function)
+    name = owned_name = jscore_value_get_function_name (ctx, function);
+  if (name == NULL || *name == '\0')
+    name = "(anonymous)";
+  key = g_strconcat (name, "\n", caller, NULL);
+
+  G_LOCK (profiler);
+
+  if (entries == NULL)
+    {
+      G_UNLOCK (profiler);
+      g_free (key);
+      g_free (caller);
+      g_free (owned_name);
+      return;
+    }
+
+  entry = g_hash_table_lookup (entries, key);
+  if (entry == NULL)
+    {
+      entry = g_slice_new0 (Entry);
+      entry->name = g_strdup (name);
+      entry->caller = caller;
+      entry->min_ns = G_MAXUINT64;
+      g_hash_table_insert (entries, key, entry);
+    }
+  else
+    {
+      g_free (key);
+      g_free (caller);
+    }
+
+  entry->count++;
+  entry->total_ns += elapsed;
+  entry->min_ns = MIN (entry->min_ns, elapsed);
+  entry->max_ns = MAX (entry->max_ns, elapsed);
+  entry->buckets[bucket_index (elapsed)]++;
+
+  G_UNLOCK (profiler);
+
+  g_free (owned_name);
+}
+
+static gint
+compare_entries (gconstpointer a, gconstpointer b)
+{
+  const Entry *ea = *(Entry **) a, *eb = *(Entry **) b;
+
+  return ea->total_ns > eb->total_ns ? -1 : ea->total_ns < eb->total_ns;
+}
+
+/* Entries by decreasing total time, call with the lock held */
+static GPtrArray *
+sorted_entries (void)
+{
+  GPtrArray *sorted = g_ptr_array_new ();
+  GHashTableIter iter;
+  gpointer value;
+
+  if (entries)
+    {
+      g_hash_table_iter_init (&iter, entries);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        g_ptr_array_add (sorted, value);
+    }
+  g_ptr_array_sort (sorted, compare_entries);
+
+  return sorted;
+}
+
+static void
+append_json_string (GString *json, const gchar *str)
+{
+  const gchar *p;
+
+  g_string_append_c (json, '"');
+  for (p = str; *p; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        g_string_append_printf (json, "\\%c", *p);
+      else if ((guchar) *p < 0x20)
+        g_string_append_printf (json, "\\u%04x", (guchar) *p);
+      else
+        g_string_append_c (json, *p);
+    }
+  g_string_append_c (json, '"');
+}
+
+gchar *
+jscore_profiler_dump_json (void)
+{
+  GString *json = g_string_new (NULL);
+  GPtrArray *sorted;
+  guint i, j;
+  gboolean first;
+
+  G_LOCK (profiler);
+
+  sorted = sorted_entries ();
+
+  g_string_append_printf (json, "{\"sample_interval\": %u, \"bindings\": [", sample_interval);
+  for (i = 0; i < sorted->len; i++)
+    {
+      Entry *entry = g_ptr_array_index (sorted, i);
+
+      g_string_append (json, i ? ",\n  {\"name\": " : "\n  {\"name\": ");
+      append_json_string (json, entry->name);
+      g_string_append (json, ", \"caller\": ");
+      append_json_string (json, entry->caller);
+      g_string_append_printf (json,
+                              ", \"samples\": %" G_GUINT64_FORMAT
+                              ", \"estimated_calls\": %" G_GUINT64_FORMAT
+                              ", \"total_ns\": %" G_GUINT64_FORMAT
+                              ", \"estimated_total_ns\": %" G_GUINT64_FORMAT
+                              ", \"min_ns\": %" G_GUINT64_FORMAT
+                              ", \"max_ns\": %" G_GUINT64_FORMAT
+                              ", \"p50_ns\": %" G_GUINT64_FORMAT
+                              ", \"p90_ns\": %" G_GUINT64_FORMAT
+                              ", \"p99_ns\": %" G_GUINT64_FORMAT
+                              ", \"histogram\": [",
+                              entry->count, entry->count * sample_interval,
+                              entry->total_ns, entry->total_ns * sample_interval,
+                              entry->min_ns, entry->max_ns,
+                              entry_percentile (entry, 0.5),
+                              entry_percentile (entry, 0.9),
+                              entry_percentile (entry, 0.99));
+
+      /* Only non-empty buckets, by upper bound */
+      for (j = 0, first = TRUE; j < N_BUCKETS; j++)
+        {
+          if (entry->buckets[j] == 0)
+            continue;
+          g_string_append_printf (json, "%s{\"le\": %" G_GUINT64_FORMAT ", \"count\": %" G_GUINT64_FORMAT "}",
+                                  first ? "" : ", ", bucket_upper (j), entry->buckets[j]);
+          first = FALSE;
+        }
+      g_string_append (json, "]}");
+    }
+  g_string_append (json, "\n]}\n");
+
+  G_UNLOCK (profiler);
+
+  g_ptr_array_free (sorted, TRUE);
+
+  return g_string_free (json, FALSE);
+}
+
+/* Protocol buffer encoding, just what profile.proto needs */
+
+static void
+put_varint (GByteArray *buf, guint64 value)
+{
+  guint8 byte;
+
+  do
+    {
+      byte = value & 0x7f;
+      value >>= 7;
+      if (value)
+        byte |= 0x80;
+      g_byte_array_append (buf, &byte, 1);
+    }
+  while (value);
+}
+
+static void
+put_uint (GByteArray *buf, guint field, guint64 value)
+{
+  put_varint (buf, field << 3);
+  put_varint (buf, value);
+}
+
+static void
+put_bytes (GByteArray *buf, guint field, const guint8 *data, gsize length)
+{
+  put_varint (buf, (field << 3) | 2);
+  put_varint (buf, length);
+  g_byte_array_append (buf, data, length);
+}
+
+/* Appends msg as a submessage and frees it */
+static void
+put_message (GByteArray *buf, guint field, GByteArray *msg)
+{
+  put_bytes (buf, field, msg->data, msg->len);
+  g_byte_array_free (msg, TRUE);
+}
+
+typedef struct
+{
+  GByteArray *profile;
+  GHashTable *strings;
+  GHashTable *functions;
+  guint64 n_strings;
+  guint64 n_functions;
+} ProfileBuilder;
+
+static guint64
+intern (ProfileBuilder *builder, const gchar *str)
+{
+  gpointer index;
+
+  if (g_hash_table_lookup_extended (builder->strings, str, NULL, &index))
+    return GPOINTER_TO_SIZE (index);
+
+  g_hash_table_insert (builder->strings, g_strdup (str),
+                       GSIZE_TO_POINTER (builder->n_strings));
+  /* string_table */
+  put_bytes (builder->profile, 6, (const guint8 *) str, strlen (str));
+
+  return builder->n_strings++;
+}
+
+static void
+put_value_type (ProfileBuilder *builder, guint field, const gchar *type, const gchar *unit)
+{
+  GByteArray *msg = g_byte_array_new ();
+
+  put_uint (msg, 1, intern (builder, type));
+  put_uint (msg, 2, intern (builder, unit));
+  put_message (builder->profile, field, msg);
+}
+
+/* Function and location sharing one id, for a binding or a caller */
+static guint64
+location_id (ProfileBuilder *builder, const gchar *name, const gchar *filename, gint64 line)
+{
+  GByteArray *msg, *line_msg;
+  gchar *key = g_strconcat (filename, "\n", name, NULL);
+  gpointer id;
+  guint64 name_index, file_index;
+
+  if (g_hash_table_lookup_extended (builder->functions, key, NULL, &id))
+    {
+      g_free (key);
+      return GPOINTER_TO_SIZE (id);
+    }
+
+  id = GSIZE_TO_POINTER (++builder->n_functions);
+  g_hash_table_insert (builder->functions, key, id);
+
+  name_index = intern (builder, name);
+  file_index = intern (builder, filename);
+
+  /* function */
+  msg = g_byte_array_new ();
+  put_uint (msg, 1, GPOINTER_TO_SIZE (id));
+  put_uint (msg, 2, name_index);
+  put_uint (msg, 3, name_index);
+  put_uint (msg, 4, file_index);
+  put_message (builder->profile, 5, msg);
+
+  /* location with one line */
+  line_msg = g_byte_array_new ();
+  put_uint (line_msg, 1, GPOINTER_TO_SIZE (id));
+  put_uint (line_msg, 2, line);
+  msg = g_byte_array_new ();
+  put_uint (msg, 1, GPOINTER_TO_SIZE (id));
+  put_message (msg, 4, line_msg);
+  put_message (builder->profile, 4, msg);
+
+  return GPOINTER_TO_SIZE (id);
+}
+
+GBytes *
+jscore_profiler_dump_pprof (void)
+{
+  ProfileBuilder builder;
+  GPtrArray *sorted;
+  guint i;
+
+  builder.profile = g_byte_array_new ();
+  builder.strings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  builder.functions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  builder.n_strings = 0;
+  builder.n_functions = 0;
+
+  intern (&builder, "");
+  put_value_type (&builder, 1, "calls", "count");
+  put_value_type (&builder, 1, "latency", "nanoseconds");
+
+  G_LOCK (profiler);
+
+  sorted = sorted_entries ();
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      Entry *entry = g_ptr_array_index (sorted, i);
+      GByteArray *sample = g_byte_array_new (), *packed = g_byte_array_new ();
+      gchar *url = g_strdup (entry->caller), *colon = strrchr (url, ':');
+      gint64 line = 0;
+
+      if (colon && colon != url)
+        {
+          line = g_ascii_strtoll (colon + 1, NULL, 10);
+          *colon = '\0';
+        }
+
+      /* Leaf first */
+      put_varint (packed, location_id (&builder, entry->name, "[native]", 0));
+      put_varint (packed, location_id (&builder, entry->caller, url, line));
+      put_bytes (sample, 1, packed->data, packed->len);
+      g_byte_array_set_size (packed, 0);
+
+      put_varint (packed, entry->count * sample_interval);
+      put_varint (packed, entry->total_ns * sample_interval);
+      put_bytes (sample, 2, packed->data, packed->len);
+      g_byte_array_free (packed, TRUE);
+
+      put_message (builder.profile, 2, sample);
+      g_free (url);
+    }
+
+  put_value_type (&builder, 11, "calls", "count");
+  put_uint (builder.profile, 12, sample_interval);
+
+  G_UNLOCK (profiler);
+
+  g_ptr_array_free (sorted, TRUE);
+  g_hash_table_destroy (builder.strings);
+  g_hash_table_destroy (builder.functions);
+
+  return g_byte_array_free_to_bytes (builder.profile);
+}
@@ -0,0 +1,43 @@
+/*
+ * jscore-profiler.h - Header for the native callback profiler
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_PROFILER_H__
+#define __JSCORE_PROFILER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Process wide profiler of calls from scripts into native functions. One
+ * in sample_interval calls per thread is timed into a log-linear latency
+ * histogram keyed by function name and the source location of the
+ * calling script. Starting again keeps the data, reset drops it. */
+void jscore_profiler_start (guint sample_interval);
+void jscore_profiler_stop (void);
+void jscore_profiler_reset (void);
+/* Counts are as sampled, estimated totals are scaled by the interval */
+gchar *jscore_profiler_dump_json (void);
+/* Uncompressed profile.proto, which pprof reads as is. Each sample is a
+ * native function called from a script location. */
+GBytes *jscore_profiler_dump_pprof (void);
+
+G_END_DECLS
+
+#endif /* __JSCORE_PROFILER_H__ */
@@ -0,0 +1,367 @@
+/*
+ * jscore-promise.c - Source for awaiting promises from C
+ *
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "jscore-promise.h"
+#include "jscore-context-private.h"
+#include "jscore-value-private.h"
+
+#include <JavaScriptCore/JavaScript.h>
+
+/*
+ * JavaScriptCore runs pending microtasks whenever a call leaves the API,
+ * so the native handlers below may fire in the middle of any later call.
+ * They only record the outcome, the tasks are completed from a source on
+ * the owning main context which takes every settlement queued so far.
+ */
+
+typedef struct
+{
+  gint ref_count;
+  /* Kept alive by the task, as its source object */
+  JSCoreContext *context;
+  GTask *task;
+  GSource *cancel_source;
+  gboolean settled;
+  GVariant *result;
+  GError *error;
+} Reaction;
+
+typedef struct
+{
+  Reaction *reaction;
+  gboolean reject;
+} Handler;
+
+static const gchar then_source[] =
+  "(function (value, onFulfilled, onRejected) {"
+  "  Promise.resolve (value).then (onFulfilled, onRejected);"
+  "})";
+
+static Reaction *
+reaction_ref (Reaction *reaction)
+{
+  reaction->ref_count++;
+
+  return reaction;
+}
+
+static void
+reaction_unref (Reaction *reaction)
+{
+  if (--reaction->ref_count > 0)
+    return;
+
+  if (reaction->result)
+    g_variant_unref (reaction->result);
+  if (reaction->error)
+    g_error_free (reaction->error);
+  g_object_unref (reaction->task);
+  g_slice_free (Reaction, reaction);
+}
+
+void
+jscore_context_complete_settled (JSCoreContext *context)
+{
+  JSCoreContextPrivate *priv = context->priv;
+  Reaction *reaction;
+
+  while ((reaction = g_queue_pop_head (&priv->settled)))
+    {
+      if (reaction->error)
+        g_task_return_error (reaction->task, reaction->error);
+      else
+        g_task_return_pointer (reaction->task, reaction->result,
+                               (GDestroyNotify) g_variant_unref);
+
+      reaction->error = NULL;
+      reaction->result = NULL;
+      reaction_unref (reaction);
+    }
+}
+
+static void
+settle (Reaction *reaction,
+        GVariant *result,
+        GError *error)
+{
+  JSCoreContextPrivate *priv = reaction->context->priv;
+
+  reaction->settled = TRUE;
+  reaction->result = result;
+  reaction->error = error;
+
+  if (reaction->cancel_source)
+    {
+      g_source_destroy (reaction->cancel_source);
+      g_source_unref (reaction->cancel_source);
+      reaction->cancel_source = NULL;
+    }
+
+  g_queue_push_tail (&priv->settled, reaction_ref (reaction));
+
+  /* Once the context is disposed there is no source left to wait for */
+  if (priv->settle_source)
+    g_source_set_ready_time (priv->settle_source, 0);
+  else
+    jscore_context_complete_settled (reaction->context);
+}
+
+static JSValueRef
+handler_call (JSContextRef ctx,
+              JSObjectRef function,
+              JSObjectRef this_object,
+              size_t argument_count,
+              const JSValueRef arguments[],
+              JSValueRef *exception)
+{
+  Handler *handler = JSObjectGetPrivate (function);
+  Reaction *reaction = handler->reaction;
+  JSValueRef value;
+  GVariant *result;
+  GError *error = NULL;
+
+  if (reaction->settled)
+    return JSValueMakeUndefined (ctx);
+
+  value = argument_count > 0 ? arguments[0] : JSValueMakeUndefined (ctx);
+
+  if (handler->reject)
+    {
+      set_error_from_js_exception (&error, value, reaction->context);
+      settle (reaction, NULL, error);
+    }
+  else
+    {
+      result = jscore_value_to_variant ((JSCoreValue *) value,
+                                        reaction->context);
+      if (result)
+        g_variant_ref_sink (result);
+      settle (reaction, result, NULL);
+    }
+
+  return JSValueMakeUndefined (ctx);
+}
+
+/* A promise that is collected without settling will never settle */
+static void
+handler_finalize (JSObjectRef object)
+{
+  Handler *handler = JSObjectGetPrivate (object);
+  Reaction *reaction = handler->reaction;
+
+  if (!reaction->settled)
+    settle (reaction, NULL,
+            g_error_new_literal (JS_CORE_ERROR, JS_CORE_ERROR_FAILED,
+                                 "Promise was collected before settling"));
+
+  reaction_unref (reaction);
+  g_slice_free (Handler, handler);
+}
+
+static JSClassRef
+get_handler_class (void)
+{
+  static gsize class = 0;
+
+  if (g_once_init_enter (&class))
+    {
+      JSClassDefinition definition = kJSClassDefinitionEmpty;
+
+      definition.className = "PromiseReaction";
+      definition.callAsFunction = handler_call;
+      definition.finalize = handler_finalize;
+
+      g_once_init_leave (&class, (gsize) JSClassCreate (&definition));
+    }
+
+  return (JSClassRef) class;
+}
+
+static JSObjectRef
+make_handler (JSContextRef ctx,
+              Reaction *reaction,
+              gboolean reject)
+{
+  Handler *handler = g_slice_new (Handler);
+
+  handler->reaction = reaction_ref (reaction);
+  handler->reject = reject;
+
+  return JSObjectMake (ctx, get_handler_class (), handler);
+}
+
+static gboolean
+reaction_cancelled (GCancellable *cancellable,
+                    gpointer user_data)
+{
+  Reaction *reaction = user_data;
+
+  if (!reaction->settled)
+    settle (reaction, NULL,
+            g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 "Operation was cancelled"));
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+settle_source_dispatch (GSource *source,
+                        GSourceFunc callback,
+                        gpointer user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs settle_source_funcs = {
+  NULL,
+  NULL,
+  settle_source_dispatch,
+  NULL
+};
+
+static gboolean
+run_settled (gpointer data)
+{
+  JSCoreContext *context = g_object_ref (data);
+
+  /* Completing the last task may drop the last other reference */
+  jscore_context_complete_settled (context);
+  g_object_unref (context);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static JSObjectRef
+get_then (JSCoreContext *context,
+          GError **error)
+{
+  JSCoreContextPrivate *priv = context->priv;
+  JSValueRef exception = NULL;
+  JSStringRef script;
+  JSValueRef then;
+
+  if (priv->promise_then)
+    return priv->promise_then;
+
+  script = JSStringCreateWithUTF8CString (then_source);
+  then = JSEvaluateScript (priv->real, script, NULL, NULL, 1, &exception);
+  JSStringRelease (script);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return NULL;
+    }
+
+  jscore_value_protect (priv->real, then);
+  priv->promise_then = (JSObjectRef) then;
+
+  /* The source is weak, the context removes it when disposed */
+  priv->settle_source = g_source_new (&settle_source_funcs, sizeof (GSource));
+  g_source_set_name (priv->settle_source, "JSCoreContext promises");
+  g_source_set_callback (priv->settle_source, run_settled, context, NULL);
+  g_source_attach (priv->settle_source, priv->group->priv->owner_context);
+
+  return priv->promise_then;
+}
+
+void
+jscore_value_promise_then_async (JSCoreContext *context,
+                                 JSCoreValue *value,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data)
+{
+  JSCoreContextPrivate *priv;
+  JSValueRef exception = NULL;
+  JSValueRef arguments[3];
+  JSObjectRef then;
+  Reaction *reaction;
+  GError *error = NULL;
+  GTask *task;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT (context));
+  g_return_if_fail (value != NULL);
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  priv = context->priv;
+
+  task = g_task_new (context, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jscore_value_promise_then_async);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_object_unref (task);
+      return;
+    }
+
+  then = get_then (context, &error);
+  if (then == NULL)
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  reaction = g_slice_new0 (Reaction);
+  reaction->ref_count = 1;
+  reaction->context = context;
+  reaction->task = task;
+
+  if (cancellable)
+    {
+      reaction->cancel_source = g_cancellable_source_new (cancellable);
+      g_source_set_callback (reaction->cancel_source,
+                             (GSourceFunc) reaction_cancelled,
+                             reaction_ref (reaction),
+                             (GDestroyNotify) reaction_unref);
+      g_source_attach (reaction->cancel_source,
+                       priv->group->priv->owner_context);
+    }
+
+  arguments[0] = (JSValueRef) value;
+  arguments[1] = make_handler (priv->real, reaction, FALSE);
+  arguments[2] = make_handler (priv->real, reaction, TRUE);
+
+  JSObjectCallAsFunction (priv->real, then, NULL, 3, arguments, &exception);
+
+  if (exception && !reaction->settled)
+    {
+      set_error_from_js_exception (&error, exception, context);
+      settle (reaction, NULL, error);
+    }
+
+  reaction_unref (reaction);
+}
+
+GVariant *
+jscore_value_promise_then_finish (JSCoreContext *context,
+                                  GAsyncResult *result,
+                                  GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, context), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,37 @@
+/*
+ * jscore-promise.h - Header for awaiting promises from C
+ *
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_PROMISE_H__
+#define __JSCORE_PROMISE_H__
+
+#include "jscore-value.h"
+
+G_BEGIN_DECLS
+
+/* Completes once value, or the promise it resolves to, settles. A
+ * rejection becomes a JS_CORE_ERROR_EXCEPTION error. Settlements are
+ * delivered from the context's main context, all at once per wakeup. */
+void jscore_value_promise_then_async (JSCoreContext *context, JSCoreValue *value, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+GVariant *jscore_value_promise_then_finish (JSCoreContext *context, GAsyncResult *result, GError **error);
+
+G_END_DECLS
+
+#endif /* __JSCORE_PROMISE_H__ */
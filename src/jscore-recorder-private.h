@@ -0,0 +1,37 @@
+/*
+ * jscore-recorder-private.h - Private header for the boundary traffic recorder
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef js_core_recorder_private_h
+#define js_core_recorder_private_h
+
+#include "jscore-recorder.h"
+
+extern gint jscore_recorder_enabled;
+
+#define jscore_recorder_active() \
+  G_UNLIKELY (g_atomic_int_get (&jscore_recorder_enabled))
+
+/* Monotonic time in nanoseconds, for durations */
+gint64 jscore_recorder_now (void);
+void jscore_recorder_evaluate (const gchar *source_url, const gchar *script, gint64 start);
+void jscore_recorder_callback (const gchar *name, GVariant *arguments, gint64 start);
+void jscore_recorder_property (JSCoreRecordKind kind, const gchar *name, gint type, gint64 start);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * jscore-recorder.c - Source for the boundary traffic recorder
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-recorder.h"
+#include "jscore-recorder-private.h"
+#include "jscore-value.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <glib/gstdio.h>
+
+gint jscore_recorder_enabled = 0;
+
+static FILE *trace = NULL;
+static gint64 origin = 0;
+G_LOCK_DEFINE_STATIC (recorder);
+
+gint64
+jscore_recorder_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+gboolean
+jscore_recorder_start (const gchar *filename,
+                       GError **error)
+{
+  const guint8 version = JS_CORE_TRACE_VERSION;
+  FILE *file;
+
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  G_LOCK (recorder);
+
+  if (trace)
+    {
+      G_UNLOCK (recorder);
+      g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "A trace is already being recorded");
+      return FALSE;
+    }
+
+  file = g_fopen (filename, "wb");
+  if (file == NULL)
+    {
+      gint saved_errno = errno;
+
+      G_UNLOCK (recorder);
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "Cannot open %s: %s", filename, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  fwrite (JS_CORE_TRACE_MAGIC, 1, strlen (JS_CORE_TRACE_MAGIC), file);
+  fwrite (&version, 1, 1, file);
+
+  trace = file;
+  origin = jscore_recorder_now ();
+  g_atomic_int_set (&jscore_recorder_enabled, TRUE);
+
+  G_UNLOCK (recorder);
+
+  return TRUE;
+}
+
+void
+jscore_recorder_stop (void)
+{
+  G_LOCK (recorder);
+
+  g_atomic_int_set (&jscore_recorder_enabled, FALSE);
+  if (trace)
+    {
+      fclose (trace);
+      trace = NULL;
+    }
+
+  G_UNLOCK (recorder);
+}
+
+static void
+put_varint (GByteArray *buf, guint64 value)
+{
+  guint8 byte;
+
+  do
+    {
+      byte = value & 0x7f;
+      value >>= 7;
+      if (value)
+        byte |= 0x80;
+      g_byte_array_append (buf, &byte, 1);
+    }
+  while (value);
+}
+
+static void
+put_bytes (GByteArray *buf, gconstpointer data, gsize length)
+{
+  put_varint (buf, length);
+  g_byte_array_append (buf, data, length);
+}
+
+static void
+put_string (GByteArray *buf, const gchar *str)
+{
+  put_bytes (buf, str ? str : "", str ? strlen (str) : 0);
+}
+
+static GByteArray *
+record_new (JSCoreRecordKind kind, gint64 start)
+{
+  GByteArray *buf = g_byte_array_sized_new (64);
+  guint8 byte = kind;
+  gint64 now = jscore_recorder_now ();
+
+  g_byte_array_append (buf, &byte, 1);
+  put_varint (buf, MAX (start - origin, 0) / 1000);
+  put_varint (buf, MAX (now - start, 0));
+
+  return buf;
+}
+
+static void
+record_write (GByteArray *buf)
+{
+  G_LOCK (recorder);
+  if (trace)
+    fwrite (buf->data, 1, buf->len, trace);
+  G_UNLOCK (recorder);
+
+  g_byte_array_free (buf, TRUE);
+}
+
+/* Same shape and size, none of the data */
+static GVariant *
+scrub (GVariant *value)
+{
+  switch (g_variant_classify (value))
+    {
+    case G_VARIANT_CLASS_STRING:
+      {
+        gsize length;
+        gchar *str;
+
+        g_variant_get_string (value, &length);
+        str = g_strnfill (length, 'x');
+        return g_variant_new_take_string (str);
+      }
+    /* Zero bytes would not be valid, these get the shortest valid values */
+    case G_VARIANT_CLASS_OBJECT_PATH:
+      return g_variant_new_object_path ("/");
+    case G_VARIANT_CLASS_SIGNATURE:
+      return g_variant_new_signature ("");
+    case G_VARIANT_CLASS_VARIANT:
+      {
+        GVariant *child = g_variant_get_variant (value);
+        GVariant *result = g_variant_new_variant (scrub (child));
+
+        g_variant_unref (child);
+        return result;
+      }
+    case G_VARIANT_CLASS_MAYBE:
+    case G_VARIANT_CLASS_ARRAY:
+    case G_VARIANT_CLASS_TUPLE:
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      {
+        gsize i, n = g_variant_n_children (value);
+        GVariant **children = g_new (GVariant *, MAX (n, 1));
+        GVariant *result;
+
+        for (i = 0; i < n; i++)
+          {
+            GVariant *child = g_variant_get_child_value (value, i);
+
+            children[i] = scrub (child);
+            g_variant_unref (child);
+          }
+
+        switch (g_variant_classify (value))
+          {
+          case G_VARIANT_CLASS_MAYBE:
+            result = g_variant_new_maybe (g_variant_type_element (g_variant_get_type (value)),
+                                          n ? children[0] : NULL);
+            break;
+          case G_VARIANT_CLASS_ARRAY:
+            result = g_variant_new_array (g_variant_type_element (g_variant_get_type (value)),
+                                          children, n);
+            break;
+          case G_VARIANT_CLASS_DICT_ENTRY:
+            result = g_variant_new_dict_entry (children[0], children[1]);
+            break;
+          default:
+            result = g_variant_new_tuple (children, n);
+            break;
+          }
+
+        g_free (children);
+        return result;
+      }
+    default:
+      /* Numbers and booleans, all zero bytes of the same size */
+      {
+        gsize size = g_variant_get_size (value);
+        gpointer zeros = g_malloc0 (MAX (size, 1));
+        GVariant *result = g_variant_new_from_data (g_variant_get_type (value), zeros,
+                                                    size, TRUE, g_free, zeros);
+        return result;
+      }
+    }
+}
+
+void
+jscore_recorder_evaluate (const gchar *source_url,
+                          const gchar *script,
+                          gint64 start)
+{
+  GByteArray *buf = record_new (JS_CORE_RECORD_EVALUATE, start);
+
+  put_string (buf, source_url);
+  put_string (buf, script);
+  record_write (buf);
+}
+
+void
+jscore_recorder_callback (const gchar *name,
+                          GVariant *arguments,
+                          gint64 start)
+{
+  GByteArray *buf = record_new (JS_CORE_RECORD_CALLBACK, start);
+  GVariant *shape = g_variant_ref_sink (arguments ? scrub (arguments) : g_variant_new_tuple (NULL, 0));
+
+  put_string (buf, name);
+  put_string (buf, g_variant_get_type_string (shape));
+  put_bytes (buf, g_variant_get_data (shape), g_variant_get_size (shape));
+  g_variant_unref (shape);
+  record_write (buf);
+}
+
+void
+jscore_recorder_property (JSCoreRecordKind kind,
+                          const gchar *name,
+                          gint type,
+                          gint64 start)
+{
+  GByteArray *buf = record_new (kind, start);
+
+  put_string (buf, name);
+  put_varint (buf, type);
+  record_write (buf);
+}
@@ -0,0 +1,60 @@
+/*
+ * jscore-recorder.h - Header for the boundary traffic recorder
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_RECORDER_H__
+#define __JSCORE_RECORDER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Trace files start with JS_CORE_TRACE_MAGIC and a version byte, then hold
+ * records of a kind byte followed by unsigned LEB128 varints:
+ *
+ *   time since the start of the trace in microseconds
+ *   duration in nanoseconds
+ *   and per kind, with strings as a length and bytes:
+ *     EVALUATE      source url, script
+ *     CALLBACK      function name, argument type string, arguments
+ *     PROPERTY_GET  property name, JSType of the value
+ *     PROPERTY_SET  property name, JSType of the value
+ *
+ * Callback arguments are serialized GVariant data with strings replaced
+ * by as many 'x' and numbers by 0, so they keep their shape and size.
+ * Scripts are recorded as they are. */
+#define JS_CORE_TRACE_MAGIC "JSCTRACE"
+#define JS_CORE_TRACE_VERSION 1
+
+typedef enum
+{
+  JS_CORE_RECORD_EVALUATE = 1,
+  JS_CORE_RECORD_CALLBACK,
+  JS_CORE_RECORD_PROPERTY_GET,
+  JS_CORE_RECORD_PROPERTY_SET
+} JSCoreRecordKind;
+
+/* Process wide, records calls from all threads until stopped. See
+ * tools/jscore-replay. */
+gboolean jscore_recorder_start (const gchar *filename, GError **error);
+void jscore_recorder_stop (void);
+
+G_END_DECLS
+
+#endif /* __JSCORE_RECORDER_H__ */
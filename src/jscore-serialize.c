@@ -0,0 +1,1253 @@
+/*
+ * jscore-serialize.c - Source for the structured clone serializer
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jscore-serialize.h"
+#include "jscore-context-private.h"
+#include "jscore-value-private.h"
+
+#include <math.h>
+#include <string.h>
+#include <JavaScriptCore/JavaScript.h>
+
+/*
+ * Format: an 8 bytes header ("JSCS", version, byte order, 2 reserved)
+ * followed by one tagged value. Integers are LEB128 varints, doubles are
+ * raw in the byte order of the header, strings are a count of UTF-16 code
+ * units followed by them in that order too. Every object gets an id in the
+ * order it is first met and later occurrences are written as a back
+ * reference, which keeps cycles and shared sub-graphs intact.
+ */
+
+#define MAGIC "JSCS"
+#define FORMAT_VERSION 3
+#define HEADER_SIZE 8
+#define MAX_DEPTH 2048
+#define BUFFER_ALIGNMENT 8
+/* Longer arrays with fewer than half their elements present are written
+ * as index and value pairs */
+#define SPARSE_ARRAY_MIN_LENGTH 1024
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define BYTE_ORDER_MARK 'l'
+#else
+#define BYTE_ORDER_MARK 'B'
+#endif
+
+enum
+{
+  TAG_UNDEFINED = 'u',
+  TAG_NULL = 'n',
+  TAG_TRUE = 'T',
+  TAG_FALSE = 'F',
+  TAG_INT = 'i',
+  TAG_DOUBLE = 'd',
+  TAG_STRING = 's',
+  TAG_OBJECT = 'o',
+  TAG_ARRAY = 'a',
+  TAG_SPARSE_ARRAY = 'A',
+  TAG_DATE = 'D',
+  TAG_REGEXP = 'R',
+  TAG_MAP = 'M',
+  TAG_SET = 'S',
+  TAG_ARRAY_BUFFER = 'B',
+  TAG_SHARED_BUFFER = 't',
+  TAG_TYPED_ARRAY = 'V',
+  TAG_BACKREF = 'r'
+};
+
+/* What the C API cannot tell apart or build is left to a few JS helpers */
+static const gchar helpers_source[] =
+  "(function () {\n"
+  "  var toString = Object.prototype.toString;\n"
+  "  return {\n"
+  "    tag: function (v) { return toString.call (v); },\n"
+  "    arrayIndices: function (a) {\n"
+  "      return Object.keys (a).filter (function (k) {\n"
+  "        return String (k >>> 0) === k && (k >>> 0) < a.length;\n"
+  "      }).map (Number);\n"
+  "    },\n"
+  "    regExpFlags: function (r) {\n"
+  "      return r.flags !== undefined ? r.flags :\n"
+  "        (r.global ? 'g' : '') + (r.ignoreCase ? 'i' : '') + (r.multiline ? 'm' : '');\n"
+  "    },\n"
+  "    mapEntries: function (m) {\n"
+  "      var a = []; m.forEach (function (v, k) { a.push (k, v); }); return a;\n"
+  "    },\n"
+  "    setValues: function (s) {\n"
+  "      var a = []; s.forEach (function (v) { a.push (v); }); return a;\n"
+  "    },\n"
+  "    newMap: function () { return new Map (); },\n"
+  "    newSet: function () { return new Set (); },\n"
+  "    fillMap: function (m, a) {\n"
+  "      for (var i = 0; i < a.length; i += 2) m.set (a[i], a[i + 1]);\n"
+  "    },\n"
+  "    fillSet: function (s, a) {\n"
+  "      for (var i = 0; i < a.length; i++) s.add (a[i]);\n"
+  "    }\n"
+  "  };\n"
+  "}) ()";
+
+typedef struct
+{
+  JSCoreContext *context;
+  JSContextRef ctx;
+  JSObjectRef helpers;
+  JSObjectRef tag;
+  GByteArray *out;
+  GHashTable *memo;
+  guint next_id;
+  GPtrArray *transfer;
+  guint depth;
+  GError **error;
+} Writer;
+
+typedef struct
+{
+  JSCoreContext *context;
+  JSContextRef ctx;
+  JSObjectRef helpers;
+  GBytes *bytes;
+  const guint8 *pos;
+  const guint8 *end;
+  GPtrArray *objects;
+  GPtrArray *transfer;
+  JSCoreCloneFlags flags;
+  GString *scratch;
+  guint depth;
+  GError **error;
+} Reader;
+
+static JSObjectRef
+get_helpers (JSCoreContext *context, GError **error)
+{
+  JSCoreContextPrivate *priv = context->priv;
+  JSValueRef exception = NULL;
+  JSStringRef script;
+  JSValueRef helpers;
+
+  if (priv->clone_helpers)
+    return priv->clone_helpers;
+
+  script = JSStringCreateWithUTF8CString (helpers_source);
+  helpers = JSEvaluateScript (priv->real, script, NULL, NULL, 1, &exception);
+  JSStringRelease (script);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return NULL;
+    }
+
+  jscore_value_protect (priv->real, helpers);
+  priv->clone_helpers = (JSObjectRef) helpers;
+
+  return priv->clone_helpers;
+}
+
+static JSObjectRef
+get_helper (JSContextRef ctx, JSObjectRef helpers, const gchar *name)
+{
+  JSStringRef jname = JSStringCreateWithUTF8CString (name);
+  JSValueRef function = JSObjectGetProperty (ctx, helpers, jname, NULL);
+
+  JSStringRelease (jname);
+
+  return (JSObjectRef) function;
+}
+
+static JSValueRef
+call_helper (JSContextRef ctx,
+             JSObjectRef helpers,
+             const gchar *name,
+             size_t argument_count,
+             const JSValueRef arguments[],
+             JSValueRef *exception)
+{
+  return JSObjectCallAsFunction (ctx, get_helper (ctx, helpers, name), NULL,
+                                 argument_count, arguments, exception);
+}
+
+static guint
+get_length (JSContextRef ctx, JSObjectRef object, JSValueRef *exception)
+{
+  JSStringRef name = JSStringCreateWithUTF8CString ("length");
+  JSValueRef length = JSObjectGetProperty (ctx, object, name, exception);
+
+  JSStringRelease (name);
+
+  return (guint) JSValueToNumber (ctx, length, NULL);
+}
+
+/* Writer */
+
+static gboolean
+writer_exception (Writer *w, JSValueRef exception)
+{
+  set_error_from_js_exception (w->error, exception, w->context);
+  return FALSE;
+}
+
+static void
+write_byte (Writer *w, guint8 byte)
+{
+  g_byte_array_append (w->out, &byte, 1);
+}
+
+static void
+write_varint (Writer *w, guint64 value)
+{
+  guint8 buffer[10];
+  guint n = 0;
+
+  do
+    {
+      buffer[n] = value & 0x7f;
+      value >>= 7;
+      if (value)
+        buffer[n] |= 0x80;
+      n++;
+    }
+  while (value);
+
+  g_byte_array_append (w->out, buffer, n);
+}
+
+static void
+write_double (Writer *w, gdouble value)
+{
+  g_byte_array_append (w->out, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+write_number (Writer *w, gdouble number)
+{
+  gint32 i;
+
+  if (number >= G_MININT32 && number <= G_MAXINT32)
+    {
+      i = (gint32) number;
+      if ((gdouble) i == number && !(i == 0 && signbit (number)))
+        {
+          write_byte (w, TAG_INT);
+          /* zigzag so small negative numbers stay small */
+          write_varint (w, (guint32) ((i << 1) ^ (i >> 31)));
+          return;
+        }
+    }
+
+  write_byte (w, TAG_DOUBLE);
+  write_double (w, number);
+}
+
+/* UTF-16 code units as they are, UTF-8 would lose lone surrogates */
+static void
+write_string_ref (Writer *w, JSStringRef string)
+{
+  size_t length = JSStringGetLength (string);
+
+  write_varint (w, length);
+  g_byte_array_append (w->out, (const guint8 *) JSStringGetCharactersPtr (string),
+                       length * sizeof (JSChar));
+}
+
+static gboolean
+write_js_string (Writer *w, JSValueRef value)
+{
+  JSValueRef exception = NULL;
+  JSStringRef string = JSValueToStringCopy (w->ctx, value, &exception);
+
+  if (exception)
+    return writer_exception (w, exception);
+
+  write_string_ref (w, string);
+  JSStringRelease (string);
+
+  return TRUE;
+}
+
+static gboolean write_value (Writer *w, JSValueRef value);
+static gboolean write_object (Writer *w, JSObjectRef object);
+
+static gboolean
+write_elements (Writer *w, JSObjectRef array, guint length)
+{
+  JSValueRef exception = NULL;
+  JSValueRef value;
+  guint i;
+
+  for (i = 0; i < length; i++)
+    {
+      value = JSObjectGetPropertyAtIndex (w->ctx, array, i, &exception);
+      if (exception)
+        return writer_exception (w, exception);
+
+      if (!write_value (w, value))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+write_sparse_array (Writer *w, JSObjectRef array, guint length,
+                    JSObjectRef indices, guint count)
+{
+  JSValueRef exception = NULL;
+  JSValueRef value;
+  guint i, index;
+
+  write_byte (w, TAG_SPARSE_ARRAY);
+  write_varint (w, length);
+  write_varint (w, count);
+
+  for (i = 0; i < count; i++)
+    {
+      index = (guint) JSValueToNumber (w->ctx,
+                                       JSObjectGetPropertyAtIndex (w->ctx, indices,
+                                                                   i, NULL),
+                                       NULL);
+      value = JSObjectGetPropertyAtIndex (w->ctx, array, index, &exception);
+      if (exception)
+        return writer_exception (w, exception);
+
+      write_varint (w, index);
+      if (!write_value (w, value))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+write_array (Writer *w, JSObjectRef array)
+{
+  JSValueRef exception = NULL;
+  JSValueRef indices;
+  guint length = get_length (w->ctx, array, &exception);
+  guint count;
+
+  if (exception)
+    return writer_exception (w, exception);
+
+  /* Holes would otherwise cost a value each, up to 2^32 - 1 of them */
+  if (length >= SPARSE_ARRAY_MIN_LENGTH)
+    {
+      indices = call_helper (w->ctx, w->helpers, "arrayIndices", 1,
+                             (JSValueRef *) &array, &exception);
+      if (exception)
+        return writer_exception (w, exception);
+
+      count = get_length (w->ctx, (JSObjectRef) indices, NULL);
+      if (count < length / 2)
+        return write_sparse_array (w, array, length,
+                                   (JSObjectRef) indices, count);
+    }
+
+  write_byte (w, TAG_ARRAY);
+  write_varint (w, length);
+
+  return write_elements (w, array, length);
+}
+
+static gboolean
+write_collection (Writer *w, JSObjectRef collection, guint8 tag,
+                  const gchar *helper, guint arity)
+{
+  JSValueRef exception = NULL;
+  JSValueRef flattened;
+  guint length;
+
+  flattened = call_helper (w->ctx, w->helpers, helper, 1,
+                           (JSValueRef *) &collection, &exception);
+  if (exception)
+    return writer_exception (w, exception);
+
+  length = get_length (w->ctx, (JSObjectRef) flattened, NULL);
+
+  write_byte (w, tag);
+  write_varint (w, length / arity);
+
+  return write_elements (w, (JSObjectRef) flattened, length);
+}
+
+static gboolean
+write_regexp (Writer *w, JSObjectRef regexp)
+{
+  JSValueRef exception = NULL;
+  JSStringRef name = JSStringCreateWithUTF8CString ("source");
+  JSValueRef source = JSObjectGetProperty (w->ctx, regexp, name, &exception);
+  JSValueRef flags;
+
+  JSStringRelease (name);
+  if (exception)
+    return writer_exception (w, exception);
+
+  flags = call_helper (w->ctx, w->helpers, "regExpFlags", 1,
+                       (JSValueRef *) &regexp, &exception);
+  if (exception)
+    return writer_exception (w, exception);
+
+  write_byte (w, TAG_REGEXP);
+
+  return write_js_string (w, source) && write_js_string (w, flags);
+}
+
+static gboolean
+write_plain_object (Writer *w, JSObjectRef object)
+{
+  JSValueRef exception = NULL;
+  JSPropertyNameArrayRef names = JSObjectCopyPropertyNames (w->ctx, object);
+  size_t count = JSPropertyNameArrayGetCount (names);
+  gboolean ret = TRUE;
+  JSStringRef name;
+  JSValueRef value;
+  size_t i;
+
+  write_byte (w, TAG_OBJECT);
+  write_varint (w, count);
+
+  for (i = 0; i < count && ret; i++)
+    {
+      name = JSPropertyNameArrayGetNameAtIndex (names, i);
+      value = JSObjectGetProperty (w->ctx, object, name, &exception);
+      if (exception)
+        {
+          ret = writer_exception (w, exception);
+          break;
+        }
+
+      write_string_ref (w, name);
+      ret = write_value (w, value);
+    }
+
+  JSPropertyNameArrayRelease (names);
+
+  return ret;
+}
+
+#ifdef HAVE_JSC_TYPED_ARRAYS
+
+static gboolean
+write_array_buffer (Writer *w, JSObjectRef buffer)
+{
+  JSValueRef exception = NULL;
+  const guint8 *data = JSObjectGetArrayBufferBytesPtr (w->ctx, buffer, &exception);
+  gsize length = JSObjectGetArrayBufferByteLength (w->ctx, buffer, &exception);
+  GBytes *bytes;
+  guint8 padding;
+
+  if (exception)
+    return writer_exception (w, exception);
+
+  bytes = w->transfer ? jscore_value_lookup_bytes (data, length) : NULL;
+  if (bytes)
+    {
+      write_byte (w, TAG_SHARED_BUFFER);
+      write_varint (w, w->transfer->len);
+      g_ptr_array_add (w->transfer, bytes);
+      return TRUE;
+    }
+
+  write_byte (w, TAG_ARRAY_BUFFER);
+  write_varint (w, length);
+
+  /* Aligned contents let the reader borrow them in place */
+  padding = (BUFFER_ALIGNMENT - (w->out->len + 1) % BUFFER_ALIGNMENT) % BUFFER_ALIGNMENT;
+  write_byte (w, padding);
+  while (padding--)
+    write_byte (w, 0);
+
+  g_byte_array_append (w->out, data, length);
+
+  return TRUE;
+}
+
+static gboolean
+write_typed_array (Writer *w, JSObjectRef array, JSTypedArrayType type)
+{
+  JSValueRef exception = NULL;
+  JSObjectRef buffer = JSObjectGetTypedArrayBuffer (w->ctx, array, &exception);
+  gsize offset = JSObjectGetTypedArrayByteOffset (w->ctx, array, &exception);
+  gsize length = JSObjectGetTypedArrayLength (w->ctx, array, &exception);
+
+  if (exception)
+    return writer_exception (w, exception);
+
+  write_byte (w, TAG_TYPED_ARRAY);
+  write_byte (w, type);
+  if (!write_object (w, buffer))
+    return FALSE;
+  write_varint (w, offset);
+  write_varint (w, length);
+
+  return TRUE;
+}
+
+#endif
+
+static gboolean
+write_object_contents (Writer *w, JSObjectRef object)
+{
+  JSValueRef exception = NULL;
+  JSStringRef tag;
+  JSValueRef value;
+  gboolean ret;
+
+#ifdef HAVE_JSC_TYPED_ARRAYS
+  JSTypedArrayType type = JSValueGetTypedArrayType (w->ctx, object, NULL);
+
+  if (type == kJSTypedArrayTypeArrayBuffer)
+    return write_array_buffer (w, object);
+  if (type < kJSTypedArrayTypeArrayBuffer)
+    return write_typed_array (w, object, type);
+#endif
+
+  if (JSObjectIsFunction (w->ctx, object))
+    {
+      g_set_error_literal (w->error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Functions cannot be cloned");
+      return FALSE;
+    }
+
+  value = JSObjectCallAsFunction (w->ctx, w->tag, NULL, 1,
+                                  (JSValueRef *) &object, &exception);
+  if (exception)
+    return writer_exception (w, exception);
+
+  tag = JSValueToStringCopy (w->ctx, value, NULL);
+
+  if (JSStringIsEqualToUTF8CString (tag, "[object Array]"))
+    ret = write_array (w, object);
+  else if (JSStringIsEqualToUTF8CString (tag, "[object Date]"))
+    {
+      write_byte (w, TAG_DATE);
+      write_double (w, JSValueToNumber (w->ctx, object, NULL));
+      ret = TRUE;
+    }
+  else if (JSStringIsEqualToUTF8CString (tag, "[object RegExp]"))
+    ret = write_regexp (w, object);
+  else if (JSStringIsEqualToUTF8CString (tag, "[object Map]"))
+    ret = write_collection (w, object, TAG_MAP, "mapEntries", 2);
+  else if (JSStringIsEqualToUTF8CString (tag, "[object Set]"))
+    ret = write_collection (w, object, TAG_SET, "setValues", 1);
+  else
+    ret = write_plain_object (w, object);
+
+  JSStringRelease (tag);
+
+  return ret;
+}
+
+static gboolean
+write_object (Writer *w, JSObjectRef object)
+{
+  gpointer id;
+  gboolean ret;
+
+  if (g_hash_table_lookup_extended (w->memo, object, NULL, &id))
+    {
+      write_byte (w, TAG_BACKREF);
+      write_varint (w, GPOINTER_TO_UINT (id));
+      return TRUE;
+    }
+
+  if (w->depth >= MAX_DEPTH)
+    {
+      g_set_error_literal (w->error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Value is nested too deeply to be cloned");
+      return FALSE;
+    }
+
+  g_hash_table_insert (w->memo, object, GUINT_TO_POINTER (w->next_id++));
+
+  w->depth++;
+  ret = write_object_contents (w, object);
+  w->depth--;
+
+  return ret;
+}
+
+static gboolean
+write_value (Writer *w, JSValueRef value)
+{
+  switch (JSValueGetType (w->ctx, value))
+    {
+    case kJSTypeUndefined:
+      write_byte (w, TAG_UNDEFINED);
+      return TRUE;
+    case kJSTypeNull:
+      write_byte (w, TAG_NULL);
+      return TRUE;
+    case kJSTypeBoolean:
+      write_byte (w, JSValueToBoolean (w->ctx, value) ? TAG_TRUE : TAG_FALSE);
+      return TRUE;
+    case kJSTypeNumber:
+      write_number (w, JSValueToNumber (w->ctx, value, NULL));
+      return TRUE;
+    case kJSTypeString:
+      write_byte (w, TAG_STRING);
+      return write_js_string (w, value);
+    case kJSTypeObject:
+      return write_object (w, (JSObjectRef) value);
+    default:
+      g_set_error_literal (w->error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Value cannot be cloned");
+      return FALSE;
+    }
+}
+
+gboolean
+jscore_value_serialize_to_byte_array (JSCoreContext *context,
+                                      JSCoreValue *value,
+                                      GByteArray *array,
+                                      GPtrArray *transfer,
+                                      GError **error)
+{
+  static const guint8 header[HEADER_SIZE] = {
+    'J', 'S', 'C', 'S', FORMAT_VERSION, BYTE_ORDER_MARK, 0, 0
+  };
+  guint start = array->len;
+  guint transfer_start = transfer ? transfer->len : 0;
+  guint i;
+  Writer w;
+  gboolean ret;
+
+  w.context = context;
+  w.ctx = context->priv->real;
+  w.helpers = get_helpers (context, error);
+  if (w.helpers == NULL)
+    return FALSE;
+
+  w.tag = get_helper (w.ctx, w.helpers, "tag");
+  w.out = array;
+  w.memo = g_hash_table_new (g_direct_hash, g_direct_equal);
+  w.next_id = 0;
+  w.transfer = transfer;
+  w.depth = 0;
+  w.error = error;
+
+  g_byte_array_append (array, header, HEADER_SIZE);
+  ret = write_value (&w, (JSValueRef) value);
+
+  g_hash_table_destroy (w.memo);
+
+  if (!ret)
+    {
+      g_byte_array_set_size (array, start);
+      /* The entries hold a reference of their own, shrinking len
+       * directly keeps any free func of the caller from running too */
+      if (transfer)
+        {
+          for (i = transfer_start; i < transfer->len; i++)
+            g_bytes_unref (transfer->pdata[i]);
+          transfer->len = transfer_start;
+        }
+    }
+
+  return ret;
+}
+
+GBytes *
+jscore_value_serialize (JSCoreContext *context,
+                        JSCoreValue *value,
+                        GPtrArray *transfer,
+                        GError **error)
+{
+  GByteArray *array = g_byte_array_new ();
+
+  if (!jscore_value_serialize_to_byte_array (context, value, array,
+                                             transfer, error))
+    {
+      g_byte_array_unref (array);
+      return NULL;
+    }
+
+  return g_byte_array_free_to_bytes (array);
+}
+
+/* Reader */
+
+static gboolean
+reader_corrupt (Reader *r)
+{
+  g_set_error_literal (r->error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                       "Malformed serialized value");
+  return FALSE;
+}
+
+static gboolean
+reader_exception (Reader *r, JSValueRef exception)
+{
+  set_error_from_js_exception (r->error, exception, r->context);
+  return FALSE;
+}
+
+static gboolean
+read_byte (Reader *r, guint8 *byte)
+{
+  if (r->pos >= r->end)
+    return reader_corrupt (r);
+
+  *byte = *r->pos++;
+  return TRUE;
+}
+
+static gboolean
+read_varint (Reader *r, guint64 *value)
+{
+  guint shift = 0;
+  guint8 byte;
+
+  *value = 0;
+  do
+    {
+      if (shift > 63 || !read_byte (r, &byte))
+        return reader_corrupt (r);
+
+      *value |= (guint64) (byte & 0x7f) << shift;
+      shift += 7;
+    }
+  while (byte & 0x80);
+
+  return TRUE;
+}
+
+/* Bounds a count read from the input by what is left of it, each element
+ * taking at least one byte. */
+static gboolean
+read_count (Reader *r, guint64 *count, guint per_element)
+{
+  if (!read_varint (r, count))
+    return FALSE;
+
+  if (*count > (guint64) (r->end - r->pos) / per_element)
+    return reader_corrupt (r);
+
+  return TRUE;
+}
+
+static gboolean
+read_double (Reader *r, gdouble *value)
+{
+  if (r->end - r->pos < (gssize) sizeof (gdouble))
+    return reader_corrupt (r);
+
+  memcpy (value, r->pos, sizeof (gdouble));
+  r->pos += sizeof (gdouble);
+
+  return TRUE;
+}
+
+static JSStringRef
+read_string (Reader *r)
+{
+  guint64 length;
+
+  if (!read_count (r, &length, sizeof (JSChar)))
+    return NULL;
+
+  /* Copied out as the input is not aligned for JSChar */
+  g_string_truncate (r->scratch, 0);
+  g_string_append_len (r->scratch, (const gchar *) r->pos,
+                       length * sizeof (JSChar));
+  r->pos += length * sizeof (JSChar);
+
+  return JSStringCreateWithCharacters ((const JSChar *) r->scratch->str,
+                                       length);
+}
+
+static void
+reader_register (Reader *r, JSObjectRef object)
+{
+  jscore_value_protect (r->ctx, object);
+  g_ptr_array_add (r->objects, object);
+}
+
+static gboolean read_value (Reader *r, JSValueRef *value);
+
+static gboolean
+read_elements (Reader *r, JSObjectRef array, guint64 count)
+{
+  JSValueRef exception = NULL;
+  JSValueRef value;
+  guint64 i;
+
+  for (i = 0; i < count; i++)
+    {
+      if (!read_value (r, &value))
+        return FALSE;
+
+      JSObjectSetPropertyAtIndex (r->ctx, array, i, value, &exception);
+      if (exception)
+        return reader_exception (r, exception);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_object (Reader *r, JSValueRef *value)
+{
+  JSValueRef exception = NULL;
+  JSObjectRef object = JSObjectMake (r->ctx, NULL, NULL);
+  JSStringRef name;
+  JSValueRef property;
+  guint64 count, i;
+
+  reader_register (r, object);
+  *value = object;
+
+  if (!read_count (r, &count, 2))
+    return FALSE;
+
+  for (i = 0; i < count; i++)
+    {
+      name = read_string (r);
+      if (name == NULL)
+        return FALSE;
+
+      if (!read_value (r, &property))
+        {
+          JSStringRelease (name);
+          return FALSE;
+        }
+
+      JSObjectSetProperty (r->ctx, object, name, property,
+                           kJSPropertyAttributeNone, &exception);
+      JSStringRelease (name);
+
+      if (exception)
+        return reader_exception (r, exception);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_array (Reader *r, JSValueRef *value)
+{
+  JSValueRef exception = NULL;
+  JSObjectRef array = JSObjectMakeArray (r->ctx, 0, NULL, &exception);
+  guint64 count;
+
+  if (exception)
+    return reader_exception (r, exception);
+
+  reader_register (r, array);
+  *value = array;
+
+  return read_count (r, &count, 1) && read_elements (r, array, count);
+}
+
+static gboolean
+read_sparse_array (Reader *r, JSValueRef *value)
+{
+  JSValueRef exception = NULL;
+  JSObjectRef array = JSObjectMakeArray (r->ctx, 0, NULL, &exception);
+  JSStringRef name;
+  JSValueRef element;
+  guint64 length, count, index, i;
+
+  if (exception)
+    return reader_exception (r, exception);
+
+  reader_register (r, array);
+  *value = array;
+
+  if (!read_varint (r, &length) || length > G_MAXUINT32)
+    return reader_corrupt (r);
+
+  if (!read_count (r, &count, 2))
+    return FALSE;
+
+  for (i = 0; i < count; i++)
+    {
+      if (!read_varint (r, &index) || index >= length)
+        return reader_corrupt (r);
+
+      if (!read_value (r, &element))
+        return FALSE;
+
+      JSObjectSetPropertyAtIndex (r->ctx, array, index, element, &exception);
+      if (exception)
+        return reader_exception (r, exception);
+    }
+
+  /* Trailing holes */
+  name = JSStringCreateWithUTF8CString ("length");
+  JSObjectSetProperty (r->ctx, array, name,
+                       JSValueMakeNumber (r->ctx, length),
+                       kJSPropertyAttributeNone, &exception);
+  JSStringRelease (name);
+  if (exception)
+    return reader_exception (r, exception);
+
+  return TRUE;
+}
+
+static gboolean
+read_collection (Reader *r, JSValueRef *value,
+                 const gchar *constructor, const gchar *filler, guint arity)
+{
+  JSValueRef exception = NULL;
+  JSValueRef arguments[2];
+  JSObjectRef flattened;
+  guint64 count;
+
+  *value = call_helper (r->ctx, r->helpers, constructor, 0, NULL, &exception);
+  if (exception)
+    return reader_exception (r, exception);
+
+  reader_register (r, (JSObjectRef) *value);
+
+  if (!read_count (r, &count, arity))
+    return FALSE;
+
+  flattened = JSObjectMakeArray (r->ctx, 0, NULL, NULL);
+  if (!read_elements (r, flattened, count * arity))
+    return FALSE;
+
+  arguments[0] = *value;
+  arguments[1] = flattened;
+  call_helper (r->ctx, r->helpers, filler, 2, arguments, &exception);
+  if (exception)
+    return reader_exception (r, exception);
+
+  return TRUE;
+}
+
+static gboolean
+read_regexp (Reader *r, JSValueRef *value)
+{
+  JSValueRef exception = NULL;
+  JSValueRef arguments[2];
+  JSStringRef source, flags;
+  JSObjectRef regexp;
+
+  source = read_string (r);
+  if (source == NULL)
+    return FALSE;
+
+  flags = read_string (r);
+  if (flags == NULL)
+    {
+      JSStringRelease (source);
+      return FALSE;
+    }
+
+  arguments[0] = JSValueMakeString (r->ctx, source);
+  arguments[1] = JSValueMakeString (r->ctx, flags);
+  JSStringRelease (source);
+  JSStringRelease (flags);
+
+  regexp = JSObjectMakeRegExp (r->ctx, 2, arguments, &exception);
+  if (exception)
+    return reader_exception (r, exception);
+
+  reader_register (r, regexp);
+  *value = regexp;
+
+  return TRUE;
+}
+
+static gboolean
+read_date (Reader *r, JSValueRef *value)
+{
+  JSValueRef exception = NULL;
+  JSValueRef time;
+  JSObjectRef date;
+  gdouble number;
+
+  if (!read_double (r, &number))
+    return FALSE;
+
+  time = JSValueMakeNumber (r->ctx, number);
+  date = JSObjectMakeDate (r->ctx, 1, &time, &exception);
+  if (exception)
+    return reader_exception (r, exception);
+
+  reader_register (r, date);
+  *value = date;
+
+  return TRUE;
+}
+
+#ifdef HAVE_JSC_TYPED_ARRAYS
+
+static gboolean
+read_array_buffer (Reader *r, JSValueRef *value)
+{
+  JSCoreValue *buffer;
+  guint64 length;
+  guint8 padding;
+  gpointer copy;
+
+  if (!read_varint (r, &length) || !read_byte (r, &padding))
+    return FALSE;
+
+  if (padding >= BUFFER_ALIGNMENT || padding > r->end - r->pos
+      || length > (guint64) (r->end - r->pos - padding))
+    return reader_corrupt (r);
+
+  r->pos += padding;
+
+  if ((r->flags & JS_CORE_CLONE_BORROW_BUFFERS)
+      && GPOINTER_TO_SIZE (r->pos) % BUFFER_ALIGNMENT == 0)
+    buffer = jscore_value_new_array_buffer (r->context, (gpointer) r->pos, length,
+                                            (GDestroyNotify) g_bytes_unref,
+                                            g_bytes_ref (r->bytes),
+                                            r->error);
+  else
+    {
+      copy = g_malloc (MAX (length, 1));
+      memcpy (copy, r->pos, length);
+      buffer = jscore_value_new_array_buffer (r->context, copy, length,
+                                              g_free, copy, r->error);
+    }
+
+  r->pos += length;
+
+  if (buffer == NULL)
+    return FALSE;
+
+  reader_register (r, (JSObjectRef) buffer);
+  *value = (JSValueRef) buffer;
+
+  return TRUE;
+}
+
+static gboolean
+read_shared_buffer (Reader *r, JSValueRef *value)
+{
+  JSCoreValue *buffer;
+  guint64 index;
+
+  if (!read_varint (r, &index))
+    return FALSE;
+
+  if (r->transfer == NULL || index >= r->transfer->len)
+    return reader_corrupt (r);
+
+  buffer = jscore_value_new_typed_array_sharing_bytes (r->context,
+                                                       JS_CORE_TYPED_ARRAY_ARRAY_BUFFER,
+                                                       g_ptr_array_index (r->transfer, index),
+                                                       r->error);
+  if (buffer == NULL)
+    return FALSE;
+
+  reader_register (r, (JSObjectRef) buffer);
+  *value = (JSValueRef) buffer;
+
+  return TRUE;
+}
+
+static gboolean
+read_typed_array (Reader *r, JSValueRef *value)
+{
+  JSValueRef exception = NULL;
+  JSValueRef buffer;
+  JSObjectRef array;
+  guint64 offset, length;
+  guint slot = r->objects->len;
+  guint8 type;
+
+  /* The view was numbered before its buffer */
+  g_ptr_array_add (r->objects, NULL);
+
+  if (!read_byte (r, &type) || !read_value (r, &buffer)
+      || !read_varint (r, &offset) || !read_varint (r, &length))
+    return FALSE;
+
+  if (type >= kJSTypedArrayTypeArrayBuffer
+      || JSValueGetTypedArrayType (r->ctx, buffer, NULL) != kJSTypedArrayTypeArrayBuffer)
+    return reader_corrupt (r);
+
+  array = JSObjectMakeTypedArrayWithArrayBufferAndOffset (r->ctx, type,
+                                                          (JSObjectRef) buffer,
+                                                          offset, length,
+                                                          &exception);
+  if (exception)
+    return reader_exception (r, exception);
+
+  jscore_value_protect (r->ctx, array);
+  r->objects->pdata[slot] = array;
+  *value = array;
+
+  return TRUE;
+}
+
+#endif
+
+static gboolean
+read_value (Reader *r, JSValueRef *value)
+{
+  JSStringRef string;
+  guint64 integer;
+  gdouble number;
+  guint8 tag;
+  gboolean ret;
+
+  if (!read_byte (r, &tag))
+    return FALSE;
+
+  switch (tag)
+    {
+    case TAG_UNDEFINED:
+      *value = JSValueMakeUndefined (r->ctx);
+      return TRUE;
+    case TAG_NULL:
+      *value = JSValueMakeNull (r->ctx);
+      return TRUE;
+    case TAG_TRUE:
+    case TAG_FALSE:
+      *value = JSValueMakeBoolean (r->ctx, tag == TAG_TRUE);
+      return TRUE;
+    case TAG_INT:
+      if (!read_varint (r, &integer) || integer > G_MAXUINT32)
+        return reader_corrupt (r);
+      *value = JSValueMakeNumber (r->ctx,
+                                  (gint32) (integer >> 1) ^ -(gint32) (integer & 1));
+      return TRUE;
+    case TAG_DOUBLE:
+      if (!read_double (r, &number))
+        return FALSE;
+      *value = JSValueMakeNumber (r->ctx, number);
+      return TRUE;
+    case TAG_STRING:
+      string = read_string (r);
+      if (string == NULL)
+        return FALSE;
+      *value = JSValueMakeString (r->ctx, string);
+      JSStringRelease (string);
+      return TRUE;
+    case TAG_BACKREF:
+      if (!read_varint (r, &integer) || integer >= r->objects->len
+          || r->objects->pdata[integer] == NULL)
+        return reader_corrupt (r);
+      *value = r->objects->pdata[integer];
+      return TRUE;
+    }
+
+  if (r->depth >= MAX_DEPTH)
+    return reader_corrupt (r);
+
+  r->depth++;
+
+  switch (tag)
+    {
+    case TAG_OBJECT:
+      ret = read_object (r, value);
+      break;
+    case TAG_ARRAY:
+      ret = read_array (r, value);
+      break;
+    case TAG_SPARSE_ARRAY:
+      ret = read_sparse_array (r, value);
+      break;
+    case TAG_DATE:
+      ret = read_date (r, value);
+      break;
+    case TAG_REGEXP:
+      ret = read_regexp (r, value);
+      break;
+    case TAG_MAP:
+      ret = read_collection (r, value, "newMap", "fillMap", 2);
+      break;
+    case TAG_SET:
+      ret = read_collection (r, value, "newSet", "fillSet", 1);
+      break;
+#ifdef HAVE_JSC_TYPED_ARRAYS
+    case TAG_ARRAY_BUFFER:
+      ret = read_array_buffer (r, value);
+      break;
+    case TAG_SHARED_BUFFER:
+      ret = read_shared_buffer (r, value);
+      break;
+    case TAG_TYPED_ARRAY:
+      ret = read_typed_array (r, value);
+      break;
+#else
+    case TAG_ARRAY_BUFFER:
+    case TAG_SHARED_BUFFER:
+    case TAG_TYPED_ARRAY:
+      g_set_error_literal (r->error, JS_CORE_ERROR, JS_CORE_ERROR_NOT_SUPPORTED,
+                           "JavaScriptCore was built without typed array support");
+      ret = FALSE;
+      break;
+#endif
+    default:
+      ret = reader_corrupt (r);
+      break;
+    }
+
+  r->depth--;
+
+  return ret;
+}
+
+JSCoreValue *
+jscore_value_deserialize (JSCoreContext *context,
+                          GBytes *bytes,
+                          GPtrArray *transfer,
+                          JSCoreCloneFlags flags,
+                          GError **error)
+{
+  JSValueRef value = NULL;
+  gsize size;
+  const guint8 *data = g_bytes_get_data (bytes, &size);
+  Reader r;
+  guint i;
+
+  if (size < HEADER_SIZE || memcmp (data, MAGIC, 4) != 0
+      || data[4] != FORMAT_VERSION || data[5] != BYTE_ORDER_MARK)
+    {
+      g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Not a serialized value of a supported version");
+      return NULL;
+    }
+
+  r.context = context;
+  r.ctx = context->priv->real;
+  r.helpers = get_helpers (context, error);
+  if (r.helpers == NULL)
+    return NULL;
+
+  r.bytes = bytes;
+  r.pos = data + HEADER_SIZE;
+  r.end = data + size;
+  r.objects = g_ptr_array_new ();
+  r.transfer = transfer;
+  r.flags = flags;
+  r.scratch = g_string_new (NULL);
+  r.depth = 0;
+  r.error = error;
+
+  if (!read_value (&r, &value))
+    value = NULL;
+
+  for (i = 0; i < r.objects->len; i++)
+    if (r.objects->pdata[i])
+      jscore_value_unprotect (r.ctx, r.objects->pdata[i]);
+
+  g_ptr_array_free (r.objects, TRUE);
+  g_string_free (r.scratch, TRUE);
+
+  return (JSCoreValue *) value;
+}
@@ -0,0 +1,46 @@
+/*
+ * jscore-serialize.h - Header for the structured clone serializer
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_SERIALIZE_H__
+#define __JSCORE_SERIALIZE_H__
+
+#include "jscore-value.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+  JS_CORE_CLONE_NONE = 0,
+  /* Deserialized ArrayBuffers point into the serialized GBytes instead of
+   * copying it. Scripts writing into them write into the message. */
+  JS_CORE_CLONE_BORROW_BUFFERS = 1 << 0
+} JSCoreCloneFlags;
+
+/* When transfer is not NULL, ArrayBuffers created from a GBytes are not
+ * copied into the output, their GBytes is appended to transfer instead and
+ * the same array has to be handed to jscore_value_deserialize(). The
+ * memory is shared, not moved: the source buffer is not detached and stays
+ * usable, and writes on either side show on the other. */
+GBytes *jscore_value_serialize (JSCoreContext *context, JSCoreValue *value, GPtrArray *transfer, GError **error);
+gboolean jscore_value_serialize_to_byte_array (JSCoreContext *context, JSCoreValue *value, GByteArray *array, GPtrArray *transfer, GError **error);
+JSCoreValue *jscore_value_deserialize (JSCoreContext *context, GBytes *bytes, GPtrArray *transfer, JSCoreCloneFlags flags, GError **error);
+
+G_END_DECLS
+
+#endif /* __JSCORE_SERIALIZE_H__ */
@@ -0,0 +1,677 @@
+/*
+ * jscore-timers.c - Source for the setTimeout family of host functions
+ *
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "jscore-timers.h"
+#include "jscore-context-private.h"
+#include "jscore-value-private.h"
+#include "jscore-probes.h"
+#include "jscore-profiler-private.h"
+
+#include <math.h>
+#include <string.h>
+#include <JavaScriptCore/JavaScript.h>
+
+/*
+ * Hierarchical timer wheel: four levels of 64 slots, level n covering
+ * 64^(n+1) ticks. Timers are hashed by deadline into the finest level
+ * that can hold them and move down a level each time the one below
+ * wraps, so adding, removing and firing are O(1). A bitmap of non-empty
+ * slots per level gives the next deadline without walking the slots, and
+ * a single source per context is armed for it.
+ */
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_RANGE (G_GUINT64_CONSTANT (1) << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define LEVEL_FIRING -1
+#define LEVEL_NONE -2
+
+enum {
+  SET_TIMEOUT,
+  SET_INTERVAL,
+  CLEAR_TIMEOUT,
+  CLEAR_INTERVAL,
+  N_FUNCTIONS
+};
+
+static const gchar *function_names[N_FUNCTIONS] = {
+  "setTimeout",
+  "setInterval",
+  "clearTimeout",
+  "clearInterval"
+};
+
+typedef struct _Timer Timer;
+typedef struct _TimerWheel TimerWheel;
+
+struct _Timer
+{
+  Timer *prev;
+  Timer *next;
+  gint level;
+  guint slot;
+
+  guint id;
+  guint64 expires;
+  /* 0 for one-shot timers */
+  gint64 interval_us;
+
+  JSGlobalContextRef ctx;
+  JSObjectRef callback;
+  JSValueRef *arguments;
+  gsize n_arguments;
+};
+
+typedef struct
+{
+  TimerWheel *wheel;
+  guint kind;
+  JSObjectRef object;
+} HostFunction;
+
+struct _TimerWheel
+{
+  JSCoreContext *context;
+  GSource *source;
+
+  gint64 origin;
+  gint64 tick_us;
+  guint min_delay_ms;
+
+  /* Next tick to process */
+  guint64 now;
+  Timer *slots[WHEEL_LEVELS][WHEEL_SIZE];
+  guint64 occupied[WHEEL_LEVELS];
+  /* Timers of the tick being processed */
+  Timer *firing;
+
+  GHashTable *timers;
+  guint next_id;
+
+  HostFunction functions[N_FUNCTIONS];
+  JSCoreTimerStats stats;
+};
+
+static inline guint
+lowest_bit (guint64 bits)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll (bits);
+#else
+  guint n = 0;
+
+  while (!(bits & 1))
+    {
+      bits >>= 1;
+      n++;
+    }
+
+  return n;
+#endif
+}
+
+/* Distance from position to the first set bit, wrapping around */
+static inline guint
+first_set_from (guint64 bits,
+                guint position)
+{
+  if (position)
+    bits = (bits >> position) | (bits << (WHEEL_SIZE - position));
+
+  return lowest_bit (bits);
+}
+
+static Timer **
+timer_head (TimerWheel *wheel,
+            Timer *timer)
+{
+  if (timer->level == LEVEL_FIRING)
+    return &wheel->firing;
+
+  return &wheel->slots[timer->level][timer->slot];
+}
+
+static void
+timer_unlink (TimerWheel *wheel,
+              Timer *timer)
+{
+  if (timer->level == LEVEL_NONE)
+    return;
+
+  if (timer->prev)
+    timer->prev->next = timer->next;
+  else
+    *timer_head (wheel, timer) = timer->next;
+  if (timer->next)
+    timer->next->prev = timer->prev;
+
+  if (timer->level >= 0 && wheel->slots[timer->level][timer->slot] == NULL)
+    wheel->occupied[timer->level] &= ~(G_GUINT64_CONSTANT (1) << timer->slot);
+
+  timer->prev = timer->next = NULL;
+  timer->level = LEVEL_NONE;
+}
+
+static void
+timer_insert (TimerWheel *wheel,
+              Timer *timer)
+{
+  guint64 expires = timer->expires;
+  Timer **head;
+  gint level;
+
+  if (expires < wheel->now)
+    expires = wheel->now;
+  else if (expires - wheel->now >= WHEEL_RANGE)
+    /* Parked in the last slot, it is placed again when it cascades */
+    expires = wheel->now + WHEEL_RANGE - 1;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (expires - wheel->now < G_GUINT64_CONSTANT (1) << (WHEEL_BITS * (level + 1)))
+      break;
+
+  timer->level = level;
+  timer->slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+  head = &wheel->slots[level][timer->slot];
+  timer->prev = NULL;
+  timer->next = *head;
+  if (*head)
+    (*head)->prev = timer;
+  *head = timer;
+
+  wheel->occupied[level] |= G_GUINT64_CONSTANT (1) << timer->slot;
+}
+
+static void
+timer_free (gpointer data)
+{
+  Timer *timer = data;
+  gsize i;
+
+  jscore_value_unprotect (timer->ctx, timer->callback);
+  for (i = 0; i < timer->n_arguments; i++)
+    jscore_value_unprotect (timer->ctx, timer->arguments[i]);
+
+  g_slice_free1 (sizeof (JSValueRef) * timer->n_arguments, timer->arguments);
+  g_slice_free (Timer, timer);
+}
+
+static guint64
+next_event (TimerWheel *wheel)
+{
+  guint64 next = G_MAXUINT64;
+  gint level;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+      guint shift = WHEEL_BITS * level;
+      guint64 block, candidate;
+
+      if (!wheel->occupied[level])
+        continue;
+
+      /* Slots above level 0 are due when the level below wraps into them */
+      block = (wheel->now + (G_GUINT64_CONSTANT (1) << shift) - 1) >> shift;
+      candidate = (block + first_set_from (wheel->occupied[level],
+                                           block & WHEEL_MASK)) << shift;
+      next = MIN (next, candidate);
+    }
+
+  return next;
+}
+
+static guint64
+current_tick (TimerWheel *wheel,
+              gint64 time)
+{
+  return (time - wheel->origin) / wheel->tick_us;
+}
+
+/* First tick starting at least delay_us from now */
+static guint64
+deadline (TimerWheel *wheel,
+          gint64 delay_us)
+{
+  return (g_get_monotonic_time () - wheel->origin + delay_us
+          + wheel->tick_us - 1) / wheel->tick_us;
+}
+
+static void
+rearm (TimerWheel *wheel)
+{
+  guint64 next = next_event (wheel);
+
+  if (next == G_MAXUINT64)
+    g_source_set_ready_time (wheel->source, -1);
+  else
+    g_source_set_ready_time (wheel->source,
+                             wheel->origin + (gint64) next * wheel->tick_us);
+}
+
+static void
+cascade (TimerWheel *wheel,
+         gint level,
+         guint slot)
+{
+  Timer *timer = wheel->slots[level][slot];
+
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~(G_GUINT64_CONSTANT (1) << slot);
+
+  while (timer)
+    {
+      Timer *next = timer->next;
+
+      timer_insert (wheel, timer);
+      timer = next;
+    }
+}
+
+static void
+fire (TimerWheel *wheel,
+      Timer *timer)
+{
+  JSGlobalContextRef ctx = wheel->context->priv->real;
+  JSValueRef exception = NULL;
+  JSObjectRef callback = timer->callback;
+  JSValueRef *arguments = timer->arguments;
+  gsize n_arguments = timer->n_arguments;
+  GError *error = NULL;
+
+  wheel->stats.n_fired++;
+
+  /* The callback may clear the timer, so it owns nothing past this point */
+  if (timer->interval_us)
+    {
+      timer->expires = deadline (wheel, timer->interval_us);
+      timer_insert (wheel, timer);
+      JSObjectCallAsFunction (ctx, callback, NULL, n_arguments, arguments,
+                              &exception);
+    }
+  else
+    {
+      g_hash_table_steal (wheel->timers, GUINT_TO_POINTER (timer->id));
+      JSObjectCallAsFunction (ctx, callback, NULL, n_arguments, arguments,
+                              &exception);
+      timer_free (timer);
+    }
+
+  if (exception)
+    {
+      set_error_from_js_exception (&error, exception, wheel->context);
+      g_warning ("Uncaught exception in timer: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+advance (TimerWheel *wheel,
+         guint64 target)
+{
+  while (wheel->now <= target)
+    {
+      guint64 next = next_event (wheel);
+      Timer *timer;
+      gint level;
+      guint slot;
+
+      /* Nothing is due, including cascades, until after target */
+      if (next > target)
+        {
+          wheel->now = target + 1;
+          break;
+        }
+
+      wheel->now = next;
+
+      for (level = 1; level < WHEEL_LEVELS; level++)
+        {
+          if (wheel->now & ((G_GUINT64_CONSTANT (1) << (WHEEL_BITS * level)) - 1))
+            break;
+          cascade (wheel, level,
+                   (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        }
+
+      slot = wheel->now & WHEEL_MASK;
+      wheel->firing = wheel->slots[0][slot];
+      wheel->slots[0][slot] = NULL;
+      wheel->occupied[0] &= ~(G_GUINT64_CONSTANT (1) << slot);
+      for (timer = wheel->firing; timer; timer = timer->next)
+        timer->level = LEVEL_FIRING;
+
+      /* Timers added from callbacks go after the current tick */
+      wheel->now++;
+
+      while ((timer = wheel->firing))
+        {
+          timer_unlink (wheel, timer);
+          fire (wheel, timer);
+        }
+    }
+}
+
+static gboolean
+wheel_source_dispatch (GSource *source,
+                       GSourceFunc callback,
+                       gpointer user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs wheel_source_funcs = {
+  NULL,
+  NULL,
+  wheel_source_dispatch,
+  NULL
+};
+
+static gboolean
+run_timers (gpointer data)
+{
+  TimerWheel *wheel = data;
+  JSCoreContext *context = g_object_ref (wheel->context);
+
+  wheel->stats.n_wakeups++;
+
+  advance (wheel, current_tick (wheel, g_source_get_time (wheel->source)));
+  rearm (wheel);
+
+  g_object_unref (context);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static guint
+add_timer (TimerWheel *wheel,
+           JSContextRef ctx,
+           size_t argument_count,
+           const JSValueRef arguments[],
+           gboolean repeat,
+           JSValueRef *exception)
+{
+  Timer *timer;
+  gdouble delay = 0;
+  gint64 delay_us;
+  guint64 now;
+  gsize i;
+
+  if (argument_count < 1 || !JSValueIsObject (ctx, arguments[0])
+      || !JSObjectIsFunction (ctx, (JSObjectRef) arguments[0]))
+    {
+      JSStringRef message =
+        JSStringCreateWithUTF8CString ("callback is not a function");
+      JSValueRef argument = JSValueMakeString (ctx, message);
+
+      JSStringRelease (message);
+      *exception = JSObjectMakeError (ctx, 1, &argument, NULL);
+      return 0;
+    }
+
+  if (argument_count > 1)
+    {
+      delay = JSValueToNumber (ctx, arguments[1], exception);
+      if (*exception)
+        return 0;
+    }
+
+  if (isnan (delay) || delay < 0)
+    delay = 0;
+  delay = MIN (delay, G_MAXINT32);
+  if (delay < wheel->min_delay_ms)
+    {
+      delay = wheel->min_delay_ms;
+      wheel->stats.n_clamped++;
+    }
+
+  delay_us = (gint64) delay * 1000;
+  now = current_tick (wheel, g_get_monotonic_time ());
+
+  /* An idle wheel skips ahead instead of walking the gap later */
+  if (!wheel->occupied[0] && !wheel->occupied[1]
+      && !wheel->occupied[2] && !wheel->occupied[3])
+    wheel->now = MAX (wheel->now, now);
+
+  timer = g_slice_new0 (Timer);
+  timer->level = LEVEL_NONE;
+  timer->id = wheel->next_id++;
+  timer->expires = deadline (wheel, delay_us);
+  timer->interval_us = repeat ? MAX (delay_us, wheel->tick_us) : 0;
+  timer->ctx = wheel->context->priv->real;
+  timer->callback = (JSObjectRef) arguments[0];
+  jscore_value_protect (timer->ctx, timer->callback);
+
+  timer->n_arguments = argument_count > 2 ? argument_count - 2 : 0;
+  timer->arguments = g_slice_alloc (sizeof (JSValueRef) * timer->n_arguments);
+  for (i = 0; i < timer->n_arguments; i++)
+    {
+      timer->arguments[i] = arguments[i + 2];
+      jscore_value_protect (timer->ctx, timer->arguments[i]);
+    }
+
+  g_hash_table_insert (wheel->timers, GUINT_TO_POINTER (timer->id), timer);
+  timer_insert (wheel, timer);
+  rearm (wheel);
+
+  wheel->stats.n_scheduled++;
+  wheel->stats.peak_active = MAX (wheel->stats.peak_active,
+                                  g_hash_table_size (wheel->timers));
+
+  return timer->id;
+}
+
+static void
+clear_timer (TimerWheel *wheel,
+             JSContextRef ctx,
+             size_t argument_count,
+             const JSValueRef arguments[])
+{
+  Timer *timer;
+  gdouble number;
+  guint id;
+
+  if (argument_count < 1 || !JSValueIsNumber (ctx, arguments[0]))
+    return;
+
+  /* Anything a guint cannot hold is no timer of ours */
+  number = JSValueToNumber (ctx, arguments[0], NULL);
+  if (!isfinite (number) || number < 0 || number > G_MAXUINT)
+    return;
+
+  id = (guint) number;
+  timer = g_hash_table_lookup (wheel->timers, GUINT_TO_POINTER (id));
+  if (timer == NULL)
+    return;
+
+  timer_unlink (wheel, timer);
+  g_hash_table_remove (wheel->timers, GUINT_TO_POINTER (id));
+}
+
+static JSValueRef
+host_function_call (JSContextRef ctx,
+                    JSObjectRef function,
+                    JSObjectRef this_object,
+                    size_t argument_count,
+                    const JSValueRef arguments[],
+                    JSValueRef *exception)
+{
+  HostFunction *host = JSObjectGetPrivate (function);
+  gint64 sampled = jscore_profiler_sample ();
+  JSValueRef result;
+  guint id;
+
+  /* The context that installed the function is gone */
+  if (host == NULL)
+    return JSValueMakeUndefined (ctx);
+
+  JSCORE_COUNT (host->wheel->context, JSCORE_COUNTER_CALLS_FROM_JS, 1);
+  JSCORE_PROBE2 (callback_enter, host->wheel->context, function_names[host->kind]);
+
+  switch (host->kind)
+    {
+    case SET_TIMEOUT:
+    case SET_INTERVAL:
+      id = add_timer (host->wheel, ctx, argument_count, arguments,
+                      host->kind == SET_INTERVAL, exception);
+      result = id ? JSValueMakeNumber (ctx, id) : JSValueMakeUndefined (ctx);
+      break;
+    default:
+      clear_timer (host->wheel, ctx, argument_count, arguments);
+      result = JSValueMakeUndefined (ctx);
+      break;
+    }
+
+  JSCORE_PROBE2 (callback_exit, host->wheel->context, function_names[host->kind]);
+
+  if (sampled)
+    jscore_profiler_record (ctx, function, function_names[host->kind], sampled);
+
+  return result;
+}
+
+static JSClassRef
+get_host_function_class (void)
+{
+  static gsize class = 0;
+
+  if (g_once_init_enter (&class))
+    {
+      JSClassDefinition definition = kJSClassDefinitionEmpty;
+
+      definition.className = "TimerFunction";
+      definition.callAsFunction = host_function_call;
+
+      g_once_init_leave (&class, (gsize) JSClassCreate (&definition));
+    }
+
+  return (JSClassRef) class;
+}
+
+void
+jscore_context_free_timers (JSCoreContext *context)
+{
+  TimerWheel *wheel = context->priv->timers;
+  guint i;
+
+  if (wheel == NULL)
+    return;
+
+  for (i = 0; i < N_FUNCTIONS; i++)
+    {
+      JSObjectSetPrivate (wheel->functions[i].object, NULL);
+      jscore_value_unprotect (context->priv->real, wheel->functions[i].object);
+    }
+
+  g_source_destroy (wheel->source);
+  g_source_unref (wheel->source);
+  g_hash_table_destroy (wheel->timers);
+  g_slice_free (TimerWheel, wheel);
+
+  context->priv->timers = NULL;
+}
+
+gboolean
+jscore_context_install_timers (JSCoreContext *context,
+                               guint resolution_ms,
+                               guint min_delay_ms,
+                               GError **error)
+{
+  JSCoreContextPrivate *priv;
+  JSObjectRef global;
+  TimerWheel *wheel;
+  guint i;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), FALSE);
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  priv = context->priv;
+
+  if (priv->timers)
+    {
+      g_set_error_literal (error, JS_CORE_ERROR,
+                           JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Timers are already installed");
+      return FALSE;
+    }
+
+  wheel = g_slice_new0 (TimerWheel);
+  wheel->context = context;
+  wheel->origin = g_get_monotonic_time ();
+  wheel->tick_us = (gint64) MAX (resolution_ms, 1) * 1000;
+  wheel->min_delay_ms = min_delay_ms;
+  wheel->next_id = 1;
+  wheel->timers = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                         NULL, timer_free);
+
+  wheel->source = g_source_new (&wheel_source_funcs, sizeof (GSource));
+  g_source_set_name (wheel->source, "JSCoreContext timers");
+  g_source_set_callback (wheel->source, run_timers, wheel, NULL);
+  g_source_attach (wheel->source, priv->group->priv->owner_context);
+
+  global = JSContextGetGlobalObject (priv->real);
+
+  for (i = 0; i < N_FUNCTIONS; i++)
+    {
+      HostFunction *host = &wheel->functions[i];
+      JSStringRef name = JSStringCreateWithUTF8CString (function_names[i]);
+
+      host->wheel = wheel;
+      host->kind = i;
+      host->object = JSObjectMake (priv->real, get_host_function_class (),
+                                   host);
+      jscore_value_protect (priv->real, host->object);
+
+      JSObjectSetProperty (priv->real, global, name, host->object,
+                           kJSPropertyAttributeDontEnum, NULL);
+      JSStringRelease (name);
+    }
+
+  priv->timers = wheel;
+
+  return TRUE;
+}
+
+void
+jscore_context_get_timer_stats (JSCoreContext *context,
+                                JSCoreTimerStats *stats)
+{
+  TimerWheel *wheel;
+
+  g_return_if_fail (IS_JSCORE_CONTEXT (context));
+  g_return_if_fail (stats != NULL);
+
+  wheel = context->priv->timers;
+  if (wheel == NULL)
+    {
+      memset (stats, 0, sizeof (JSCoreTimerStats));
+      return;
+    }
+
+  *stats = wheel->stats;
+  stats->n_active = g_hash_table_size (wheel->timers);
+}
@@ -0,0 +1,49 @@
+/*
+ * jscore-timers.h - Header for the setTimeout family of host functions
+ *
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_TIMERS_H__
+#define __JSCORE_TIMERS_H__
+
+#include "jscore-value.h"
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  guint n_active;
+  guint peak_active;
+  guint64 n_scheduled;
+  guint64 n_fired;
+  /* Delays raised to the minimum */
+  guint64 n_clamped;
+  /* Main context dispatches, timers due in the same tick share one */
+  guint64 n_wakeups;
+} JSCoreTimerStats;
+
+/* Adds setTimeout, setInterval, clearTimeout and clearInterval to the
+ * global object. Deadlines are rounded up to resolution_ms and delays
+ * shorter than min_delay_ms are raised to it. */
+gboolean jscore_context_install_timers (JSCoreContext *context, guint resolution_ms, guint min_delay_ms, GError **error);
+void jscore_context_get_timer_stats (JSCoreContext *context, JSCoreTimerStats *stats);
+
+G_END_DECLS
+
+#endif /* __JSCORE_TIMERS_H__ */
@@ -1 +1,45 @@
+/*
+ * Copyright (C) 2010 Igalia S.L.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef js_core_value_private_h
+#define js_core_value_private_h
+
+#include <glib.h>
+#include <JavaScriptCore/JavaScript.h>
+
+#include "jscore-value.h"
+
 gchar *jscore_value_get_string_real (JSContextRef context, JSValueRef value);
+gchar *jscore_value_get_function_name (JSContextRef context, JSObjectRef function);
+
+GBytes *jscore_value_lookup_bytes (gconstpointer data, gsize length);
+/* Wraps the contents of bytes without copying them, scripts write
+ * straight into them */
+JSCoreValue *jscore_value_new_typed_array_sharing_bytes (JSCoreContext *context, JSCoreTypedArrayType type, GBytes *bytes, GError **error);
+
+void jscore_value_protect (JSContextRef ctx, JSValueRef value);
+void jscore_value_unprotect (JSContextRef ctx, JSValueRef value);
+#ifdef JSCORE_ENABLE_DEBUG
+/* Warns about, and forgets, values of group still protected */
+void jscore_debug_report_protected (JSContextGroupRef group);
+#endif
+
+void set_error_from_js_exception (GError **error, JSValueRef exception, JSCoreContext *context);
+
+#endif
@@ -22,30 +22,365 @@
 #include "jscore-context.h"
 #include "jscore-context-private.h"
 #include "jscore-class-private.h"
+#include "jscore-value-private.h"
+#include "jscore-exception-private.h"
+#include "jscore-probes.h"
 
 #include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
 #include <JavaScriptCore/JavaScript.h>
 
+GQuark
+jscore_error_quark (void)
+{
+  return g_quark_from_static_string ("jscore-gobject-error");
+}
+
+void
+set_error_from_js_exception (GError **error, JSValueRef exception, JSCoreContext *context)
+{
+  JSCoreException *wrapped;
+
+  g_assert ((exception));
+
+  JSCORE_COUNT (context, JSCORE_COUNTER_EXCEPTIONS, 1);
+
+  /* The watchdog stopped the script, what it threw says nothing useful */
+  if (context->priv->terminated)
+    {
+      g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_TERMINATED,
+                           "Script exceeded its execution time limit");
+      return;
+    }
+
+  /* Kept for jscore_context_take_exception() whether or not an error was
+   * asked for, nothing is read from it until someone does */
+  wrapped = jscore_exception_new (context->priv->real, exception);
+  if (error)
+    jscore_exception_to_error (wrapped, error);
+
+  if (context->priv->last_exception)
+    jscore_exception_unref (context->priv->last_exception);
+  context->priv->last_exception = wrapped;
+}
+
 /* JavascriptCore API */
 
+/* Every protection taken by the library goes through these so leaks show
+ * up in jscore_get_protect_count() */
+static gint protect_count = 0;
+
+#ifdef JSCORE_ENABLE_DEBUG
+
+/* Debug builds keep, per protected value, where each protection still
+ * held was taken */
+#define MAX_FRAMES 24
+
+typedef struct
+{
+  gint n_frames;
+  gpointer frames[MAX_FRAMES];
+} Backtrace;
+
+typedef struct
+{
+  JSContextGroupRef group;
+  JSValueRef value;
+  gint count;
+  /* Backtrace, most recent last */
+  GQueue protections;
+} ProtectRecord;
+
+/* Records by group and value, the same value may be protected in several
+ * groups */
+static GHashTable *protect_records = NULL;
+G_LOCK_DEFINE_STATIC (protect_records);
+
+static guint
+protect_record_hash (gconstpointer data)
+{
+  const ProtectRecord *record = data;
+
+  return g_direct_hash (record->group) ^ g_direct_hash (record->value);
+}
+
+static gboolean
+protect_record_equal (gconstpointer a,
+                      gconstpointer b)
+{
+  const ProtectRecord *ra = a, *rb = b;
+
+  return ra->group == rb->group && ra->value == rb->value;
+}
+
+/* Numbers, booleans, null and undefined are not heap cells, protecting
+ * them does nothing and they compare equal whatever protected them */
+static gboolean
+is_cell (JSContextRef ctx,
+         JSValueRef value)
+{
+  switch (JSValueGetType (ctx, value))
+    {
+    case kJSTypeUndefined:
+    case kJSTypeNull:
+    case kJSTypeBoolean:
+    case kJSTypeNumber:
+      return FALSE;
+    default:
+      return TRUE;
+    }
+}
+
+static Backtrace *
+backtrace_new (void)
+{
+  Backtrace *trace = g_slice_new (Backtrace);
+
+#ifdef HAVE_EXECINFO_H
+  trace->n_frames = backtrace (trace->frames, MAX_FRAMES);
+#else
+  trace->n_frames = 0;
+#endif
+
+  return trace;
+}
+
+static void
+backtrace_free (gpointer data)
+{
+  g_slice_free (Backtrace, data);
+}
+
+static void
+append_backtrace (GString *out, Backtrace *trace)
+{
+#ifdef HAVE_EXECINFO_H
+  gchar **symbols = backtrace_symbols (trace->frames, trace->n_frames);
+  gint i;
+
+  /* Skip the accounting frames themselves */
+  for (i = 2; symbols && i < trace->n_frames; i++)
+    g_string_append_printf (out, "      %s\n", symbols[i]);
+  free (symbols);
+#else
+  g_string_append (out, "      (no backtrace support)\n");
+#endif
+}
+
+static void
+protect_record_free (gpointer data)
+{
+  ProtectRecord *record = data;
+
+  g_queue_free_full (&record->protections, backtrace_free);
+  g_slice_free (ProtectRecord, record);
+}
+
+static void
+append_record (GString *out, ProtectRecord *record)
+{
+  GList *l;
+
+  g_string_append_printf (out, "  value %p of group %p protected %d time(s)\n",
+                          record->value, record->group, record->count);
+  for (l = record->protections.head; l; l = l->next)
+    {
+      g_string_append (out, "    protected at:\n");
+      append_backtrace (out, l->data);
+    }
+}
+
+static void
+record_protect (JSContextRef ctx,
+                JSValueRef value)
+{
+  ProtectRecord key, *record;
+
+  if (!is_cell (ctx, value))
+    return;
+
+  key.group = JSContextGetGroup (ctx);
+  key.value = value;
+
+  G_LOCK (protect_records);
+
+  if (protect_records == NULL)
+    protect_records = g_hash_table_new_full (protect_record_hash,
+                                             protect_record_equal,
+                                             NULL, protect_record_free);
+
+  record = g_hash_table_lookup (protect_records, &key);
+  if (record == NULL)
+    {
+      record = g_slice_new0 (ProtectRecord);
+      record->group = key.group;
+      record->value = value;
+      g_queue_init (&record->protections);
+      g_hash_table_add (protect_records, record);
+    }
+
+  record->count++;
+  g_queue_push_tail (&record->protections, backtrace_new ());
+
+  G_UNLOCK (protect_records);
+}
+
+static void
+record_unprotect (JSContextRef ctx,
+                  JSValueRef value)
+{
+  ProtectRecord key, *record;
+
+  if (!is_cell (ctx, value))
+    return;
+
+  key.group = JSContextGetGroup (ctx);
+  key.value = value;
+
+  G_LOCK (protect_records);
+
+  record = protect_records ? g_hash_table_lookup (protect_records, &key) : NULL;
+  if (record == NULL)
+    {
+      GString *out = g_string_new (NULL);
+      Backtrace *trace = backtrace_new ();
+
+      G_UNLOCK (protect_records);
+
+      append_backtrace (out, trace);
+      g_warning ("Unprotecting value %p which the library never protected, at:\n%s",
+                 value, out->str);
+      g_string_free (out, TRUE);
+      backtrace_free (trace);
+      return;
+    }
+
+  backtrace_free (g_queue_pop_tail (&record->protections));
+  if (--record->count == 0)
+    g_hash_table_remove (protect_records, record);
+
+  G_UNLOCK (protect_records);
+}
+
+void
+jscore_debug_report_protected (JSContextGroupRef group)
+{
+  GString *out = g_string_new (NULL);
+  GHashTableIter iter;
+  gpointer value;
+  guint n = 0;
+
+  G_LOCK (protect_records);
+  if (protect_records)
+    {
+      g_hash_table_iter_init (&iter, protect_records);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          ProtectRecord *record = value;
+
+          if (record->group != group)
+            continue;
+          append_record (out, record);
+          g_hash_table_iter_remove (&iter);
+          n++;
+        }
+    }
+  G_UNLOCK (protect_records);
+
+  if (n)
+    g_warning ("Context group %p disposed with %u value(s) still protected:\n%s",
+               group, n, out->str);
+  g_string_free (out, TRUE);
+}
+
+#endif
+
+void
+jscore_value_protect (JSContextRef ctx,
+                      JSValueRef value)
+{
+  JSValueProtect (ctx, value);
+  g_atomic_int_inc (&protect_count);
+#ifdef JSCORE_ENABLE_DEBUG
+  record_protect (ctx, value);
+#endif
+}
+
+void
+jscore_value_unprotect (JSContextRef ctx,
+                        JSValueRef value)
+{
+#ifdef JSCORE_ENABLE_DEBUG
+  record_unprotect (ctx, value);
+#endif
+  JSValueUnprotect (ctx, value);
+  g_atomic_int_add (&protect_count, -1);
+}
+
+guint
+jscore_get_protect_count (void)
+{
+  return g_atomic_int_get (&protect_count);
+}
+
+gchar *
+jscore_debug_dump_protected (void)
+{
+  GString *out = g_string_new (NULL);
+
+  g_string_append_printf (out, "%u value(s) protected\n", jscore_get_protect_count ());
+
+#ifdef JSCORE_ENABLE_DEBUG
+  G_LOCK (protect_records);
+  if (protect_records)
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init (&iter, protect_records);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        append_record (out, value);
+    }
+  G_UNLOCK (protect_records);
+#else
+  g_string_append (out, "  configure with --enable-debug to see where they were protected\n");
+#endif
+
+  return g_string_free (out, FALSE);
+}
+
 void
 jscore_value_ref (JSCoreContext *context,
                       JSCoreValue *value)
 {
-  JSValueProtect(context->priv->real, value);
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  jscore_value_protect (context->priv->real, value);
+  JSCORE_COUNT (context, JSCORE_COUNTER_PROTECTS, 1);
+  g_atomic_int_inc (&context->priv->group->priv->n_protected);
 }
 
 void
 jscore_value_unref (JSCoreContext *context,
                       JSCoreValue *value)
 {
-  JSValueUnprotect (context->priv->real, value);
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  jscore_value_unprotect (context->priv->real, value);
+  JSCORE_COUNT (context, JSCORE_COUNTER_UNPROTECTS, 1);
+  g_atomic_int_add (&context->priv->group->priv->n_protected, -1);
 }
 
 int
 jscore_value_get_type (JSCoreContext *context,
                        const JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueGetType(context->priv->real, value);
 }
 
@@ -53,6 +388,8 @@ gboolean
 jscore_value_is_boolean (JSCoreContext *context,
                          JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsBoolean(context->priv->real, value);
 }
 
@@ -60,6 +397,8 @@ gboolean
 jscore_value_is_number (JSCoreContext *context,
                          JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsNumber (context->priv->real, value);
 }
 
@@ -67,6 +406,8 @@ gboolean
 jscore_value_is_null (JSCoreContext *context,
                       JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsNull (context->priv->real, value);
 }
 
@@ -74,6 +415,8 @@ gboolean
 jscore_value_is_string (JSCoreContext *context,
                       JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsString (context->priv->real, value);
 }
 
@@ -81,6 +424,8 @@ gboolean
 jscore_value_is_undefined (JSCoreContext *context,
                       JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsUndefined (context->priv->real, value);
 }
 
@@ -88,6 +433,8 @@ gboolean
 jscore_value_is_object (JSCoreContext *context,
                         JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsObject (context->priv->real, value);
 }
 
@@ -95,6 +442,8 @@ gboolean
 jscore_value_is_object_of_class (JSCoreContext *context,
                                  JSCoreValue *value, JSCoreClass *class)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsObjectOfClass (context->priv->real, value, class->priv->class);
 }
 
@@ -102,26 +451,42 @@ gboolean
 jscore_value_is_equal (JSCoreContext *context,
                        JSCoreValue *value, JSCoreValue *value2)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueIsEqual (context->priv->real, value, value2, NULL);
 }
 
 JSCoreValue *
 jscore_value_new_null (JSCoreContext *context)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+
   return JSValueMakeNull(context->priv->real);
 }
 
 JSCoreValue *
 jscore_value_new_undefined (JSCoreContext *context)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+
   return JSValueMakeUndefined(context->priv->real);
 }
 
 JSCoreValue *
 jscore_value_new_string (JSCoreContext *context, const gchar *string)
 {
-  JSStringRef jsstr = JSStringCreateWithUTF8CString (string);
-  JSValueRef valstr = JSValueMakeString (context->priv->real, jsstr);
+  JSStringRef jsstr;
+  JSValueRef valstr;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+  JSCORE_COUNT (context, JSCORE_COUNTER_STRINGS_TRANSCODED, 1);
+  JSCORE_COUNT (context, JSCORE_COUNTER_STRING_BYTES, strlen (string));
+
+  jsstr = JSStringCreateWithUTF8CString (string);
+  valstr = JSValueMakeString (context->priv->real, jsstr);
   JSStringRelease (jsstr);
 
   return valstr;
@@ -130,20 +495,34 @@ jscore_value_new_string (JSCoreContext *context, const gchar *string)
 JSCoreValue *
 jscore_value_new_number (JSCoreContext *context, gdouble number)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+
   return JSValueMakeNumber (context->priv->real, (gdouble) number);
 }
 
 JSCoreValue *
 jscore_value_new_boolean (JSCoreContext *context, gboolean boolean)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+
  return JSValueMakeBoolean (context->priv->real, boolean);
 }
 
 JSCoreValue *
 jscore_value_new_json (JSCoreContext *context, const gchar* json)
 {
-  JSStringRef jsstr = JSStringCreateWithUTF8CString (json);
-  JSValueRef val = JSValueMakeFromJSONString(context->priv->real, jsstr);
+  JSStringRef jsstr;
+  JSValueRef val;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+  JSCORE_COUNT (context, JSCORE_COUNTER_STRINGS_TRANSCODED, 1);
+  JSCORE_COUNT (context, JSCORE_COUNTER_STRING_BYTES, strlen (json));
+
+  jsstr = JSStringCreateWithUTF8CString (json);
+  val = JSValueMakeFromJSONString(context->priv->real, jsstr);
   JSStringRelease (jsstr);
 
   return val;
@@ -170,23 +549,50 @@ gchar *jscore_value_get_string_real (JSContextRef context, JSValueRef value)
   return buf;
 }
 
+gchar *
+jscore_value_get_function_name (JSContextRef context, JSObjectRef function)
+{
+  JSStringRef jname = JSStringCreateWithUTF8CString ("name");
+  JSValueRef name = JSObjectGetProperty (context, function, jname, NULL);
+
+  JSStringRelease (jname);
+
+  return name ? jscore_value_get_string_real (context, name) : NULL;
+}
+
 gchar *jscore_value_get_string (JSCoreContext *context, JSCoreValue *value)
 {
-  return jscore_value_get_string_real (context->priv->real, (JSValueRef) value);
+  gchar *string;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  string = jscore_value_get_string_real (context->priv->real, (JSValueRef) value);
+
+  JSCORE_COUNT (context, JSCORE_COUNTER_STRINGS_TRANSCODED, 1);
+  if (string)
+    JSCORE_COUNT (context, JSCORE_COUNTER_STRING_BYTES, strlen (string));
+
+  return string;
 }
 
 gdouble jscore_value_get_number (JSCoreContext *context, JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueToNumber (context->priv->real, value, NULL);
 }
 
 gboolean jscore_value_get_boolean (JSCoreContext *context, JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueToBoolean(context->priv->real, value);
 }
 
 gchar *jscore_value_get_json (JSCoreContext *context, const JSCoreValue *value)
 {
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   return JSValueCreateJSONString(context->priv->real, value, 2, NULL);
 }
 
@@ -198,6 +604,8 @@ jscore_value_new_gvalue (JSCoreContext *context,
 {
   JSValueRef exception = NULL;
 
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
   if (!G_IS_VALUE (gval))
     {
       return false;
@@ -236,74 +644,649 @@ jscore_value_new_gvalue (JSCoreContext *context,
   return NULL;
 }
 
+#define MAX_VARIANT_DEPTH 64
+
+static JSValueRef
+variant_to_js (JSContextRef ctx, GVariant *variant, guint depth)
+{
+  JSValueRef *elements;
+  JSObjectRef object;
+  JSStringRef name;
+  GVariant *child, *key, *value;
+  JSValueRef result;
+  gsize n, i;
+
+  switch (g_variant_classify (variant))
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      return JSValueMakeBoolean (ctx, g_variant_get_boolean (variant));
+    case G_VARIANT_CLASS_BYTE:
+      return JSValueMakeNumber (ctx, g_variant_get_byte (variant));
+    case G_VARIANT_CLASS_INT16:
+      return JSValueMakeNumber (ctx, g_variant_get_int16 (variant));
+    case G_VARIANT_CLASS_UINT16:
+      return JSValueMakeNumber (ctx, g_variant_get_uint16 (variant));
+    case G_VARIANT_CLASS_INT32:
+    case G_VARIANT_CLASS_HANDLE:
+      return JSValueMakeNumber (ctx, g_variant_get_int32 (variant));
+    case G_VARIANT_CLASS_UINT32:
+      return JSValueMakeNumber (ctx, g_variant_get_uint32 (variant));
+    case G_VARIANT_CLASS_INT64:
+      return JSValueMakeNumber (ctx, g_variant_get_int64 (variant));
+    case G_VARIANT_CLASS_UINT64:
+      return JSValueMakeNumber (ctx, g_variant_get_uint64 (variant));
+    case G_VARIANT_CLASS_DOUBLE:
+      return JSValueMakeNumber (ctx, g_variant_get_double (variant));
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+      name = JSStringCreateWithUTF8CString (g_variant_get_string (variant, NULL));
+      result = JSValueMakeString (ctx, name);
+      JSStringRelease (name);
+      return result;
+    default:
+      break;
+    }
+
+  if (depth >= MAX_VARIANT_DEPTH)
+    return NULL;
+
+  switch (g_variant_classify (variant))
+    {
+    case G_VARIANT_CLASS_VARIANT:
+      child = g_variant_get_variant (variant);
+      result = variant_to_js (ctx, child, depth + 1);
+      g_variant_unref (child);
+      return result;
+
+    case G_VARIANT_CLASS_MAYBE:
+      child = g_variant_get_maybe (variant);
+      if (child == NULL)
+        return JSValueMakeNull (ctx);
+      result = variant_to_js (ctx, child, depth + 1);
+      g_variant_unref (child);
+      return result;
+
+    case G_VARIANT_CLASS_ARRAY:
+      /* a{s*} becomes an object, any other array or tuple an array */
+      if (g_variant_type_is_dict_entry (g_variant_type_element (g_variant_get_type (variant)))
+          && g_variant_get_type_string (variant)[2] == 's')
+        {
+          object = JSObjectMake (ctx, NULL, NULL);
+          n = g_variant_n_children (variant);
+          for (i = 0; i < n; i++)
+            {
+              child = g_variant_get_child_value (variant, i);
+              key = g_variant_get_child_value (child, 0);
+              value = g_variant_get_child_value (child, 1);
+
+              result = variant_to_js (ctx, value, depth + 1);
+              if (result)
+                {
+                  name = JSStringCreateWithUTF8CString (g_variant_get_string (key, NULL));
+                  JSObjectSetProperty (ctx, object, name, result,
+                                       kJSPropertyAttributeNone, NULL);
+                  JSStringRelease (name);
+                }
+
+              g_variant_unref (value);
+              g_variant_unref (key);
+              g_variant_unref (child);
+            }
+          return object;
+        }
+      /* fall through */
+    case G_VARIANT_CLASS_TUPLE:
+    case G_VARIANT_CLASS_DICT_ENTRY:
+      n = g_variant_n_children (variant);
+      elements = g_new (JSValueRef, MAX (n, 1));
+      for (i = 0; i < n; i++)
+        {
+          child = g_variant_get_child_value (variant, i);
+          elements[i] = variant_to_js (ctx, child, depth + 1);
+          if (elements[i] == NULL)
+            elements[i] = JSValueMakeUndefined (ctx);
+          g_variant_unref (child);
+        }
+      /* Elements are only on the heap until the array holds them */
+      for (i = 0; i < n; i++)
+        jscore_value_protect (ctx, elements[i]);
+      result = JSObjectMakeArray (ctx, n, elements, NULL);
+      for (i = 0; i < n; i++)
+        jscore_value_unprotect (ctx, elements[i]);
+      g_free (elements);
+      return result;
+
+    default:
+      return NULL;
+    }
+}
+
 JSCoreValue *
 jscore_value_new_variant (JSCoreContext *context,
                         GVariant * gval, GError **error)
 {
-  JSValueRef exception = NULL;
+  JSValueRef value;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  g_return_val_if_fail (gval != NULL, NULL);
+
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+  JSCORE_PROBE3 (variant_to_js, context, g_variant_get_type_string (gval),
+                 g_variant_get_size (gval));
+  value = variant_to_js (context->priv->real, gval, 0);
+  if (value == NULL)
+    g_set_error (error, JS_CORE_ERROR, JS_CORE_ERROR_NOT_SUPPORTED,
+                 "Cannot convert variant of type %s",
+                 g_variant_get_type_string (gval));
+
+  return (JSCoreValue *) value;
+}
 
-  if (!G_IS_VARIANT (gval))
+static gboolean
+value_is_array (JSContextRef ctx, JSValueRef value)
+{
+#ifdef HAVE_JSC_TYPED_ARRAYS
+  return JSValueIsArray (ctx, value);
+#else
+  JSStringRef name = JSStringCreateWithUTF8CString ("Array");
+  JSValueRef array = JSObjectGetProperty (ctx, JSContextGetGlobalObject (ctx),
+                                          name, NULL);
+
+  JSStringRelease (name);
+
+  return JSValueIsObject (ctx, array)
+    && JSValueIsInstanceOfConstructor (ctx, value, (JSObjectRef) array, NULL);
+#endif
+}
+
+static GVariant *
+js_to_variant (JSContextRef ctx, JSValueRef value, guint depth)
+{
+  JSPropertyNameArrayRef names;
+  GVariantBuilder builder;
+  JSObjectRef object;
+  JSStringRef name;
+  GVariant *child;
+  gchar *string;
+  gsize n, i;
+
+  switch (JSValueGetType (ctx, value))
     {
-      return false;
+    case kJSTypeBoolean:
+      return g_variant_new_boolean (JSValueToBoolean (ctx, value));
+    case kJSTypeNumber:
+      return g_variant_new_double (JSValueToNumber (ctx, value, NULL));
+    case kJSTypeString:
+      string = jscore_value_get_string_real (ctx, value);
+      return g_variant_new_take_string (string ? string : g_strdup (""));
+    case kJSTypeObject:
+      break;
+    default:
+      return NULL;
     }
-  GVariantType *type = g_variant_get_type (gval);
 
-  if (g_variant_type_equal(type, G_VARIANT_TYPE_BOOLEAN))
-      return jscore_value_new_boolean (context,
-                                       g_variant_get_boolean (gval));
-  else if (g_variant_type_equal(type, G_VARIANT_TYPE_BYTE))
-    return jscore_value_new_number (context,
-                                      g_variant_get_byte(gval));
-  else if (g_variant_type_equal(type, G_VARIANT_TYPE_INT16))
-     return jscore_value_new_number (context,
-                                       g_variant_get_int16(gval));
-  else if (g_variant_type_equal(type, G_VARIANT_TYPE_INT32))
-     return jscore_value_new_number (context,
-                                       g_variant_get_int32(gval));
-  else if (g_variant_type_equal(type, G_VARIANT_TYPE_INT64))
-     return jscore_value_new_number (context,
-                                       g_variant_get_int64(gval));
-  else if (g_variant_type_equal(type, G_VARIANT_TYPE_UINT16))
-      return jscore_value_new_number (context,
-                                        g_variant_get_uint16(gval));
-   else if (g_variant_type_equal(type, G_VARIANT_TYPE_UINT32))
-      return jscore_value_new_number (context,
-                                        g_variant_get_uint32(gval));
-   else if (g_variant_type_equal(type, G_VARIANT_TYPE_UINT64))
-      return jscore_value_new_number (context,
-                                        g_variant_get_uint64(gval));
-
-   else if (g_variant_type_equal(type, G_VARIANT_TYPE_DOUBLE))
-       return jscore_value_new_number (context,
-                                         g_variant_get_double(gval));
-
-    else if (g_variant_type_equal(type, G_VARIANT_TYPE_UINT32))
-       return jscore_value_new_string (context,
-                                         g_variant_get_bytestring(gval));
+  object = (JSObjectRef) value;
+  if (depth >= MAX_VARIANT_DEPTH || JSObjectIsFunction (ctx, object))
+    return NULL;
 
-  return NULL;
+  /* Missing values inside containers are kept as an empty maybe */
+  if (value_is_array (ctx, value))
+    {
+      name = JSStringCreateWithUTF8CString ("length");
+      n = (gsize) JSValueToNumber (ctx, JSObjectGetProperty (ctx, object, name, NULL), NULL);
+      JSStringRelease (name);
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+      for (i = 0; i < n; i++)
+        {
+          child = js_to_variant (ctx, JSObjectGetPropertyAtIndex (ctx, object, i, NULL),
+                                 depth + 1);
+          if (child == NULL)
+            child = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+          g_variant_builder_add (&builder, "v", child);
+        }
+      return g_variant_builder_end (&builder);
+    }
+
+  names = JSObjectCopyPropertyNames (ctx, object);
+  n = JSPropertyNameArrayGetCount (names);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  for (i = 0; i < n; i++)
+    {
+      name = JSPropertyNameArrayGetNameAtIndex (names, i);
+      child = js_to_variant (ctx, JSObjectGetProperty (ctx, object, name, NULL),
+                             depth + 1);
+      if (child == NULL)
+        child = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+
+      string = jscore_value_get_string_real (ctx, JSValueMakeString (ctx, name));
+      g_variant_builder_add (&builder, "{sv}", string, child);
+      g_free (string);
+    }
+  JSPropertyNameArrayRelease (names);
+
+  return g_variant_builder_end (&builder);
 }
 
+/* null, undefined and functions have no variant form and give NULL */
 GVariant *
 jscore_value_to_variant (JSCoreValue *value,JSCoreContext *context)
 {
+  GVariant *variant;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  variant = js_to_variant (context->priv->real, (JSValueRef) value, 0);
+
+  JSCORE_PROBE3 (js_to_variant, context,
+                 variant ? g_variant_get_type_string (variant) : NULL,
+                 variant ? g_variant_get_size (variant) : 0);
+
+  return variant;
+}
+
+
+/* Typed arrays */
+
+#ifdef HAVE_JSC_TYPED_ARRAYS
+
+static const gsize typed_array_element_size[] = {
+  1, /* JS_CORE_TYPED_ARRAY_INT8 */
+  2, /* JS_CORE_TYPED_ARRAY_INT16 */
+  4, /* JS_CORE_TYPED_ARRAY_INT32 */
+  1, /* JS_CORE_TYPED_ARRAY_UINT8 */
+  1, /* JS_CORE_TYPED_ARRAY_UINT8_CLAMPED */
+  2, /* JS_CORE_TYPED_ARRAY_UINT16 */
+  4, /* JS_CORE_TYPED_ARRAY_UINT32 */
+  4, /* JS_CORE_TYPED_ARRAY_FLOAT32 */
+  8, /* JS_CORE_TYPED_ARRAY_FLOAT64 */
+  1  /* JS_CORE_TYPED_ARRAY_ARRAY_BUFFER */
+};
+
+typedef struct
+{
+  GDestroyNotify destroy_notify;
+  gpointer user_data;
+  gconstpointer registered;
+} BufferDeallocator;
+
+/* Buffers created over a GBytes, by data pointer, so the serializer can
+ * hand the GBytes over instead of copying its contents. */
+typedef struct
+{
+  GBytes *bytes;
+  guint count;
+} RegisteredBytes;
+
+G_LOCK_DEFINE_STATIC (registered_bytes);
+static GHashTable *registered_bytes = NULL;
+
+static void
+register_bytes (GBytes *bytes)
+{
+  gconstpointer data = g_bytes_get_data (bytes, NULL);
+  RegisteredBytes *entry;
+
+  G_LOCK (registered_bytes);
+
+  if (registered_bytes == NULL)
+    registered_bytes = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  entry = g_hash_table_lookup (registered_bytes, data);
+  if (entry == NULL)
+    {
+      entry = g_slice_new (RegisteredBytes);
+      entry->bytes = bytes;
+      entry->count = 0;
+      g_hash_table_insert (registered_bytes, (gpointer) data, entry);
+    }
+  entry->count++;
+
+  G_UNLOCK (registered_bytes);
+}
+
+static void
+unregister_bytes (gconstpointer data)
+{
+  RegisteredBytes *entry;
+
+  G_LOCK (registered_bytes);
+
+  entry = g_hash_table_lookup (registered_bytes, data);
+  if (entry && --entry->count == 0)
+    {
+      g_hash_table_remove (registered_bytes, data);
+      g_slice_free (RegisteredBytes, entry);
+    }
+
+  G_UNLOCK (registered_bytes);
+}
+
+static void
+buffer_deallocate (void *bytes, void *deallocator_context)
+{
+  BufferDeallocator *deallocator = deallocator_context;
+
+  if (deallocator->registered)
+    unregister_bytes (deallocator->registered);
+
+  if (deallocator->destroy_notify)
+    deallocator->destroy_notify (deallocator->user_data);
+
+  g_slice_free (BufferDeallocator, deallocator);
+}
+
+#endif
+
+GBytes *
+jscore_value_lookup_bytes (gconstpointer data, gsize length)
+{
+  GBytes *bytes = NULL;
+#ifdef HAVE_JSC_TYPED_ARRAYS
+  RegisteredBytes *entry;
+
+  G_LOCK (registered_bytes);
+
+  entry = registered_bytes ? g_hash_table_lookup (registered_bytes, data) : NULL;
+  if (entry && g_bytes_get_size (entry->bytes) == length)
+    bytes = g_bytes_ref (entry->bytes);
+
+  G_UNLOCK (registered_bytes);
+#endif
+
+  return bytes;
+}
+
+typedef struct
+{
+  JSGlobalContextRef context;
+  JSValueRef value;
+} ProtectedBuffer;
+
+static void
+protected_buffer_free (gpointer data)
+{
+  ProtectedBuffer *buffer = data;
+
+  jscore_value_unprotect (buffer->context, buffer->value);
+  JSGlobalContextRelease (buffer->context);
+
+  g_slice_free (ProtectedBuffer, buffer);
+}
+
+static JSCoreValue *
+make_typed_array (JSCoreContext *context,
+                  JSCoreTypedArrayType type,
+                  gpointer data,
+                  gsize length,
+                  GDestroyNotify destroy_notify,
+                  gpointer user_data,
+                  GBytes *bytes,
+                  GError **error)
+{
+#ifdef HAVE_JSC_TYPED_ARRAYS
   JSValueRef exception = NULL;
+  JSObjectRef array;
+  BufferDeallocator *deallocator;
 
-  switch (JSValueGetType(context->priv->real, value))
-  {
-  case kJSTypeUndefined:
-  case kJSTypeNull:
-    return NULL;
-  case kJSTypeBoolean:
-    return g_variant_new_boolean (JSValueToBoolean(context, value));
-  case kJSTypeNumber:
-    return g_variant_new_double (JSValueToNumber(context, value, &exception));
-  case kJSTypeString:
-    return g_variant_new_string (JSValueToStringCopy(context, value, &exception));
-  case kJSTypeObject:
-    return g_variant_new_string(JSValueToStringCopy(context, value, &exception));
-  }
+  if (type >= JS_CORE_TYPED_ARRAY_NONE
+      || length % typed_array_element_size[type] != 0)
+    {
+      g_set_error (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                   "Buffer of %" G_GSIZE_FORMAT " bytes does not match typed array type %d",
+                   length, type);
+      if (destroy_notify)
+        destroy_notify (user_data);
+      return NULL;
+    }
+
+  /* From here on JavaScriptCore owns the memory, even on failure */
+  deallocator = g_slice_new (BufferDeallocator);
+  deallocator->destroy_notify = destroy_notify;
+  deallocator->user_data = user_data;
+  deallocator->registered = NULL;
+
+  if (bytes)
+    {
+      register_bytes (bytes);
+      deallocator->registered = data;
+    }
+
+  if (type == JS_CORE_TYPED_ARRAY_ARRAY_BUFFER)
+    array = JSObjectMakeArrayBufferWithBytesNoCopy (context->priv->real,
+                                                    data, length,
+                                                    buffer_deallocate,
+                                                    deallocator,
+                                                    &exception);
+  else
+    array = JSObjectMakeTypedArrayWithBytesNoCopy (context->priv->real,
+                                                   (JSTypedArrayType) type,
+                                                   data, length,
+                                                   buffer_deallocate,
+                                                   deallocator,
+                                                   &exception);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return NULL;
+    }
+
+  return (JSCoreValue *) array;
+#else
+  g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_NOT_SUPPORTED,
+                       "JavaScriptCore was built without typed array support");
+  if (destroy_notify)
+    destroy_notify (user_data);
+  return NULL;
+#endif
+}
+
+JSCoreValue *
+jscore_value_new_typed_array (JSCoreContext *context,
+                              JSCoreTypedArrayType type,
+                              gpointer data,
+                              gsize length,
+                              GDestroyNotify destroy_notify,
+                              gpointer user_data,
+                              GError **error)
+{
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+  JSCORE_COUNT (context, JSCORE_COUNTER_VALUES_CREATED, 1);
+
+  return make_typed_array (context, type, data, length,
+                           destroy_notify, user_data,
+                           NULL, error);
+}
+
+JSCoreValue *
+jscore_value_new_array_buffer (JSCoreContext *context,
+                               gpointer data,
+                               gsize length,
+                               GDestroyNotify destroy_notify,
+                               gpointer user_data,
+                               GError **error)
+{
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  return jscore_value_new_typed_array (context, JS_CORE_TYPED_ARRAY_ARRAY_BUFFER,
+                                       data, length,
+                                       destroy_notify, user_data,
+                                       error);
+}
+
+JSCoreValue *
+jscore_value_new_typed_array_sharing_bytes (JSCoreContext *context,
+                                            JSCoreTypedArrayType type,
+                                            GBytes *bytes,
+                                            GError **error)
+{
+  gsize length;
+  gconstpointer data = g_bytes_get_data (bytes, &length);
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  return make_typed_array (context, type,
+                           (gpointer) data, length,
+                           (GDestroyNotify) g_bytes_unref,
+                           g_bytes_ref (bytes),
+                           bytes, error);
+}
+
+JSCoreValue *
+jscore_value_new_typed_array_from_bytes (JSCoreContext *context,
+                                         JSCoreTypedArrayType type,
+                                         GBytes *bytes,
+                                         GError **error)
+{
+  JSCoreValue *array;
+  GBytes *contents;
+  gpointer data;
+  gsize length;
 
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  /* Scripts may write into the array, which must not show through bytes.
+   * The copy is still registered so the serializer can transfer it. */
+  data = g_bytes_unref_to_data (g_bytes_ref (bytes), &length);
+  contents = g_bytes_new_take (data, length);
+  array = jscore_value_new_typed_array_sharing_bytes (context, type,
+                                                      contents, error);
+  g_bytes_unref (contents);
+
+  return array;
+}
+
+JSCoreValue *
+jscore_value_new_typed_array_from_mapped_file (JSCoreContext *context,
+                                               JSCoreTypedArrayType type,
+                                               GMappedFile *file,
+                                               gboolean writable,
+                                               GError **error)
+{
+  JSCoreValue *array;
+  GBytes *bytes;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  /* Stores into a read-only mapping would fault */
+  if (!writable)
+    {
+      bytes = g_mapped_file_get_bytes (file);
+      array = jscore_value_new_typed_array_from_bytes (context, type,
+                                                       bytes, error);
+      g_bytes_unref (bytes);
+
+      return array;
+    }
+
+  return jscore_value_new_typed_array (context, type,
+                                       g_mapped_file_get_contents (file),
+                                       g_mapped_file_get_length (file),
+                                       (GDestroyNotify) g_mapped_file_unref,
+                                       g_mapped_file_ref (file),
+                                       error);
+}
+
+JSCoreTypedArrayType
+jscore_value_get_typed_array_type (JSCoreContext *context,
+                                   JSCoreValue *value)
+{
+#ifdef HAVE_JSC_TYPED_ARRAYS
+  JSTypedArrayType type;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  type = JSValueGetTypedArrayType (context->priv->real, (JSValueRef) value, NULL);
+
+  if (type > kJSTypedArrayTypeNone)
+    return JS_CORE_TYPED_ARRAY_NONE;
+
+  return (JSCoreTypedArrayType) type;
+#else
+  return JS_CORE_TYPED_ARRAY_NONE;
+#endif
+}
+
+/* Returns a pointer into the JS owned memory, valid as long as the value
+ * is alive. */
+gpointer
+jscore_value_get_typed_array_data (JSCoreContext *context,
+                                   JSCoreValue *value,
+                                   gsize *length,
+                                   GError **error)
+{
+#ifdef HAVE_JSC_TYPED_ARRAYS
+  JSValueRef exception = NULL;
+  JSContextRef ctx = context->priv->real;
+  JSObjectRef object = (JSObjectRef) value;
+  guint8 *data;
+  gsize byte_length;
+
+  switch (jscore_value_get_typed_array_type (context, value))
+    {
+    case JS_CORE_TYPED_ARRAY_NONE:
+      g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Value is not a typed array");
+      return NULL;
+    case JS_CORE_TYPED_ARRAY_ARRAY_BUFFER:
+      data = JSObjectGetArrayBufferBytesPtr (ctx, object, &exception);
+      byte_length = JSObjectGetArrayBufferByteLength (ctx, object, &exception);
+      break;
+    default:
+      /* The bytes pointer is the start of the underlying buffer */
+      data = JSObjectGetTypedArrayBytesPtr (ctx, object, &exception);
+      if (data)
+        data += JSObjectGetTypedArrayByteOffset (ctx, object, &exception);
+      byte_length = JSObjectGetTypedArrayByteLength (ctx, object, &exception);
+      break;
+    }
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return NULL;
+    }
+
+  if (length)
+    *length = byte_length;
+
+  return data;
+#else
+  g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_NOT_SUPPORTED,
+                       "JavaScriptCore was built without typed array support");
   return NULL;
+#endif
 }
 
+/* The returned GBytes keeps the value protected and must be released on
+ * the thread owning the context. */
+GBytes *
+jscore_value_to_bytes (JSCoreContext *context,
+                       JSCoreValue *value,
+                       GError **error)
+{
+  ProtectedBuffer *buffer;
+  GError *local_error = NULL;
+  gpointer data;
+  gsize length = 0;
+
+  JSCORE_CONTEXT_CHECK_THREAD (context);
+
+  data = jscore_value_get_typed_array_data (context, value, &length, &local_error);
+  if (local_error)
+    {
+      g_propagate_error (error, local_error);
+      return NULL;
+    }
+
+  buffer = g_slice_new (ProtectedBuffer);
+  buffer->context = JSGlobalContextRetain (context->priv->real);
+  buffer->value = (JSValueRef) value;
+  jscore_value_protect (buffer->context, buffer->value);
+
+  return g_bytes_new_with_free_func (data, length, protected_buffer_free, buffer);
+}
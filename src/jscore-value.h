@@ -23,7 +23,35 @@
 
 #include "jscore-context.h"
 
-typedef gpointer JSCoreValue;
+#include <gio/gio.h>
+
+#define JS_CORE_ERROR jscore_error_quark ()
+
+typedef enum {
+  JS_CORE_ERROR_FAILED,
+  JS_CORE_ERROR_NOT_SUPPORTED,
+  JS_CORE_ERROR_INVALID_ARGUMENT,
+  /* Stopped by the execution time limit */
+  JS_CORE_ERROR_TERMINATED,
+  JS_CORE_ERROR_EXCEPTION = 42
+} JSCoreError;
+
+/* Mirrors JSTypedArrayType */
+typedef enum {
+  JS_CORE_TYPED_ARRAY_INT8,
+  JS_CORE_TYPED_ARRAY_INT16,
+  JS_CORE_TYPED_ARRAY_INT32,
+  JS_CORE_TYPED_ARRAY_UINT8,
+  JS_CORE_TYPED_ARRAY_UINT8_CLAMPED,
+  JS_CORE_TYPED_ARRAY_UINT16,
+  JS_CORE_TYPED_ARRAY_UINT32,
+  JS_CORE_TYPED_ARRAY_FLOAT32,
+  JS_CORE_TYPED_ARRAY_FLOAT64,
+  JS_CORE_TYPED_ARRAY_ARRAY_BUFFER,
+  JS_CORE_TYPED_ARRAY_NONE
+} JSCoreTypedArrayType;
+
+GQuark jscore_error_quark (void);
 
 
 JSCoreValue *jscore_value_new_null (JSCoreContext *context);
@@ -53,8 +81,29 @@ gboolean jscore_value_is_object_of_class (JSCoreContext *context, JSCoreValue *v
 gboolean jscore_value_is_equal (JSCoreContext *context, JSCoreValue *value, JSCoreValue *value2);
 void jscore_value_ref (JSCoreContext *context, JSCoreValue *value);
 void jscore_value_unref (JSCoreContext *context, JSCoreValue *value);
+/* Values currently protected by the library for all contexts, including
+ * those held by wrappers and jscore_value_ref() */
+guint jscore_get_protect_count (void);
+/* Values protected by the library, with the backtraces of their
+ * protections in builds configured with --enable-debug */
+gchar *jscore_debug_dump_protected (void);
 
 
 JSCoreValue *jscore_value_new_variant (JSCoreContext *context, GVariant * gval, GError **error);
 GVariant *jscore_value_to_variant (JSCoreValue *value,JSCoreContext *context);
+
+/* Typed arrays: lengths are in bytes. The JS objects made from a pointer
+ * are views over that memory, nothing is copied and stores from scripts
+ * land in it. Arrays made from GBytes get a copy of the contents, which
+ * are immutable. Arrays made from a GMappedFile alias the mapping only
+ * when writable is TRUE, i.e. the file was mapped with
+ * g_mapped_file_new (..., TRUE, ...), whose pages are private to the
+ * process; read-only mappings are copied. */
+JSCoreValue *jscore_value_new_array_buffer (JSCoreContext *context, gpointer data, gsize length, GDestroyNotify destroy_notify, gpointer user_data, GError **error);
+JSCoreValue *jscore_value_new_typed_array (JSCoreContext *context, JSCoreTypedArrayType type, gpointer data, gsize length, GDestroyNotify destroy_notify, gpointer user_data, GError **error);
+JSCoreValue *jscore_value_new_typed_array_from_bytes (JSCoreContext *context, JSCoreTypedArrayType type, GBytes *bytes, GError **error);
+JSCoreValue *jscore_value_new_typed_array_from_mapped_file (JSCoreContext *context, JSCoreTypedArrayType type, GMappedFile *file, gboolean writable, GError **error);
+JSCoreTypedArrayType jscore_value_get_typed_array_type (JSCoreContext *context, JSCoreValue *value);
+gpointer jscore_value_get_typed_array_data (JSCoreContext *context, JSCoreValue *value, gsize *length, GError **error);
+GBytes *jscore_value_to_bytes (JSCoreContext *context, JSCoreValue *value, GError **error);
 #endif /* __JSCORE_VALUE_H__ */
@@ -0,0 +1,957 @@
+/*
+ * jscore-worker-pool.c - Source for JSCoreWorkerPool
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_SCHED_SETAFFINITY
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include "jscore-worker-pool.h"
+#include "jscore-serialize.h"
+#include "jscore-context-private.h"
+#include "jscore-value-private.h"
+
+#include <JavaScriptCore/JavaScript.h>
+
+/* Every worker thread owns a context in its own group, so workers never
+ * contend on a JSC lock. Jobs are pushed round-robin on per-worker queues;
+ * a worker pops from the head of its own queue and, when it runs dry,
+ * steals from the tail of the others before going to sleep. */
+
+G_DEFINE_TYPE (JSCoreWorkerPool, jscore_worker_pool, G_TYPE_OBJECT);
+
+static void jscore_worker_pool_dispose (GObject *object);
+static void jscore_worker_pool_finalize (GObject *object);
+
+typedef enum
+{
+  JOB_EVALUATE,
+  JOB_CALL,
+  JOB_MAP
+} JobKind;
+
+typedef struct
+{
+  JobKind kind;
+  gchar *source;
+  gchar *source_url;
+  GBytes *arguments;
+  GPtrArray *transfer;
+  GTask *task;
+
+  /* JOB_MAP: input[start, start + count) is chunk number chunk */
+  GVariant *input;
+  gsize start;
+  gsize count;
+  guint chunk;
+} Job;
+
+#define DEFAULT_CHUNK_SIZE 1024
+
+/* Sources attached from other threads cannot wake an idle worker, which
+ * looks at its main context at least this often */
+#define IDLE_POLL_MS 50
+
+typedef struct
+{
+  GVariant **chunks;
+  guint n_chunks;
+  guint remaining;
+  GError *error;
+} MapData;
+
+typedef struct
+{
+  JSCoreWorkerPool *pool;
+  guint index;
+  GThread *thread;
+
+  GMutex lock;
+  GQueue jobs;
+
+  /* Only touched from the worker thread */
+  GMainContext *main_context;
+  JSCoreContext *context;
+  GHashTable *functions;
+} Worker;
+
+struct _JSCoreWorkerPoolPrivate
+{
+  Worker *workers;
+  guint n_workers;
+  guint next_worker;
+  JSCoreWorkerPoolFlags flags;
+
+  JSCoreWorkerSetupFunc setup;
+  gpointer user_data;
+  GDestroyNotify destroy_notify;
+
+  /* Idle workers sleep on wakeup until pending is non zero or something
+   * is due on their main context */
+  GMutex idle_lock;
+  GCond wakeup;
+  gint pending;
+  gboolean shutdown;
+
+  gboolean dispose_has_run;
+};
+
+static void
+job_free (gpointer data)
+{
+  Job *job = data;
+
+  g_free (job->source);
+  g_free (job->source_url);
+  if (job->arguments)
+    g_bytes_unref (job->arguments);
+  if (job->transfer)
+    g_ptr_array_unref (job->transfer);
+  if (job->input)
+    g_variant_unref (job->input);
+  g_slice_free (Job, job);
+}
+
+static Job *
+worker_pop (Worker *worker)
+{
+  JSCoreWorkerPoolPrivate *priv = worker->pool->priv;
+  Worker *victim;
+  Job *job;
+  guint i;
+
+  g_mutex_lock (&worker->lock);
+  job = g_queue_pop_head (&worker->jobs);
+  g_mutex_unlock (&worker->lock);
+
+  for (i = 1; job == NULL && i < priv->n_workers; i++)
+    {
+      victim = &priv->workers[(worker->index + i) % priv->n_workers];
+
+      g_mutex_lock (&victim->lock);
+      job = g_queue_pop_tail (&victim->jobs);
+      g_mutex_unlock (&victim->lock);
+    }
+
+  if (job)
+    g_atomic_int_add (&priv->pending, -1);
+
+  return job;
+}
+
+static JSObjectRef
+worker_get_function (Worker *worker, const gchar *source, GError **error)
+{
+  JSContextRef ctx = worker->context->priv->real;
+  JSValueRef exception = NULL;
+  JSObjectRef function;
+  JSStringRef script;
+  gchar *expression;
+
+  function = g_hash_table_lookup (worker->functions, source);
+  if (function)
+    return function;
+
+  expression = g_strconcat ("(", source, "\n)", NULL);
+  script = JSStringCreateWithUTF8CString (expression);
+  function = (JSObjectRef) JSEvaluateScript (ctx, script, NULL, NULL, 1, &exception);
+  JSStringRelease (script);
+  g_free (expression);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, worker->context);
+      return NULL;
+    }
+
+  if (!JSValueIsObject (ctx, function) || !JSObjectIsFunction (ctx, function))
+    {
+      g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Source does not evaluate to a function");
+      return NULL;
+    }
+
+  jscore_value_protect (ctx, function);
+  g_hash_table_insert (worker->functions, g_strdup (source), function);
+
+  return function;
+}
+
+static JSValueRef
+worker_call (Worker *worker, Job *job, GError **error)
+{
+  JSContextRef ctx = worker->context->priv->real;
+  JSValueRef exception = NULL;
+  JSValueRef *arguments = NULL;
+  JSValueRef args = NULL;
+  JSObjectRef function;
+  JSValueRef result;
+  size_t n_arguments = 0;
+  JSStringRef name;
+  size_t i;
+
+  function = worker_get_function (worker, job->source, error);
+  if (function == NULL)
+    return NULL;
+
+  if (job->arguments)
+    {
+      args = (JSValueRef) jscore_value_deserialize (worker->context, job->arguments,
+                                                    job->transfer,
+                                                    JS_CORE_CLONE_NONE, error);
+      if (args == NULL)
+        return NULL;
+
+      if (!JSValueIsObject (ctx, args))
+        {
+          g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                               "Arguments must be serialized as an array");
+          return NULL;
+        }
+
+      name = JSStringCreateWithUTF8CString ("length");
+      n_arguments = (size_t) JSValueToNumber (ctx,
+                                              JSObjectGetProperty (ctx, (JSObjectRef) args,
+                                                                   name, NULL),
+                                              NULL);
+      JSStringRelease (name);
+
+      arguments = g_new (JSValueRef, MAX (n_arguments, 1));
+      for (i = 0; i < n_arguments; i++)
+        arguments[i] = JSObjectGetPropertyAtIndex (ctx, (JSObjectRef) args, i, NULL);
+    }
+
+  /* args is kept on the stack, so are the arguments it holds */
+  result = JSObjectCallAsFunction (ctx, function, NULL, n_arguments, arguments,
+                                   &exception);
+  g_free (arguments);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, worker->context);
+      return NULL;
+    }
+
+  return result;
+}
+
+static GVariant *
+worker_map (Worker *worker, Job *job, GError **error)
+{
+  JSContextRef ctx = worker->context->priv->real;
+  JSValueRef exception = NULL;
+  JSValueRef arguments[2];
+  GVariantBuilder builder;
+  JSObjectRef function;
+  JSValueRef result;
+  GVariant *element;
+  GVariant *mapped;
+  gsize i;
+
+  function = worker_get_function (worker, job->source, error);
+  if (function == NULL)
+    return NULL;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+
+  for (i = job->start; i < job->start + job->count; i++)
+    {
+      element = g_variant_get_child_value (job->input, i);
+      arguments[0] = (JSValueRef) jscore_value_new_variant (worker->context, element, NULL);
+      g_variant_unref (element);
+
+      if (arguments[0] == NULL)
+        arguments[0] = JSValueMakeUndefined (ctx);
+      arguments[1] = JSValueMakeNumber (ctx, i);
+
+      result = JSObjectCallAsFunction (ctx, function, NULL, 2, arguments, &exception);
+      if (exception)
+        {
+          set_error_from_js_exception (error, exception, worker->context);
+          g_variant_builder_clear (&builder);
+          return NULL;
+        }
+
+      mapped = jscore_value_to_variant ((JSCoreValue *) result, worker->context);
+      if (mapped == NULL)
+        mapped = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+      g_variant_builder_add (&builder, "v", mapped);
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+worker_run (Worker *worker, Job *job)
+{
+  GError *error = NULL;
+  JSCoreValue *result = NULL;
+  GBytes *bytes = NULL;
+  GVariant *mapped;
+
+  if (g_task_return_error_if_cancelled (job->task))
+    return;
+
+  if (job->kind == JOB_MAP)
+    {
+      mapped = worker_map (worker, job, &error);
+      if (mapped)
+        g_task_return_pointer (job->task, mapped, (GDestroyNotify) g_variant_unref);
+      else
+        g_task_return_error (job->task, error);
+      return;
+    }
+
+  switch (job->kind)
+    {
+    case JOB_EVALUATE:
+      result = jscore_context_evaluate_script (worker->context, job->source,
+                                               job->source_url, 1, &error);
+      break;
+    case JOB_CALL:
+      result = (JSCoreValue *) worker_call (worker, job, &error);
+      break;
+    case JOB_MAP:
+      break;
+    }
+
+  if (result)
+    bytes = jscore_value_serialize (worker->context, result, NULL, &error);
+
+  if (bytes)
+    g_task_return_pointer (job->task, bytes, (GDestroyNotify) g_bytes_unref);
+  else
+    g_task_return_error (job->task, error);
+}
+
+static void
+worker_pin (Worker *worker)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+  cpu_set_t set;
+
+  CPU_ZERO (&set);
+  CPU_SET (worker->index % g_get_num_processors (), &set);
+
+  if (sched_setaffinity (0, sizeof (set), &set) != 0)
+    g_warning ("Could not pin worker %u to a CPU", worker->index);
+#endif
+}
+
+static gboolean
+release_task (gpointer data)
+{
+  g_object_unref (data);
+  return G_SOURCE_REMOVE;
+}
+
+/* The task may hold the last reference on the pool, which must not be
+ * dropped from one of the threads the pool joins. */
+static void
+worker_release_task (GTask *task)
+{
+  GSource *source = g_idle_source_new ();
+
+  g_source_set_callback (source, release_task, task, NULL);
+  g_source_attach (source, g_task_get_context (task));
+  g_source_unref (source);
+}
+
+/* Dispatches whatever is due on the worker's main context, timers and
+ * promise jobs of its context among them, without blocking. Returns the
+ * time in ms until something else is due, -1 when nothing is scheduled. */
+static gint
+worker_iterate (Worker *worker)
+{
+  GMainContext *main_context = worker->main_context;
+  gint priority, timeout;
+
+  while (g_main_context_iteration (main_context, FALSE))
+    ;
+
+  g_main_context_acquire (main_context);
+  g_main_context_prepare (main_context, &priority);
+  g_main_context_query (main_context, priority, &timeout, NULL, 0);
+  if (g_main_context_check (main_context, priority, NULL, 0))
+    g_main_context_dispatch (main_context);
+  g_main_context_release (main_context);
+
+  return timeout;
+}
+
+static gpointer
+worker_thread (gpointer data)
+{
+  Worker *worker = data;
+  JSCoreWorkerPoolPrivate *priv = worker->pool->priv;
+  GHashTableIter iter;
+  gpointer function;
+  GTask *task;
+  Job *job;
+  gint timeout;
+
+  if (priv->flags & JS_CORE_WORKER_POOL_PIN_THREADS)
+    worker_pin (worker);
+
+  /* The group of the context takes the thread default as its owner */
+  worker->main_context = g_main_context_new ();
+  g_main_context_push_thread_default (worker->main_context);
+
+  worker->context = jscore_context_new_in_group (NULL, NULL);
+  worker->functions = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, NULL);
+
+  if (priv->setup)
+    priv->setup (worker->context, worker->index, priv->user_data);
+
+  for (;;)
+    {
+      job = worker_pop (worker);
+      if (job)
+        {
+          /* The job is freed along with the task */
+          task = job->task;
+          worker_run (worker, job);
+          worker_release_task (task);
+          worker_iterate (worker);
+          continue;
+        }
+
+      timeout = worker_iterate (worker);
+      if (timeout < 0 || timeout > IDLE_POLL_MS)
+        timeout = IDLE_POLL_MS;
+
+      g_mutex_lock (&priv->idle_lock);
+      if (g_atomic_int_get (&priv->pending) == 0 && !priv->shutdown)
+        g_cond_wait_until (&priv->wakeup, &priv->idle_lock,
+                           g_get_monotonic_time () +
+                           timeout * G_TIME_SPAN_MILLISECOND);
+
+      if (priv->shutdown && g_atomic_int_get (&priv->pending) == 0)
+        {
+          g_mutex_unlock (&priv->idle_lock);
+          break;
+        }
+      g_mutex_unlock (&priv->idle_lock);
+    }
+
+  g_hash_table_iter_init (&iter, worker->functions);
+  while (g_hash_table_iter_next (&iter, NULL, &function))
+    jscore_value_unprotect (worker->context->priv->real, function);
+  g_hash_table_destroy (worker->functions);
+
+  g_object_unref (worker->context);
+
+  g_main_context_pop_thread_default (worker->main_context);
+  g_main_context_unref (worker->main_context);
+
+  return NULL;
+}
+
+static void
+pool_submit (JSCoreWorkerPool *pool, Job *job)
+{
+  JSCoreWorkerPoolPrivate *priv = pool->priv;
+  Worker *worker;
+
+  worker = &priv->workers[(guint) g_atomic_int_add ((gint *) &priv->next_worker, 1)
+                          % priv->n_workers];
+
+  g_mutex_lock (&worker->lock);
+  g_queue_push_tail (&worker->jobs, job);
+  g_mutex_unlock (&worker->lock);
+
+  g_atomic_int_inc (&priv->pending);
+
+  g_mutex_lock (&priv->idle_lock);
+  g_cond_signal (&priv->wakeup);
+  g_mutex_unlock (&priv->idle_lock);
+}
+
+static Job *
+job_new (JSCoreWorkerPool *pool,
+         JobKind kind,
+         const gchar *source,
+         GCancellable *cancellable,
+         GAsyncReadyCallback callback,
+         gpointer user_data,
+         gpointer source_tag)
+{
+  Job *job = g_slice_new0 (Job);
+
+  job->kind = kind;
+  job->source = g_strdup (source);
+  job->task = g_task_new (pool, cancellable, callback, user_data);
+  g_task_set_source_tag (job->task, source_tag);
+  g_task_set_task_data (job->task, job, job_free);
+
+  return job;
+}
+
+void
+jscore_worker_pool_evaluate_async (JSCoreWorkerPool *pool,
+                                   const gchar *script,
+                                   const gchar *source_url,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+  Job *job;
+
+  g_return_if_fail (IS_JSCORE_WORKER_POOL (pool));
+  g_return_if_fail (script != NULL);
+
+  job = job_new (pool, JOB_EVALUATE, script, cancellable, callback, user_data,
+                 jscore_worker_pool_evaluate_async);
+  job->source_url = g_strdup (source_url);
+
+  pool_submit (pool, job);
+}
+
+GBytes *
+jscore_worker_pool_evaluate_finish (JSCoreWorkerPool *pool,
+                                    GAsyncResult *result,
+                                    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, pool), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+void
+jscore_worker_pool_call_async (JSCoreWorkerPool *pool,
+                               const gchar *function_source,
+                               GBytes *arguments,
+                               GPtrArray *transfer,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data)
+{
+  Job *job;
+
+  g_return_if_fail (IS_JSCORE_WORKER_POOL (pool));
+  g_return_if_fail (function_source != NULL);
+
+  job = job_new (pool, JOB_CALL, function_source, cancellable, callback,
+                 user_data, jscore_worker_pool_call_async);
+  if (arguments)
+    job->arguments = g_bytes_ref (arguments);
+  if (transfer)
+    job->transfer = g_ptr_array_ref (transfer);
+
+  pool_submit (pool, job);
+}
+
+GBytes *
+jscore_worker_pool_call_finish (JSCoreWorkerPool *pool,
+                                GAsyncResult *result,
+                                GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, pool), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+map_data_free (gpointer user_data)
+{
+  MapData *data = user_data;
+  guint i;
+
+  for (i = 0; i < data->n_chunks; i++)
+    if (data->chunks[i])
+      g_variant_unref (data->chunks[i]);
+  g_free (data->chunks);
+  g_clear_error (&data->error);
+  g_slice_free (MapData, data);
+}
+
+static GVariant *
+map_data_merge (MapData *data)
+{
+  GVariantBuilder builder;
+  GVariant *child;
+  gsize n, i;
+  guint c;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+  for (c = 0; c < data->n_chunks; c++)
+    {
+      n = g_variant_n_children (data->chunks[c]);
+      for (i = 0; i < n; i++)
+        {
+          child = g_variant_get_child_value (data->chunks[c], i);
+          g_variant_builder_add_value (&builder, child);
+          g_variant_unref (child);
+        }
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+map_chunk_done (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  GTask *task = user_data;
+  MapData *data = g_task_get_task_data (task);
+  Job *job = g_task_get_task_data (G_TASK (result));
+  GError *error = NULL;
+  GVariant *chunk;
+
+  chunk = g_task_propagate_pointer (G_TASK (result), &error);
+  if (chunk)
+    data->chunks[job->chunk] = chunk;
+  else if (data->error == NULL)
+    data->error = error;
+  else
+    g_error_free (error);
+
+  if (--data->remaining > 0)
+    return;
+
+  if (data->error)
+    {
+      g_task_return_error (task, data->error);
+      data->error = NULL;
+    }
+  else
+    g_task_return_pointer (task, map_data_merge (data),
+                           (GDestroyNotify) g_variant_unref);
+
+  g_object_unref (task);
+}
+
+void
+jscore_worker_pool_map_async (JSCoreWorkerPool *pool,
+                              const gchar *function_source,
+                              GVariant *input,
+                              guint chunk_size,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback,
+                              gpointer user_data)
+{
+  GTask *task;
+  MapData *data;
+  Job *job;
+  gsize n;
+  guint i;
+
+  g_return_if_fail (IS_JSCORE_WORKER_POOL (pool));
+  g_return_if_fail (function_source != NULL);
+  g_return_if_fail (input != NULL && g_variant_is_container (input));
+
+  if (chunk_size == 0)
+    chunk_size = DEFAULT_CHUNK_SIZE;
+
+  task = g_task_new (pool, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jscore_worker_pool_map_async);
+
+  n = g_variant_n_children (input);
+  if (n == 0)
+    {
+      g_task_return_pointer (task,
+                             g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_VARIANT,
+                                                                      NULL, 0)),
+                             (GDestroyNotify) g_variant_unref);
+      g_object_unref (task);
+      return;
+    }
+
+  data = g_slice_new0 (MapData);
+  data->n_chunks = (n + chunk_size - 1) / chunk_size;
+  data->chunks = g_new0 (GVariant *, data->n_chunks);
+  data->remaining = data->n_chunks;
+  g_task_set_task_data (task, data, map_data_free);
+
+  g_variant_ref_sink (input);
+
+  for (i = 0; i < data->n_chunks; i++)
+    {
+      job = job_new (pool, JOB_MAP, function_source, cancellable,
+                     map_chunk_done, task, jscore_worker_pool_map_async);
+      job->input = g_variant_ref (input);
+      job->start = (gsize) i * chunk_size;
+      job->count = MIN (chunk_size, n - job->start);
+      job->chunk = i;
+
+      pool_submit (pool, job);
+    }
+
+  g_variant_unref (input);
+}
+
+GVariant *
+jscore_worker_pool_map_finish (JSCoreWorkerPool *pool,
+                               GAsyncResult *result,
+                               GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, pool), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+sync_ready (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  GAsyncResult **result_out = user_data;
+
+  *result_out = g_object_ref (result);
+}
+
+GVariant *
+jscore_parallel_map (const gchar *function_source,
+                     GVariant *input,
+                     guint chunk_size,
+                     guint n_workers,
+                     GError **error)
+{
+  GMainContext *main_context = g_main_context_new ();
+  GAsyncResult *result = NULL;
+  JSCoreWorkerPool *pool;
+  GVariant *output;
+
+  g_main_context_push_thread_default (main_context);
+
+  pool = jscore_worker_pool_new (n_workers, JS_CORE_WORKER_POOL_NONE,
+                                 NULL, NULL, NULL);
+  jscore_worker_pool_map_async (pool, function_source, input, chunk_size,
+                                NULL, sync_ready, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (main_context, TRUE);
+
+  output = jscore_worker_pool_map_finish (pool, result, error);
+  g_object_unref (result);
+
+  /* Tasks are released from this context, the pool goes with the last */
+  g_object_add_weak_pointer (G_OBJECT (pool), (gpointer *) &pool);
+  g_object_unref (pool);
+  while (pool)
+    g_main_context_iteration (main_context, TRUE);
+
+  g_main_context_pop_thread_default (main_context);
+  g_main_context_unref (main_context);
+
+  return output;
+}
+
+JSCoreValue *
+jscore_parallel_map_reduce (JSCoreContext *context,
+                            const gchar *map_source,
+                            const gchar *reduce_source,
+                            GVariant *input,
+                            guint chunk_size,
+                            guint n_workers,
+                            GError **error)
+{
+  JSContextRef ctx = context->priv->real;
+  JSValueRef exception = NULL;
+  JSValueRef arguments[2];
+  JSValueRef accumulator;
+  JSValueRef reduce;
+  GVariant *mapped;
+  GVariant *child;
+  JSStringRef script;
+  gchar *expression;
+  gsize n, i;
+
+  g_return_val_if_fail (IS_JSCORE_CONTEXT (context), NULL);
+  g_return_val_if_fail (reduce_source != NULL, NULL);
+
+  expression = g_strconcat ("(", reduce_source, "\n)", NULL);
+  script = JSStringCreateWithUTF8CString (expression);
+  reduce = JSEvaluateScript (ctx, script, NULL, NULL, 1, &exception);
+  JSStringRelease (script);
+  g_free (expression);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return NULL;
+    }
+
+  if (!JSValueIsObject (ctx, reduce) || !JSObjectIsFunction (ctx, (JSObjectRef) reduce))
+    {
+      g_set_error_literal (error, JS_CORE_ERROR, JS_CORE_ERROR_INVALID_ARGUMENT,
+                           "Reduce source does not evaluate to a function");
+      return NULL;
+    }
+
+  mapped = jscore_parallel_map (map_source, input, chunk_size, n_workers, error);
+  if (mapped == NULL)
+    return NULL;
+
+  /* Same as Array.prototype.reduce without an initial value */
+  accumulator = JSValueMakeUndefined (ctx);
+  n = g_variant_n_children (mapped);
+  for (i = 0; i < n && !exception; i++)
+    {
+      child = g_variant_get_child_value (mapped, i);
+      arguments[1] = (JSValueRef) jscore_value_new_variant (context, child, NULL);
+      g_variant_unref (child);
+
+      if (arguments[1] == NULL)
+        arguments[1] = JSValueMakeUndefined (ctx);
+
+      if (i == 0)
+        {
+          accumulator = arguments[1];
+          continue;
+        }
+
+      arguments[0] = accumulator;
+      accumulator = JSObjectCallAsFunction (ctx, (JSObjectRef) reduce, NULL, 2,
+                                            arguments, &exception);
+    }
+
+  g_variant_unref (mapped);
+
+  if (exception)
+    {
+      set_error_from_js_exception (error, exception, context);
+      return NULL;
+    }
+
+  return (JSCoreValue *) accumulator;
+}
+
+guint
+jscore_worker_pool_get_n_workers (JSCoreWorkerPool *pool)
+{
+  g_return_val_if_fail (IS_JSCORE_WORKER_POOL (pool), 0);
+
+  return pool->priv->n_workers;
+}
+
+JSCoreWorkerPool *
+jscore_worker_pool_new (guint n_workers,
+                        JSCoreWorkerPoolFlags flags,
+                        JSCoreWorkerSetupFunc setup,
+                        gpointer user_data,
+                        GDestroyNotify destroy_notify)
+{
+  JSCoreWorkerPool *pool = g_object_new (JSCORE_TYPE_WORKER_POOL, NULL);
+  JSCoreWorkerPoolPrivate *priv = pool->priv;
+  Worker *worker;
+  gchar *name;
+  guint i;
+
+  if (n_workers == 0)
+    n_workers = g_get_num_processors ();
+
+  priv->n_workers = n_workers;
+  priv->flags = flags;
+  priv->setup = setup;
+  priv->user_data = user_data;
+  priv->destroy_notify = destroy_notify;
+  priv->workers = g_new0 (Worker, n_workers);
+
+  for (i = 0; i < n_workers; i++)
+    {
+      worker = &priv->workers[i];
+      worker->pool = pool;
+      worker->index = i;
+      g_mutex_init (&worker->lock);
+      g_queue_init (&worker->jobs);
+    }
+
+  /* Queues must all exist before any worker tries to steal */
+  for (i = 0; i < n_workers; i++)
+    {
+      name = g_strdup_printf ("jscore-worker-%u", i);
+      priv->workers[i].thread = g_thread_new (name, worker_thread, &priv->workers[i]);
+      g_free (name);
+    }
+
+  return pool;
+}
+
+static void
+jscore_worker_pool_class_init (JSCoreWorkerPoolClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (JSCoreWorkerPoolPrivate));
+
+  gobject_class->dispose = jscore_worker_pool_dispose;
+  gobject_class->finalize = jscore_worker_pool_finalize;
+}
+
+static void
+jscore_worker_pool_init (JSCoreWorkerPool *self)
+{
+  JSCoreWorkerPoolPrivate *priv =
+      G_TYPE_INSTANCE_GET_PRIVATE (self, JSCORE_TYPE_WORKER_POOL,
+                                   JSCoreWorkerPoolPrivate);
+
+  self->priv = priv;
+  priv->workers = NULL;
+  priv->n_workers = 0;
+  priv->next_worker = 0;
+  g_mutex_init (&priv->idle_lock);
+  g_cond_init (&priv->wakeup);
+  priv->pending = 0;
+  priv->shutdown = FALSE;
+  priv->dispose_has_run = FALSE;
+}
+
+static void
+jscore_worker_pool_dispose (GObject *object)
+{
+  JSCoreWorkerPool *self = (JSCoreWorkerPool *) object;
+  JSCoreWorkerPoolPrivate *priv = self->priv;
+  guint i;
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  /* Tasks hold a reference on the pool, so no job is left by now */
+  g_mutex_lock (&priv->idle_lock);
+  priv->shutdown = TRUE;
+  g_cond_broadcast (&priv->wakeup);
+  g_mutex_unlock (&priv->idle_lock);
+
+  for (i = 0; i < priv->n_workers; i++)
+    g_thread_join (priv->workers[i].thread);
+
+  if (priv->destroy_notify)
+    priv->destroy_notify (priv->user_data);
+
+  G_OBJECT_CLASS (jscore_worker_pool_parent_class)->dispose (object);
+}
+
+static void
+jscore_worker_pool_finalize (GObject *object)
+{
+  JSCoreWorkerPool *self = (JSCoreWorkerPool *) object;
+  JSCoreWorkerPoolPrivate *priv = self->priv;
+  guint i;
+
+  for (i = 0; i < priv->n_workers; i++)
+    g_mutex_clear (&priv->workers[i].lock);
+  g_free (priv->workers);
+
+  g_mutex_clear (&priv->idle_lock);
+  g_cond_clear (&priv->wakeup);
+
+  G_OBJECT_CLASS (jscore_worker_pool_parent_class)->finalize (object);
+}
@@ -0,0 +1,104 @@
+/*
+ * jscore-worker-pool.h - Header for JSCoreWorkerPool
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __JSCORE_WORKER_POOL_H__
+#define __JSCORE_WORKER_POOL_H__
+
+#include "jscore-value.h"
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define JSCORE_TYPE_WORKER_POOL                 \
+  (jscore_worker_pool_get_type())
+#define JSCORE_WORKER_POOL(obj)                                 \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj),                           \
+                               JSCORE_TYPE_WORKER_POOL,         \
+                               JSCoreWorkerPool))
+#define JSCORE_WORKER_POOL_CLASS(klass)                 \
+  (G_TYPE_CHECK_CLASS_CAST ((klass),                    \
+                            JSCORE_TYPE_WORKER_POOL,    \
+                            JSCoreWorkerPoolClass))
+#define IS_JSCORE_WORKER_POOL(obj)                              \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj),                           \
+                               JSCORE_TYPE_WORKER_POOL))
+#define IS_JSCORE_WORKER_POOL_CLASS(klass)              \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass),                    \
+                            JSCORE_TYPE_WORKER_POOL))
+#define JSCORE_WORKER_POOL_GET_CLASS(obj)                       \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj),                            \
+                              JSCORE_TYPE_WORKER_POOL,          \
+                              JSCoreWorkerPoolClass))
+
+typedef struct _JSCoreWorkerPool      JSCoreWorkerPool;
+typedef struct _JSCoreWorkerPoolClass JSCoreWorkerPoolClass;
+typedef struct _JSCoreWorkerPoolPrivate JSCoreWorkerPoolPrivate;
+
+typedef enum {
+  JS_CORE_WORKER_POOL_NONE = 0,
+  /* Bind worker n to CPU n, where the platform allows it */
+  JS_CORE_WORKER_POOL_PIN_THREADS = 1 << 0
+} JSCoreWorkerPoolFlags;
+
+/* Runs on each worker thread once its context exists, before any job */
+typedef void
+(*JSCoreWorkerSetupFunc) (JSCoreContext *context, guint worker, gpointer user_data);
+
+struct _JSCoreWorkerPoolClass
+{
+  GObjectClass parent_class;
+};
+
+struct _JSCoreWorkerPool
+{
+  GObject parent;
+  JSCoreWorkerPoolPrivate *priv;
+};
+
+GType jscore_worker_pool_get_type (void) G_GNUC_CONST;
+
+/* n_workers == 0 means one per processor */
+JSCoreWorkerPool *jscore_worker_pool_new (guint n_workers, JSCoreWorkerPoolFlags flags, JSCoreWorkerSetupFunc setup, gpointer user_data, GDestroyNotify destroy_notify);
+guint jscore_worker_pool_get_n_workers (JSCoreWorkerPool *pool);
+
+/* Results come back serialized, see jscore_value_deserialize() */
+void jscore_worker_pool_evaluate_async (JSCoreWorkerPool *pool, const gchar *script, const gchar *source_url, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+GBytes *jscore_worker_pool_evaluate_finish (JSCoreWorkerPool *pool, GAsyncResult *result, GError **error);
+
+/* function_source is an expression evaluating to a function, compiled once
+ * per worker. arguments is a serialized array, or NULL for no arguments. */
+void jscore_worker_pool_call_async (JSCoreWorkerPool *pool, const gchar *function_source, GBytes *arguments, GPtrArray *transfer, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+GBytes *jscore_worker_pool_call_finish (JSCoreWorkerPool *pool, GAsyncResult *result, GError **error);
+
+/* Calls function (element, index) on every element of the input array, in
+ * jobs of chunk_size elements. The result is an av in input order, with
+ * an empty maybe for results that have no variant form. */
+void jscore_worker_pool_map_async (JSCoreWorkerPool *pool, const gchar *function_source, GVariant *input, guint chunk_size, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+GVariant *jscore_worker_pool_map_finish (JSCoreWorkerPool *pool, GAsyncResult *result, GError **error);
+
+/* Blocking versions over a temporary pool. The reduce function is called
+ * as reduce (accumulator, result) in context, on the calling thread. */
+GVariant *jscore_parallel_map (const gchar *function_source, GVariant *input, guint chunk_size, guint n_workers, GError **error);
+JSCoreValue *jscore_parallel_map_reduce (JSCoreContext *context, const gchar *map_source, const gchar *reduce_source, GVariant *input, guint chunk_size, guint n_workers, GError **error);
+
+G_END_DECLS
+
+#endif /* __JSCORE_WORKER_POOL_H__ */
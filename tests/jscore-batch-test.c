@@ -0,0 +1,80 @@
+/*
+ * jscore-batch-test.c - Tests for jscore_context_evaluate_batch()
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <glib.h>
+
+#include "jscore-context.h"
+#include "jscore-exception.h"
+#include "jscore-value.h"
+
+/* A source that does not compile must not take the rest of the batch
+ * down with it */
+static void
+test_batch_bad_source (void)
+{
+  const gchar *sources[] = { "1 + 1", "1 +", "2 * 3" };
+  JSCoreValue *results[G_N_ELEMENTS (sources)];
+  JSCoreException *errors[G_N_ELEMENTS (sources)];
+  JSCoreContext *context = jscore_context_new ();
+  GError *error = NULL;
+  gboolean ok;
+
+  ok = jscore_context_evaluate_batch (context, sources, G_N_ELEMENTS (sources),
+                                      results, errors, &error);
+  g_assert (!ok);
+  g_assert_no_error (error);
+
+  g_assert (results[0] != NULL);
+  g_assert (errors[0] == NULL);
+  g_assert_cmpfloat (jscore_value_get_number (context, results[0]), ==, 2);
+
+  g_assert (results[1] == NULL);
+  g_assert (errors[1] != NULL);
+  g_assert (jscore_exception_get_message (errors[1]) != NULL);
+
+  g_assert (results[2] != NULL);
+  g_assert (errors[2] == NULL);
+  g_assert_cmpfloat (jscore_value_get_number (context, results[2]), ==, 6);
+
+  jscore_value_unref (context, results[0]);
+  jscore_value_unref (context, results[2]);
+  jscore_exception_unref (errors[1]);
+
+  /* Again without errors, the exception is dropped rather than leaked */
+  ok = jscore_context_evaluate_batch (context, sources, G_N_ELEMENTS (sources),
+                                      results, NULL, &error);
+  g_assert (!ok);
+  g_assert_no_error (error);
+  g_assert (results[1] == NULL);
+
+  jscore_value_unref (context, results[0]);
+  jscore_value_unref (context, results[2]);
+  g_object_unref (context);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/batch/bad-source", test_batch_bad_source);
+
+  return g_test_run ();
+}
@@ -0,0 +1,351 @@
+/*
+ * jscore-replay.c - Replays traces of the boundary traffic recorder
+ *
+ * Copyright (C) 2010 Igalia S.L.
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <JavaScriptCore/JavaScript.h>
+
+#include "jscore-context.h"
+#include "jscore-class.h"
+#include "jscore-object.h"
+#include "jscore-recorder.h"
+#include "jscore-value.h"
+
+#define N_KINDS (JS_CORE_RECORD_PROPERTY_SET + 1)
+
+static const gchar *kind_names[N_KINDS] =
+{
+  NULL, "evaluate", "callback", "property_get", "property_set"
+};
+
+typedef struct
+{
+  guint64 count;
+  guint64 errors;
+  guint64 recorded_ns;
+  guint64 replayed_ns;
+} Category;
+
+typedef struct
+{
+  const guint8 *data;
+  gsize length;
+  gsize offset;
+} Reader;
+
+typedef struct
+{
+  JSCoreContext *context;
+  JSCoreClass *klass;
+  JSCoreObject *target;
+  /* name -> stub native function */
+  GHashTable *stubs;
+} Replay;
+
+static gint repeat = 1;
+static gboolean json = FALSE;
+
+static GOptionEntry entries[] =
+{
+  { "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat, "Replay the trace N times", "N" },
+  { "json", 'j', 0, G_OPTION_ARG_NONE, &json, "Report as JSON", NULL },
+  { NULL }
+};
+
+static guint64
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static gboolean
+read_varint (Reader *reader, guint64 *value)
+{
+  guint shift = 0;
+
+  *value = 0;
+  while (reader->offset < reader->length && shift < 64)
+    {
+      guint8 byte = reader->data[reader->offset++];
+
+      *value |= (guint64) (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return TRUE;
+      shift += 7;
+    }
+
+  return FALSE;
+}
+
+/* Points into the trace, not nul-terminated */
+static gboolean
+read_bytes (Reader *reader, const guint8 **data, gsize *length)
+{
+  guint64 n;
+
+  if (!read_varint (reader, &n) || n > reader->length - reader->offset)
+    return FALSE;
+
+  *data = reader->data + reader->offset;
+  *length = n;
+  reader->offset += n;
+
+  return TRUE;
+}
+
+static gchar *
+read_string (Reader *reader)
+{
+  const guint8 *data;
+  gsize length;
+
+  if (!read_bytes (reader, &data, &length))
+    return NULL;
+
+  return g_strndup ((const gchar *) data, length);
+}
+
+static JSCoreValue *
+value_of_type (Replay *replay, guint64 type)
+{
+  switch (type)
+    {
+    case kJSTypeNull:
+      return jscore_value_new_null (replay->context);
+    case kJSTypeBoolean:
+      return jscore_value_new_boolean (replay->context, TRUE);
+    case kJSTypeNumber:
+      return jscore_value_new_number (replay->context, 1);
+    case kJSTypeString:
+      return jscore_value_new_string (replay->context, "x");
+    case kJSTypeObject:
+      return jscore_context_evaluate_script (replay->context, "({})", NULL, 1, NULL);
+    default:
+      return jscore_value_new_undefined (replay->context);
+    }
+}
+
+static JSCoreObject *
+lookup_stub (Replay *replay, const gchar *name)
+{
+  JSCoreObject *stub = g_hash_table_lookup (replay->stubs, name);
+
+  if (stub == NULL)
+    {
+      stub = jscore_object_new_from_function_with_callback (replay->context, (gchar *) name);
+      g_hash_table_insert (replay->stubs, g_strdup (name), stub);
+    }
+
+  return stub;
+}
+
+/* Runs the record at the reader, FALSE on a truncated or invalid one */
+static gboolean
+replay_record (Replay *replay, Reader *reader, Category *categories)
+{
+  GError *error = NULL;
+  guint64 time_us, duration, start, type;
+  guint8 kind;
+  gchar *name = NULL, *script = NULL, *type_string = NULL;
+  const guint8 *data;
+  gsize length;
+  GVariant *arguments;
+  GBytes *bytes;
+  gboolean valid = FALSE;
+
+  kind = reader->data[reader->offset++];
+  if (kind == 0 || kind >= N_KINDS ||
+      !read_varint (reader, &time_us) || !read_varint (reader, &duration))
+    return FALSE;
+
+  switch (kind)
+    {
+    case JS_CORE_RECORD_EVALUATE:
+      if (!(name = read_string (reader)) || !(script = read_string (reader)))
+        break;
+      start = now_ns ();
+      jscore_context_evaluate_script (replay->context, script, *name ? name : NULL, 1, &error);
+      categories[kind].replayed_ns += now_ns () - start;
+      valid = TRUE;
+      break;
+
+    case JS_CORE_RECORD_CALLBACK:
+      if (!(name = read_string (reader)) || !(type_string = read_string (reader)) ||
+          !read_bytes (reader, &data, &length) ||
+          !g_variant_type_string_is_valid (type_string))
+        break;
+      /* Copied, as variant data must be aligned */
+      bytes = g_bytes_new (data, length);
+      arguments = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (type_string),
+                                                                bytes, FALSE));
+      g_bytes_unref (bytes);
+      start = now_ns ();
+      jscore_object_call_as_function (lookup_stub (replay, name), NULL, arguments, &error);
+      categories[kind].replayed_ns += now_ns () - start;
+      g_variant_unref (arguments);
+      valid = TRUE;
+      break;
+
+    case JS_CORE_RECORD_PROPERTY_GET:
+    case JS_CORE_RECORD_PROPERTY_SET:
+      if (!(name = read_string (reader)) || !read_varint (reader, &type))
+        break;
+      if (kind == JS_CORE_RECORD_PROPERTY_SET)
+        {
+          JSCoreValue *value = value_of_type (replay, type);
+
+          start = now_ns ();
+          jscore_object_set_property (replay->target, name, value,
+                                      JS_CORE_PROPERTY_ATTRIBUTE_NONE, &error);
+        }
+      else
+        {
+          start = now_ns ();
+          jscore_object_get_property (replay->target, name, &error);
+        }
+      categories[kind].replayed_ns += now_ns () - start;
+      valid = TRUE;
+      break;
+    }
+
+  if (valid)
+    {
+      categories[kind].count++;
+      categories[kind].recorded_ns += duration;
+      if (error)
+        categories[kind].errors++;
+    }
+
+  g_clear_error (&error);
+  g_free (name);
+  g_free (script);
+  g_free (type_string);
+
+  return valid;
+}
+
+static void
+report (Category *categories, guint64 n_records)
+{
+  guint i;
+
+  if (json)
+    {
+      g_print ("{\"records\": %" G_GUINT64_FORMAT ", \"repeat\": %d, \"categories\": {", n_records, repeat);
+      for (i = 1; i < N_KINDS; i++)
+        g_print ("%s\n  \"%s\": {\"count\": %" G_GUINT64_FORMAT ", \"errors\": %" G_GUINT64_FORMAT
+                 ", \"recorded_ns\": %" G_GUINT64_FORMAT ", \"replayed_ns\": %" G_GUINT64_FORMAT "}",
+                 i > 1 ? "," : "", kind_names[i], categories[i].count, categories[i].errors,
+                 categories[i].recorded_ns, categories[i].replayed_ns);
+      g_print ("\n}}\n");
+      return;
+    }
+
+  g_print ("%-14s %10s %8s %14s %14s %12s\n", "category", "count", "errors",
+           "recorded ms", "replayed ms", "replayed/op");
+  for (i = 1; i < N_KINDS; i++)
+    g_print ("%-14s %10" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %14.3f %14.3f %9.3f us\n",
+             kind_names[i], categories[i].count, categories[i].errors,
+             categories[i].recorded_ns / 1e6, categories[i].replayed_ns / 1e6,
+             categories[i].count ? categories[i].replayed_ns / 1e3 / categories[i].count : 0.0);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *options;
+  GError *error = NULL;
+  Category categories[N_KINDS];
+  Replay replay;
+  Reader reader;
+  gchar *contents;
+  gsize length, header = strlen (JS_CORE_TRACE_MAGIC) + 1;
+  guint64 n_records = 0;
+  gint i;
+
+  options = g_option_context_new ("TRACE - replay a javascriptcore-gobject trace");
+  g_option_context_add_main_entries (options, entries, NULL);
+  if (!g_option_context_parse (options, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+  g_option_context_free (options);
+
+  if (argc != 2)
+    {
+      g_printerr ("Usage: %s [OPTION...] TRACE\n", argv[0]);
+      return 1;
+    }
+
+  if (!g_file_get_contents (argv[1], &contents, &length, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  if (length < header || memcmp (contents, JS_CORE_TRACE_MAGIC, header - 1) != 0 ||
+      contents[header - 1] != JS_CORE_TRACE_VERSION)
+    {
+      g_printerr ("%s is not a version %d trace\n", argv[1], JS_CORE_TRACE_VERSION);
+      g_free (contents);
+      return 1;
+    }
+
+  memset (categories, 0, sizeof (categories));
+  replay.context = jscore_context_new ();
+  replay.klass = jscore_class_new ((const JSCoreClassDefinition *) &kJSClassDefinitionEmpty);
+  replay.target = jscore_object_new (replay.context, replay.klass, NULL);
+  replay.stubs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+  for (i = 0; i < MAX (repeat, 1); i++)
+    {
+      reader.data = (const guint8 *) contents;
+      reader.length = length;
+      reader.offset = header;
+
+      while (reader.offset < reader.length)
+        {
+          if (!replay_record (&replay, &reader, categories))
+            {
+              g_printerr ("Truncated or invalid record at offset %" G_GSIZE_FORMAT "\n", reader.offset);
+              break;
+            }
+          n_records++;
+        }
+    }
+
+  report (categories, n_records);
+
+  g_hash_table_destroy (replay.stubs);
+  g_object_unref (replay.target);
+  g_object_unref (replay.klass);
+  g_object_unref (replay.context);
+  g_free (contents);
+
+  return 0;
+}